@@ -0,0 +1,460 @@
+// ArrowExport.h - Defines export and import of ParticleColumns through the Arrow C Data Interface.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef ARROWEXPORT_H
+#define ARROWEXPORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ParticleCatalogue.h"
+#include "ParticleColumns.h"
+#include "ParticleKind.h"
+
+// The two ABI-stable structs of the Arrow C Data Interface, declared exactly as the specification
+// gives them (https://arrow.apache.org/docs/format/CDataInterface.html) so that no Arrow library
+// is needed; the guard lets this header coexist with Arrow's own abi.h.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+// Exports columns as one struct array (a record batch to pyarrow, polars, DuckDB, ...) with the
+// fields of the CSV format, in the same order:
+//   kind                     dictionary<uint8, utf8> of kind names
+//   charge ... baryonNumber  float64
+//   leptonNumber             int32
+//   flags                    uint8 (ParticleFlag bits)
+//   calorimeter1..4          float64
+//   name, colour, colour2    dictionary<uint16, utf8>, null where the particle has no such string
+// Numeric buffers are the columns' own vectors: nothing is copied, the columns are kept alive by
+// a shared reference held by every exported array and freed when the last one is released. Only
+// the small string dictionaries and the validity bitmaps of the string fields are built.
+class ArrowExport {
+public:
+  // Export columns, taking ownership; schema and array must be released by the consumer
+  static void exportColumns(ParticleColumns columns, ArrowSchema* schema, ArrowArray* array) {
+    exportColumns(std::make_shared<const ParticleColumns>(std::move(columns)), schema, array);
+  }
+
+  // Export shared columns; they must not be modified until every exported array is released
+  static void exportColumns(std::shared_ptr<const ParticleColumns> columns, ArrowSchema* schema, ArrowArray* array) {
+    exportSchema(schema);
+    exportArray(std::move(columns), array);
+  }
+
+  // Export a catalogue (converted to columns once; the catalogue itself is not referenced)
+  static void exportCatalogue(const ParticleCatalogue& catalogue, ArrowSchema* schema, ArrowArray* array) {
+    exportColumns(ParticleColumns::fromCatalogue(catalogue), schema, array);
+  }
+
+  // Describe the exported struct type
+  static void exportSchema(ArrowSchema* schema) {
+    Schema* root = new Schema("+s", "");
+    for (const Field& field : fields()) {
+      Schema* child = new Schema(field.format, field.name);
+      if (field.dictionary) {
+        child->schema.flags = ARROW_FLAG_NULLABLE;
+        child->setDictionary(new Schema("u", ""));
+      }
+      root->addChild(child);
+    }
+    root->moveTo(schema);
+  }
+
+  // Move columns into a struct array matching exportSchema
+  static void exportArray(std::shared_ptr<const ParticleColumns> columns, ArrowArray* array) {
+    const ParticleColumns& source = *columns;
+    int64_t rows = static_cast<int64_t>(source.size());
+    Array* root = new Array(columns, rows);
+    root->buffers = {nullptr};
+    auto numeric = [&](const void* data) {
+      Array* child = new Array(columns, rows);
+      child->buffers = {nullptr, data};
+      root->addChild(child);
+    };
+    Array* kind = new Array(columns, rows);
+    kind->buffers = {nullptr, source.kind.data()};
+    kind->setDictionary(kindDictionary(columns));
+    root->addChild(kind);
+    for (const auto* column : {&source.charge, &source.spin, &source.energy, &source.px, &source.py, &source.pz,
+                               &source.restMass, &source.baryonNumber}) {
+      numeric(column->data());
+    }
+    numeric(source.leptonNumber.data());
+    numeric(source.flags.data());
+    for (const auto& layer : source.calorimeter) {
+      numeric(layer.data());
+    }
+    for (const auto* ids : {&source.nameId, &source.colourId, &source.colour2Id}) {
+      Array* child = new Array(columns, rows);
+      child->validity.assign((source.size() + 7) / 8, 0);
+      for (size_t row = 0; row < ids->size(); ++row) {
+        if ((*ids)[row] != ParticleColumns::noString) {
+          child->validity[row / 8] |= static_cast<std::uint8_t>(1u << (row % 8));
+        } else {
+          ++child->array.null_count;
+        }
+      }
+      child->buffers = {child->array.null_count > 0 ? child->validity.data() : nullptr, ids->data()};
+      child->setDictionary(stringDictionary(columns));
+      root->addChild(child);
+    }
+    root->moveTo(array);
+  }
+
+  // Copy a struct array with (a subset of) the exported fields into columns, then release both
+  // structs. Fields are matched by name; missing ones get defaults (zero, no string, no flags).
+  // kind may be dictionary<int, utf8> or uint8; strings dictionary<int, utf8> or utf8; numbers
+  // must have the exported types. std::vector cannot adopt foreign buffers, so this side copies.
+  static ParticleColumns importColumns(ArrowSchema* schema, ArrowArray* array) {
+    struct Releaser {
+      ArrowSchema* schema;
+      ArrowArray* array;
+      ~Releaser() {
+        if (array && array->release) {
+          array->release(array);
+        }
+        if (schema && schema->release) {
+          schema->release(schema);
+        }
+      }
+    } releaser{schema, array};
+
+    if (!schema || !array || !schema->release || !array->release) {
+      throw std::invalid_argument("Arrow import needs live schema and array structs");
+    }
+    if (std::strcmp(schema->format, "+s") != 0 || schema->n_children != array->n_children) {
+      throw std::invalid_argument("Arrow import expects a struct array of particle fields");
+    }
+    size_t rows = static_cast<size_t>(array->length);
+    ParticleColumns columns;
+    columns.resize(rows);
+    std::fill(columns.kind.begin(), columns.kind.end(), ParticleKind::Unknown);
+    for (auto* ids : {&columns.nameId, &columns.colourId, &columns.colour2Id}) {
+      std::fill(ids->begin(), ids->end(), ParticleColumns::noString);
+    }
+    bool haveKind = false;
+    for (int64_t i = 0; i < schema->n_children; ++i) {
+      const ArrowSchema& field = *schema->children[i];
+      const ArrowArray& child = *array->children[i];
+      std::string name = field.name ? field.name : "";
+      int64_t offset = array->offset + child.offset;
+      if (name == "kind") {
+        importKinds(field, child, offset, columns);
+        haveKind = true;
+      } else if (name == "leptonNumber") {
+        importNumbers(field, child, offset, "i", columns.leptonNumber);
+      } else if (name == "flags") {
+        importNumbers(field, child, offset, "C", columns.flags);
+      } else if (name == "name" || name == "colour" || name == "colour2") {
+        auto& ids = name == "name" ? columns.nameId : name == "colour" ? columns.colourId : columns.colour2Id;
+        importStrings(field, child, offset, columns, ids);
+      } else if (std::vector<double>* target = doubleColumn(columns, name)) {
+        importNumbers(field, child, offset, "g", *target);
+      }
+    }
+    if (!haveKind) {
+      throw std::invalid_argument("Arrow import needs a kind field");
+    }
+    return columns;
+  }
+
+private:
+  struct Field {
+    const char* name;
+    const char* format; // Index type for dictionary fields
+    bool dictionary;
+  };
+
+  static const std::vector<Field>& fields() {
+    static const std::vector<Field> list = {
+      {"kind", "C", true}, {"charge", "g", false}, {"spin", "g", false}, {"E", "g", false},
+      {"px", "g", false}, {"py", "g", false}, {"pz", "g", false}, {"restMass", "g", false},
+      {"baryonNumber", "g", false}, {"leptonNumber", "i", false}, {"flags", "C", false},
+      {"calorimeter1", "g", false}, {"calorimeter2", "g", false}, {"calorimeter3", "g", false},
+      {"calorimeter4", "g", false}, {"name", "S", true}, {"colour", "S", true}, {"colour2", "S", true}};
+    return list;
+  }
+
+  static std::vector<double>* doubleColumn(ParticleColumns& columns, const std::string& name) {
+    if (name == "charge") return &columns.charge;
+    if (name == "spin") return &columns.spin;
+    if (name == "E") return &columns.energy;
+    if (name == "px") return &columns.px;
+    if (name == "py") return &columns.py;
+    if (name == "pz") return &columns.pz;
+    if (name == "restMass") return &columns.restMass;
+    if (name == "baryonNumber") return &columns.baryonNumber;
+    for (size_t layer = 0; layer < columns.calorimeter.size(); ++layer) {
+      if (name == "calorimeter" + std::to_string(layer + 1)) {
+        return &columns.calorimeter[layer];
+      }
+    }
+    return nullptr;
+  }
+
+  // An exported schema node; private_data of its ArrowSchema, owning its strings and children
+  struct Schema {
+    ArrowSchema schema{};
+    std::string format, name;
+    std::vector<ArrowSchema*> children;
+
+    Schema(const char* format, const char* name) : format(format), name(name) {
+      schema.format = this->format.c_str();
+      schema.name = this->name.c_str();
+      schema.release = &Schema::release;
+      schema.private_data = this;
+    }
+
+    void addChild(Schema* child) { children.push_back(child->detach()); }
+    void setDictionary(Schema* dictionary) { schema.dictionary = dictionary->detach(); }
+
+    // Heap-allocate the public struct for use as a child or dictionary
+    ArrowSchema* detach() {
+      finish();
+      ArrowSchema* node = new ArrowSchema(schema);
+      return node;
+    }
+
+    void moveTo(ArrowSchema* out) {
+      finish();
+      *out = schema;
+    }
+
+    void finish() {
+      schema.n_children = static_cast<int64_t>(children.size());
+      schema.children = children.empty() ? nullptr : children.data();
+    }
+
+    static void release(ArrowSchema* schema) {
+      Schema* self = static_cast<Schema*>(schema->private_data);
+      for (ArrowSchema* child : self->children) {
+        releaseNode(child);
+      }
+      if (schema->dictionary) {
+        releaseNode(schema->dictionary);
+      }
+      delete self;
+      schema->release = nullptr;
+    }
+
+    // Release a child the consumer did not move out, then free the struct this side allocated
+    static void releaseNode(ArrowSchema* node) {
+      if (node->release) {
+        node->release(node);
+      }
+      delete node;
+    }
+  };
+
+  // An exported array node; holds the columns alive and owns any buffers built for the export
+  struct Array {
+    ArrowArray array{};
+    std::shared_ptr<const ParticleColumns> columns;
+    std::vector<const void*> buffers;
+    std::vector<ArrowArray*> children;
+    std::vector<std::uint8_t> validity;
+    std::vector<std::int32_t> offsets;
+    std::string characters;
+
+    Array(std::shared_ptr<const ParticleColumns> columns, int64_t length) : columns(std::move(columns)) {
+      array.length = length;
+      array.release = &Array::release;
+      array.private_data = this;
+    }
+
+    void addChild(Array* child) { children.push_back(child->detach()); }
+    void setDictionary(Array* dictionary) { array.dictionary = dictionary->detach(); }
+
+    ArrowArray* detach() {
+      finish();
+      return new ArrowArray(array);
+    }
+
+    void moveTo(ArrowArray* out) {
+      finish();
+      *out = array;
+    }
+
+    void finish() {
+      array.n_buffers = static_cast<int64_t>(buffers.size());
+      array.buffers = buffers.data();
+      array.n_children = static_cast<int64_t>(children.size());
+      array.children = children.empty() ? nullptr : children.data();
+    }
+
+    static void release(ArrowArray* array) {
+      Array* self = static_cast<Array*>(array->private_data);
+      for (ArrowArray* child : self->children) {
+        releaseNode(child);
+      }
+      if (array->dictionary) {
+        releaseNode(array->dictionary);
+      }
+      delete self;
+      array->release = nullptr;
+    }
+
+    static void releaseNode(ArrowArray* node) {
+      if (node->release) {
+        node->release(node);
+      }
+      delete node;
+    }
+  };
+
+  // A utf8 array of the given strings
+  static Array* utf8Array(const std::shared_ptr<const ParticleColumns>& columns, const std::vector<std::string>& values) {
+    Array* dictionary = new Array(columns, static_cast<int64_t>(values.size()));
+    dictionary->offsets.push_back(0);
+    for (const auto& value : values) {
+      dictionary->characters += value;
+      dictionary->offsets.push_back(static_cast<std::int32_t>(dictionary->characters.size()));
+    }
+    dictionary->buffers = {nullptr, dictionary->offsets.data(), dictionary->characters.data()};
+    return dictionary;
+  }
+
+  static Array* kindDictionary(const std::shared_ptr<const ParticleColumns>& columns) {
+    std::vector<std::string> names;
+    for (size_t kind = 0; kind <= particleKindCount; ++kind) {
+      names.push_back(kindName(static_cast<ParticleKind>(kind)));
+    }
+    return utf8Array(columns, names);
+  }
+
+  static Array* stringDictionary(const std::shared_ptr<const ParticleColumns>& columns) {
+    return utf8Array(columns, columns->strings);
+  }
+
+  static bool isValid(const ArrowArray& array, int64_t index) {
+    const auto* bitmap = static_cast<const std::uint8_t*>(array.buffers[0]);
+    return array.null_count == 0 || !bitmap || (bitmap[index / 8] >> (index % 8) & 1);
+  }
+
+  // Read an integer of any signed or unsigned Arrow width at index
+  static std::int64_t integerAt(const char* format, const void* data, int64_t index) {
+    switch (format[0]) {
+    case 'c': return static_cast<const std::int8_t*>(data)[index];
+    case 'C': return static_cast<const std::uint8_t*>(data)[index];
+    case 's': return static_cast<const std::int16_t*>(data)[index];
+    case 'S': return static_cast<const std::uint16_t*>(data)[index];
+    case 'i': return static_cast<const std::int32_t*>(data)[index];
+    case 'I': return static_cast<const std::uint32_t*>(data)[index];
+    case 'l': return static_cast<const std::int64_t*>(data)[index];
+    case 'L': return static_cast<std::int64_t>(static_cast<const std::uint64_t*>(data)[index]);
+    default: throw std::invalid_argument(std::string("Unsupported Arrow index type ") + format);
+    }
+  }
+
+  // Strings of a utf8 array
+  static std::vector<std::string> utf8Values(const ArrowSchema& schema, const ArrowArray& array) {
+    if (std::strcmp(schema.format, "u") != 0) {
+      throw std::invalid_argument("Arrow dictionary values must be utf8");
+    }
+    const auto* offsets = static_cast<const std::int32_t*>(array.buffers[1]);
+    const auto* characters = static_cast<const char*>(array.buffers[2]);
+    std::vector<std::string> values;
+    for (int64_t i = array.offset; i < array.offset + array.length; ++i) {
+      values.emplace_back(characters + offsets[i], characters + offsets[i + 1]);
+    }
+    return values;
+  }
+
+  template <typename T>
+  static void importNumbers(const ArrowSchema& schema, const ArrowArray& array, int64_t offset, const char* format,
+                            std::vector<T>& target) {
+    if (std::strcmp(schema.format, format) != 0) {
+      throw std::invalid_argument(std::string("Arrow field ") + schema.name + " has format " + schema.format +
+                                  ", expected " + format);
+    }
+    const T* data = static_cast<const T*>(array.buffers[1]) + offset;
+    for (size_t row = 0; row < target.size(); ++row) {
+      target[row] = isValid(array, offset + static_cast<int64_t>(row)) ? data[row] : T();
+    }
+  }
+
+  static void importKinds(const ArrowSchema& schema, const ArrowArray& array, int64_t offset, ParticleColumns& columns) {
+    if (!schema.dictionary) {
+      std::vector<std::uint8_t> values(columns.size());
+      importNumbers(schema, array, offset, "C", values);
+      for (size_t row = 0; row < values.size(); ++row) {
+        columns.kind[row] = values[row] < particleKindCount ? static_cast<ParticleKind>(values[row]) : ParticleKind::Unknown;
+      }
+      return;
+    }
+    std::vector<ParticleKind> kinds;
+    for (const auto& name : utf8Values(*schema.dictionary, *array.dictionary)) {
+      kinds.push_back(kindFromName(name));
+    }
+    for (size_t row = 0; row < columns.size(); ++row) {
+      int64_t index = offset + static_cast<int64_t>(row);
+      if (isValid(array, index)) {
+        columns.kind[row] = kinds.at(static_cast<size_t>(integerAt(schema.format, array.buffers[1], index)));
+      }
+    }
+  }
+
+  static void importStrings(const ArrowSchema& schema, const ArrowArray& array, int64_t offset, ParticleColumns& columns,
+                            std::vector<std::uint16_t>& ids) {
+    if (schema.dictionary) {
+      std::vector<std::uint16_t> remap;
+      for (const auto& value : utf8Values(*schema.dictionary, *array.dictionary)) {
+        remap.push_back(columns.internString(value));
+      }
+      for (size_t row = 0; row < columns.size(); ++row) {
+        int64_t index = offset + static_cast<int64_t>(row);
+        if (isValid(array, index)) {
+          ids[row] = remap.at(static_cast<size_t>(integerAt(schema.format, array.buffers[1], index)));
+        }
+      }
+      return;
+    }
+    if (std::strcmp(schema.format, "u") != 0) {
+      throw std::invalid_argument(std::string("Arrow field ") + schema.name + " must be utf8 or dictionary encoded");
+    }
+    const auto* valueOffsets = static_cast<const std::int32_t*>(array.buffers[1]);
+    const auto* characters = static_cast<const char*>(array.buffers[2]);
+    for (size_t row = 0; row < columns.size(); ++row) {
+      int64_t index = offset + static_cast<int64_t>(row);
+      if (isValid(array, index)) {
+        ids[row] = columns.internString(std::string(characters + valueOffsets[index], characters + valueOffsets[index + 1]));
+      }
+    }
+  }
+};
+
+#endif // ARROWEXPORT_H
@@ -0,0 +1,354 @@
+// AsyncFileStream.h - Defines AsyncInputFile and AsyncOutputFile, file streams whose disk transfers run
+// in the background with double buffering, and MemoryBudget, which bounds the bytes they hold.
+// Author: Raul Scanlon, Date: 03/06/2024
+
+#ifndef ASYNCFILESTREAM_H
+#define ASYNCFILESTREAM_H
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "ThreadPool.h"
+
+// Options for one asynchronous stream
+struct AsyncIoOptions {
+  size_t bufferBytes = 4 << 20; // Size of each buffer (one disk transfer)
+  size_t buffers = 2;           // Buffers in flight: 2 is double buffering
+};
+
+// Byte budget. Every stream reserves its buffers here before allocating them, so concurrent
+// readers and writers together never hold more than the budget. Reservations never wait: one
+// thread may hold many streams open (e.g. the inputs of a merge), and waiting for memory only
+// that thread can release would never end. Streams opened while the budget is tight get
+// smaller buffers instead.
+class MemoryBudget {
+public:
+  explicit MemoryBudget(size_t bytes) : capacity(bytes), available(bytes) {}
+
+  // Reserve up to bytes: all of them while they are at most a quarter of what is free, otherwise
+  // that quarter, but never less than minimum. Throws when not even minimum bytes are free.
+  size_t acquire(size_t bytes, size_t minimum = 0) {
+    minimum = std::min(minimum, bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (available < minimum) {
+      throw std::runtime_error("I/O memory budget exhausted: " + std::to_string(capacity - available) +
+                               " bytes are held by open streams; open fewer files at once");
+    }
+    size_t granted = std::min(bytes, std::max(available / 4, minimum));
+    available -= granted;
+    return granted;
+  }
+
+  void release(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    available += bytes;
+  }
+
+  size_t getCapacity() const { return capacity; }
+
+  size_t getAvailable() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return available;
+  }
+
+  // Budget shared by all asynchronous file streams (256 MiB)
+  static MemoryBudget& io() {
+    static MemoryBudget budget(256 << 20);
+    return budget;
+  }
+
+private:
+  size_t capacity;
+  size_t available;
+  mutable std::mutex mutex;
+};
+
+// Threads that perform the blocking pread/pwrite calls for every stream
+inline ThreadPool& ioThreadPool() {
+  static ThreadPool pool(4);
+  return pool;
+}
+
+// Buffers and bookkeeping shared by the input and output stream buffers. Each slot is one buffer
+// that is either owned by the stream user or in flight on the I/O pool.
+class AsyncBufferSet {
+protected:
+  struct Slot {
+    std::vector<char> data;
+    size_t length = 0;   // Valid bytes (reads) or bytes to write
+    bool busy = false;   // A transfer is in flight
+  };
+
+  static constexpr size_t minimumBufferBytes = 64 << 10; // Smallest buffer when the budget is tight
+
+  // For reading, the buffers are sized down to the file when it is smaller than they are
+  AsyncBufferSet(const std::string& path, int fd, const AsyncIoOptions& options, bool reading) : path(path), fd(fd) {
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    size_t bufferBytes = std::max<size_t>(options.bufferBytes, 4096);
+    size_t count = std::max<size_t>(options.buffers, 1);
+    if (reading) {
+      struct stat info;
+      fileSize = fstat(fd, &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+      size_t perBuffer = (fileSize + count - 1) / count;
+      bufferBytes = std::min(bufferBytes, std::max<size_t>((perBuffer + 4095) / 4096 * 4096, 4096));
+    }
+    try {
+      reserved = MemoryBudget::io().acquire(bufferBytes * count, std::min(bufferBytes, minimumBufferBytes) * count);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    bufferBytes = std::max<size_t>(reserved / count, 1);
+    slots.resize(count);
+    for (auto& slot : slots) {
+      slot.data.resize(bufferBytes);
+    }
+  }
+
+  ~AsyncBufferSet() {
+    waitAll();
+    close(fd);
+    MemoryBudget::io().release(reserved);
+  }
+
+  // Run a transfer for a slot on the I/O pool
+  template <typename Transfer>
+  void submit(size_t index, Transfer transfer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slots[index].busy = true;
+    }
+    ioThreadPool().submit([this, index, transfer]() {
+      std::exception_ptr failure;
+      try {
+        transfer(slots[index]);
+      } catch (...) {
+        failure = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (failure && !error) {
+        error = failure;
+      }
+      slots[index].busy = false;
+      done.notify_all();
+    });
+  }
+
+  // Wait until a slot is back from the pool; rethrows the first transfer error
+  Slot& wait(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return !slots[index].busy; });
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return slots[index];
+  }
+
+  void waitAll() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] {
+      return std::none_of(slots.begin(), slots.end(), [](const Slot& slot) { return slot.busy; });
+    });
+  }
+
+  std::string path;
+  int fd;
+  size_t fileSize = 0; // Size of a file being read
+  std::vector<Slot> slots;
+  size_t reserved = 0;
+  std::mutex mutex;
+  std::condition_variable done;
+  std::exception_ptr error;
+};
+
+// Stream buffer that keeps the next chunks of a file being read ahead while the current one is parsed
+class AsyncReadBuffer : public std::streambuf, private AsyncBufferSet {
+public:
+  AsyncReadBuffer(const std::string& path, const AsyncIoOptions& options)
+    : AsyncBufferSet(path, open(path.c_str(), O_RDONLY | O_CLOEXEC), options, true) {
+    for (size_t index = 0; index < slots.size(); ++index) {
+      readAhead(index);
+    }
+  }
+
+  size_t size() const { return fileSize; }
+
+protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (started) {
+      readAhead(current); // The consumer is done with this buffer; refill it with a later chunk
+      current = (current + 1) % slots.size();
+    }
+    started = true;
+    Slot& slot = wait(current);
+    if (slot.length == 0) {
+      return traits_type::eof();
+    }
+    setg(slot.data.data(), slot.data.data(), slot.data.data() + slot.length);
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  size_t nextOffset = 0; // File offset of the next chunk to schedule
+  size_t current = 0;
+  bool started = false;
+
+  void readAhead(size_t index) {
+    size_t offset = nextOffset;
+    size_t length = offset < fileSize ? std::min(slots[index].data.size(), fileSize - offset) : 0;
+    nextOffset += length;
+    if (length == 0) {
+      slots[index].length = 0;
+      return;
+    }
+    submit(index, [this, offset, length](Slot& slot) {
+      size_t total = 0;
+      while (total < length) {
+        ssize_t got = pread(fd, slot.data.data() + total, length - total, static_cast<off_t>(offset + total));
+        if (got < 0 && errno == EINTR) {
+          continue;
+        }
+        if (got <= 0) {
+          throw std::runtime_error("Failed reading " + path + ": " + (got < 0 ? std::strerror(errno) : "unexpected end of file"));
+        }
+        total += static_cast<size_t>(got);
+      }
+      slot.length = total;
+    });
+  }
+};
+
+// Stream buffer that hands each full buffer to the I/O pool and keeps filling the next one;
+// writing only blocks when every buffer is still in flight
+class AsyncWriteBuffer : public std::streambuf, private AsyncBufferSet {
+public:
+  AsyncWriteBuffer(const std::string& path, const AsyncIoOptions& options)
+    : AsyncBufferSet(path, open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644), options, false) {
+    setp(slots[0].data.data(), slots[0].data.data() + slots[0].data.size());
+  }
+
+  ~AsyncWriteBuffer() override {
+    try {
+      finish();
+    } catch (...) {
+      // Errors are reported by an explicit finish(); a destructor must not throw
+    }
+  }
+
+  // Write out everything buffered and wait for it to reach the file
+  void finish() {
+    if (finished) {
+      return;
+    }
+    finished = true;
+    flushCurrent();
+    waitAll();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    flushCurrent();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char* data, std::streamsize count) override {
+    std::streamsize written = 0;
+    while (written < count) {
+      if (pptr() == epptr()) {
+        flushCurrent();
+      }
+      std::streamsize chunk = std::min<std::streamsize>(count - written, epptr() - pptr());
+      std::memcpy(pptr(), data + written, static_cast<size_t>(chunk));
+      pbump(static_cast<int>(chunk));
+      written += chunk;
+    }
+    return written;
+  }
+
+private:
+  size_t nextOffset = 0;
+  size_t current = 0;
+  bool finished = false;
+
+  // Send the current buffer to the pool and switch to the next one once its last write is done
+  void flushCurrent() {
+    size_t length = static_cast<size_t>(pptr() - pbase());
+    if (length > 0) {
+      size_t offset = nextOffset;
+      nextOffset += length;
+      slots[current].length = length;
+      submit(current, [this, offset](Slot& slot) {
+        size_t total = 0;
+        while (total < slot.length) {
+          ssize_t put = pwrite(fd, slot.data.data() + total, slot.length - total, static_cast<off_t>(offset + total));
+          if (put < 0 && errno == EINTR) {
+            continue;
+          }
+          if (put < 0) {
+            throw std::runtime_error("Failed writing " + path + ": " + std::strerror(errno));
+          }
+          total += static_cast<size_t>(put);
+        }
+      });
+      current = (current + 1) % slots.size();
+    }
+    Slot& slot = wait(current);
+    setp(slot.data.data(), slot.data.data() + slot.data.size());
+  }
+};
+
+// Input file stream backed by AsyncReadBuffer
+class AsyncInputFile : public std::istream {
+public:
+  explicit AsyncInputFile(const std::string& path, const AsyncIoOptions& options = AsyncIoOptions())
+    : std::istream(nullptr), buffer(path, options) {
+    rdbuf(&buffer);
+  }
+
+  // Get the file size in bytes
+  size_t size() const { return buffer.size(); }
+
+private:
+  AsyncReadBuffer buffer;
+};
+
+// Output file stream backed by AsyncWriteBuffer; call close() to surface write errors
+class AsyncOutputFile : public std::ostream {
+public:
+  explicit AsyncOutputFile(const std::string& path, const AsyncIoOptions& options = AsyncIoOptions())
+    : std::ostream(nullptr), buffer(path, options) {
+    rdbuf(&buffer);
+  }
+
+  void close() { buffer.finish(); }
+
+private:
+  AsyncWriteBuffer buffer;
+};
+
+#endif // ASYNCFILESTREAM_H
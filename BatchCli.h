@@ -0,0 +1,842 @@
+// BatchCli.h - Defines BatchCli, the non-interactive command-line driver used for batch jobs.
+// Author: Raul Scanlon, Date: 31/05/2024
+
+#ifndef BATCHCLI_H
+#define BATCHCLI_H
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "CatalogueIO.h"
+#include "CatalogueMerge.h"
+#include "CatalogueWriter.h"
+#include "CutFlow.h"
+#include "FilterExpression.h"
+#include "GroupBy.h"
+#include "JetClustering.h"
+#include "LorentzTransform.h"
+#include "MemoryAccounting.h"
+#include "MomentumColumns.h"
+#include "NumaColumns.h"
+#include "ColumnAggregates.h"
+#include "ColumnKey.h"
+#include "ParticleGenerator.h"
+#include "QueryServer.h"
+#include "ShardedCatalogue.h"
+#ifdef __cpp_impl_coroutine
+#include "ParticleStreams.h"
+#endif
+
+// Options shared by every subcommand
+struct CliOptions {
+  std::string command;
+  std::vector<std::string> inputs;
+  std::string output;                          // File, or directory when there are several inputs
+  std::optional<CatalogueFormat> inputFormat;  // Defaults to the input file extension
+  std::optional<CatalogueFormat> outputFormat; // Defaults to the output file extension
+  unsigned threads = 0;
+  size_t count = 1000000;
+  std::uint64_t seed = 1;
+  std::string type;
+  std::string key = "charge";
+  bool descending = false;
+  bool ascending = false;
+  size_t limit = 100;
+  double tolerance = 0.0;
+  bool dedup = false;
+  int mantissaBits = 52;
+  size_t queueDepth = 2;
+  std::string socketPath;
+  int port = -1;
+  std::string algorithm = "antikt";
+  double radius = 0.4;
+  double minPt = 0.0;
+  size_t eventSize = 0;                        // Rows per event for jets; 0 treats each input as one event
+  bool decay = false;
+  size_t batchRows = 65536;
+  bool memoryReport = false;
+  std::vector<std::string> cuts;               // Cut-flow steps, applied in order
+  std::string groupBy = "kind";
+  size_t shards = 2;
+  std::string partition = "hash";
+  std::string where;                           // Filter expression for query
+};
+
+// Scripted replacement for ParticleCatalogue::handleUserInput:
+//   particles <command> [options] [input files...]
+// Several input files are processed as a pipeline whose read, compute and write stages
+// run on separate threads connected by bounded queues, so disk transfers overlap computation.
+class BatchCli {
+public:
+  // Run a command line, returning the process exit code
+  int run(int argc, char** argv) {
+    try {
+      CliOptions options = parse(argc, argv);
+      int status = execute(options);
+      if (options.memoryReport && MemoryTracker::isEnabled()) {
+        MemoryTracker& tracker = MemoryTracker::global();
+        std::cerr << "heap_live_bytes " << tracker.getLiveBytes() << '\n'
+                  << "heap_peak_bytes " << tracker.getPeakBytes() << '\n'
+                  << "heap_allocations " << tracker.getAllocationCount() << '\n';
+      }
+      return status;
+    } catch (const std::exception& error) {
+      std::cerr << "Error: " << error.what() << '\n';
+      return 1;
+    }
+  }
+
+  static void printUsage(std::ostream& out) {
+    out << "Usage: particles <command> [options] [inputs...]\n"
+        << "Commands:\n"
+        << "  generate   Write --count random particles to --output\n"
+        << "  import     Convert inputs to --output-format\n"
+        << "  query      Keep particles of --type and/or matching --where\n"
+        << "  aggregate  Print totals and per-kind counts\n"
+        << "  sort       Sort by --key (charge, energy, pt, mass, eta, ...)\n"
+        << "  top        Keep the --limit particles with the largest --key (smallest with --ascending)\n"
+        << "  quantiles  Print approximate quantiles of --key\n"
+        << "  merge      Merge inputs already sorted by --key into --output (with --dedup, drop duplicates)\n"
+        << "  cmframe    Boost each input into its centre-of-mass frame\n"
+        << "  jets       Cluster the quarks and gluons of each event into jets\n"
+        << "  groupby    Count, sum and summarise particles per group of --by fields\n"
+        << "  cutflow    Apply each --cut in turn and print the rows surviving every step\n"
+        << "  dedup      Drop particles equal in kind and four-momentum (within --tolerance)\n"
+        << "  diff       Report added, removed and changed particles between two inputs\n"
+        << "  dump       Print particles as text\n"
+        << "  bench      Time the main operations on --count generated particles\n"
+        << "  numabench  Measure scan bandwidth between NUMA nodes and time node-local aggregates\n"
+        << "  serve      Load inputs once and answer queries on --socket or --port\n"
+        << "  shard      Split inputs across --shards worker processes and answer serve queries through a\n"
+        << "             coordinator on --socket or --port, or one request per stdin line without either\n"
+        << "  stream     Generate --count particles (or read inputs) batch by batch, optionally --decay them,\n"
+        << "             and print totals, quantiles and a histogram of --key; rows go to --output if given\n"
+        << "Options:\n"
+        << "  -o, --output PATH         Output file (directory for several inputs); stdout if omitted\n"
+        << "  --input-format FORMAT     csv or pcat (default: from extension)\n"
+        << "  --output-format FORMAT    csv, pcat or text (default: from extension)\n"
+        << "  -j, --threads N           Worker threads (default: all cores; per node for numabench)\n"
+        << "  --count N, --seed S       Generation size and seed\n"
+        << "  --type KIND               Particle kind for query\n"
+        << "  --where EXPR              Filter for query, e.g. 'kind==Electron && E>20 && abs(charge)==1', over\n"
+        << "                            kind, charge, spin, E, px, py, pz, pt, m, restmass, eta, phi, baryon,\n"
+        << "                            lepton, calo1-4, isolated, interacting; also accepted by --cut\n"
+        << "  --key KEY, --descending   Sort key and order\n"
+        << "  --limit N, --ascending    Number of particles kept by top (default 100) and order\n"
+        << "  --tolerance X, --dedup    Momentum tolerance for dedup/diff/merge (default exact)\n"
+        << "  --mantissa-bits N         Lossy momentum precision for pcat output (default 52)\n"
+        << "  --queue-depth N           Files buffered between pipeline stages (default 2)\n"
+        << "  --socket PATH, --port N   UNIX socket or loopback TCP port for serve and shard (shard workers\n"
+        << "                            listen on PATH.0, PATH.1, ...)\n"
+        << "  --shards N                Worker processes for shard (default 2)\n"
+        << "  --partition P             Rows to shards by hash (kind and momentum within --tolerance) or by\n"
+        << "                            event (--event-size rows each, dealt round robin; default hash)\n"
+        << "  --algorithm A, --radius R Jet algorithm (antikt, kt, ca) and radius (default antikt, 0.4)\n"
+        << "  --min-pt X                Smallest jet pt reported (MeV)\n"
+        << "  --event-size N            Consecutive rows per event for jets (default: whole input)\n"
+        << "  --cut SPEC                Cut-flow step: kind=muon[,tau], charge=+|-|0, isolated, energy>X, pt<X,\n"
+        << "                            mass=LOW:HIGH (any --key), calofractionN=LOW:HIGH; join with | for OR\n"
+        << "  --by FIELDS               Group keys for groupby: kind, charge, antiparticle, colour, KEY:WIDTH\n"
+        << "                            (e.g. kind,charge or kind,pt:10000; default kind)\n"
+        << "  --decay                   Replace unstable particles by their decay products (stream)\n"
+        << "  --batch-rows N            Rows per batch for stream and for loading shards (default 65536)\n"
+        << "  --memory-report           Instead of the usual output, report the bytes each result takes as\n"
+        << "                            columns and as a ParticleCatalogue, by kind and component; builds with\n"
+        << "                            -DPARTICLES_TRACK_ALLOCATIONS add the measured heap during ingest, and\n"
+        << "                            other commands then print their heap peak to stderr\n";
+  }
+
+private:
+  // A file moving through the pipeline
+  struct Job {
+    size_t index = 0;
+    std::string input;
+    ParticleColumns columns;
+    std::string report;     // Text output, written instead of columns when hasReport is set
+    bool hasReport = false;
+  };
+
+  using Stage = std::function<void(Job&, const CliOptions&)>;
+
+  CliOptions parse(int argc, char** argv) const {
+    if (argc < 2) {
+      throw std::invalid_argument("No command given (try 'help')");
+    }
+    CliOptions options;
+    options.command = argv[1];
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto value = [&]() -> std::string {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Missing value for " + arg);
+        }
+        return argv[++i];
+      };
+      if (arg == "-o" || arg == "--output") options.output = value();
+      else if (arg == "--input-format") options.inputFormat = catalogueFormatFromName(value());
+      else if (arg == "--output-format") options.outputFormat = catalogueFormatFromName(value());
+      else if (arg == "-j" || arg == "--threads") options.threads = static_cast<unsigned>(std::stoul(value()));
+      else if (arg == "--count") options.count = std::stoull(value());
+      else if (arg == "--seed") options.seed = std::stoull(value());
+      else if (arg == "--type") options.type = value();
+      else if (arg == "--key") options.key = value();
+      else if (arg == "--descending") options.descending = true;
+      else if (arg == "--ascending") options.ascending = true;
+      else if (arg == "--limit") options.limit = std::stoull(value());
+      else if (arg == "--tolerance") options.tolerance = std::stod(value());
+      else if (arg == "--dedup") options.dedup = true;
+      else if (arg == "--mantissa-bits") options.mantissaBits = std::stoi(value());
+      else if (arg == "--queue-depth") options.queueDepth = std::stoull(value());
+      else if (arg == "--socket") options.socketPath = value();
+      else if (arg == "--port") options.port = std::stoi(value());
+      else if (arg == "--algorithm") options.algorithm = value();
+      else if (arg == "--radius") options.radius = std::stod(value());
+      else if (arg == "--min-pt") options.minPt = std::stod(value());
+      else if (arg == "--event-size") options.eventSize = std::stoull(value());
+      else if (arg == "--decay") options.decay = true;
+      else if (arg == "--memory-report") options.memoryReport = true;
+      else if (arg == "--cut") options.cuts.push_back(value());
+      else if (arg == "--by") options.groupBy = value();
+      else if (arg == "--batch-rows") options.batchRows = std::stoull(value());
+      else if (arg == "--shards") options.shards = std::stoull(value());
+      else if (arg == "--partition") options.partition = value();
+      else if (arg == "--where") options.where = value();
+      else if (!arg.empty() && arg[0] == '-') throw std::invalid_argument("Unknown option " + arg);
+      else options.inputs.push_back(arg);
+    }
+    return options;
+  }
+
+  int execute(const CliOptions& options) {
+    const std::string& command = options.command;
+    if (command == "help" || command == "--help" || command == "-h") {
+      printUsage(std::cout);
+      return 0;
+    }
+    if (command == "generate") return generate(options);
+    if (command == "bench") return bench(options);
+    if (command == "numabench") return numaBench(options);
+    if (command == "serve") return serve(options);
+    if (command == "shard") return shard(options);
+    if (command == "merge") return merge(options);
+    if (command == "diff") return diff(options);
+    if (command == "stream") return stream(options);
+
+    Stage stage;
+    if (command == "import") {
+      stage = [](Job&, const CliOptions&) {};
+    } else if (command == "query") {
+      std::optional<FilterExpression> where;
+      if (!options.where.empty()) {
+        where.emplace(options.where); // Compiled once, before any input is read
+      }
+      stage = [where](Job& job, const CliOptions& opts) { query(job, opts, where ? &*where : nullptr); };
+    } else if (command == "aggregate") {
+      stage = [](Job& job, const CliOptions& opts) {
+        std::ostringstream report;
+        report << "# " << job.input << '\n';
+        computeTotals(job.columns, opts.threads).print(report);
+        job.report = report.str();
+        job.hasReport = true;
+      };
+    } else if (command == "sort") {
+      stage = [](Job& job, const CliOptions& opts) { sortColumns(job, opts); };
+    } else if (command == "top") {
+      stage = [](Job& job, const CliOptions& opts) {
+        ColumnKey key = columnKeyFromName(opts.key);
+        job.columns = job.columns.gather(topKRows(job.columns, key, opts.limit, !opts.ascending, opts.threads));
+      };
+    } else if (command == "quantiles") {
+      stage = [](Job& job, const CliOptions& opts) { quantiles(job, opts); };
+    } else if (command == "jets") {
+      stage = [](Job& job, const CliOptions& opts) { jets(job, opts); };
+    } else if (command == "groupby") {
+      GroupBy groupBy = GroupBy::parse(options.groupBy);
+      stage = [groupBy](Job& job, const CliOptions& opts) {
+        std::ostringstream report;
+        report << "# " << job.input << '\n';
+        groupBy.run(job.columns, opts.threads).print(report);
+        job.report = report.str();
+        job.hasReport = true;
+      };
+    } else if (command == "cutflow") {
+      CutFlow flow;
+      for (const auto& cut : options.cuts) {
+        if (FilterExpression::looksLikeExpression(cut)) {
+          flow.add(expressionCut(cut));
+        } else {
+          flow.add(cut);
+        }
+      }
+      stage = [flow](Job& job, const CliOptions& opts) {
+        std::ostringstream report;
+        report << "# " << job.input << '\n';
+        flow.run(job.columns, opts.threads).print(report);
+        job.report = report.str();
+        job.hasReport = true;
+      };
+    } else if (command == "cmframe") {
+      stage = [](Job& job, const CliOptions& opts) {
+        FourMomentum total = computeTotals(job.columns, opts.threads).getTotalFourMomentum();
+        LorentzTransform::toRestFrame(total).apply(job.columns, opts.threads);
+      };
+    } else if (command == "dedup") {
+      stage = [](Job& job, const CliOptions& opts) { Deduplicator(opts.tolerance, opts.threads).filter(job.columns); };
+    } else if (command == "dump") {
+      stage = [](Job& job, const CliOptions&) {
+        std::ostringstream text;
+        writeTextRows(job.columns, 0, job.columns.size(), text);
+        job.report = text.str();
+        job.hasReport = true;
+      };
+    } else {
+      throw std::invalid_argument("Unknown command '" + command + "' (try 'help')");
+    }
+    if (options.inputs.empty()) {
+      throw std::invalid_argument("No input files given");
+    }
+    runPipeline(options, stage);
+    return 0;
+  }
+
+  // Read -> stage -> write, one thread per step, with at most queueDepth files waiting between steps
+  void runPipeline(const CliOptions& options, const Stage& stage) {
+    BoundedQueue<Job> readQueue(options.queueDepth), writeQueue(options.queueDepth);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    auto fail = [&](std::exception_ptr error) {
+      std::lock_guard<std::mutex> lock(failureMutex);
+      if (!failure) {
+        failure = error;
+      }
+      readQueue.close();
+      writeQueue.close();
+    };
+
+    std::thread reader([&]() {
+      try {
+        for (size_t index = 0; index < options.inputs.size(); ++index) {
+          Job job;
+          job.index = index;
+          job.input = options.inputs[index];
+          CatalogueFormat format = options.inputFormat.value_or(catalogueFormatFromPath(job.input));
+          job.columns = readCatalogue(job.input, format, options.threads);
+          if (!readQueue.push(std::move(job))) {
+            return;
+          }
+        }
+        readQueue.close();
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    });
+
+    std::thread worker([&]() {
+      try {
+        while (auto job = readQueue.pop()) {
+          stage(*job, options);
+          if (options.memoryReport) {
+            memoryReport(*job);
+          }
+          if (!writeQueue.push(std::move(*job))) {
+            return;
+          }
+        }
+        writeQueue.close();
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    });
+
+    try {
+      std::ofstream reportFile;
+      while (auto job = writeQueue.pop()) {
+        writeJob(*job, options, reportFile);
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+    reader.join();
+    worker.join();
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
+  }
+
+  // Write a finished job to stdout, the output file, or a file inside the output directory
+  void writeJob(const Job& job, const CliOptions& options, std::ofstream& reportFile) const {
+    bool several = options.inputs.size() > 1;
+    if (job.hasReport) {
+      if (options.output.empty()) {
+        std::cout << job.report;
+        return;
+      }
+      if (!reportFile.is_open()) {
+        reportFile.open(options.output);
+        if (!reportFile) {
+          throw std::runtime_error("Cannot open " + options.output + " for writing");
+        }
+      }
+      reportFile << job.report;
+      return;
+    }
+
+    CatalogueFormat format = options.outputFormat.value_or(
+        options.output.empty() ? CatalogueFormat::Text : catalogueFormatFromPath(options.output));
+    if (options.output.empty()) {
+      if (format == CatalogueFormat::Compressed) {
+        throw std::invalid_argument("Compressed output needs --output");
+      }
+      if (format == CatalogueFormat::Csv) {
+        writeCsv(job.columns, std::cout);
+      } else {
+        writeTextRows(job.columns, 0, job.columns.size(), std::cout);
+      }
+      return;
+    }
+
+    std::string path = options.output;
+    if (several) {
+      mkdir(options.output.c_str(), 0755);
+      std::string name = job.input.substr(job.input.find_last_of('/') + 1);
+      name = name.substr(0, name.find_last_of('.'));
+      path = options.output + "/" + name + "." + catalogueFormatExtension(format);
+    }
+    writeCatalogue(job.columns, path, format, compressionOptions(options));
+  }
+
+  static CompressionOptions compressionOptions(const CliOptions& options) {
+    CompressionOptions compression;
+    compression.threads = options.threads;
+    compression.momentumMantissaBits = options.mantissaBits;
+    return compression;
+  }
+
+  static void query(Job& job, const CliOptions& options, const FilterExpression* where) {
+    if (where) {
+      RowMask selected = where->evaluate(job.columns, options.threads);
+      job.columns.eraseRowsIf([&](size_t row) { return !selected.test(row); });
+    }
+    if (options.type.empty()) {
+      return;
+    }
+    ParticleKind kind = kindFromName(options.type);
+    if (kind == ParticleKind::Unknown) {
+      throw std::invalid_argument("Unknown particle type " + options.type);
+    }
+    job.columns.eraseRowsIf([&](size_t row) { return job.columns.kind[row] != kind; });
+  }
+
+  static void sortColumns(Job& job, const CliOptions& options) {
+    ColumnKey key = columnKeyFromName(options.key);
+    std::vector<double> values(job.columns.size());
+    parallelFor(values.size(), options.threads, [&](size_t begin, size_t end, size_t) {
+      columnKeyValues(job.columns, key, begin, end, values.data() + begin);
+    });
+    std::vector<size_t> order(values.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    if (options.descending) {
+      std::stable_sort(order.begin(), order.end(), [&values](size_t a, size_t b) { return values[a] > values[b]; });
+    } else {
+      std::stable_sort(order.begin(), order.end(), [&values](size_t a, size_t b) { return values[a] < values[b]; });
+    }
+    job.columns = job.columns.gather(order);
+  }
+
+  // Report the jets of every event as "event jet pt rapidity phi mass constituents" lines
+  static void jets(Job& job, const CliOptions& options) {
+    JetDefinition definition;
+    definition.algorithm = jetAlgorithmFromName(options.algorithm);
+    definition.radius = options.radius;
+    definition.ptMin = options.minPt;
+    std::vector<size_t> eventStarts;
+    size_t eventSize = options.eventSize == 0 ? std::max<size_t>(job.columns.size(), 1) : options.eventSize;
+    for (size_t start = 0; start < job.columns.size(); start += eventSize) {
+      eventStarts.push_back(start);
+    }
+    auto events = JetClusterer(definition).clusterEvents(job.columns, eventStarts, options.threads);
+    std::ostringstream report;
+    report << "event jet pt rapidity phi mass constituents\n";
+    for (size_t event = 0; event < events.size(); ++event) {
+      for (size_t index = 0; index < events[event].size(); ++index) {
+        const Jet& jet = events[event][index];
+        report << event << ' ' << index << ' ' << jet.pt() << ' ' << jet.rapidity() << ' ' << jet.phi() << ' '
+               << jet.momentum.invariantMass() << ' ' << jet.constituents.size() << '\n';
+      }
+    }
+    job.report = report.str();
+    job.hasReport = true;
+  }
+
+  // Replace a job's output by what its particles cost as columns and once ingested into a
+  // ParticleCatalogue. Heap counts come from the MemoryTracker hook and are process-wide.
+  static void memoryReport(Job& job) {
+    std::ostringstream report;
+    report << "# " << job.input << '\n';
+    measureColumnsMemory(job.columns).print(report);
+    MemoryTracker& tracker = MemoryTracker::global();
+    long long before = static_cast<long long>(tracker.getLiveBytes());
+    tracker.resetPeak();
+    {
+      ParticleCatalogue catalogue;
+      job.columns.appendTo(catalogue);
+      long long live = static_cast<long long>(tracker.getLiveBytes()) - before;
+      long long peak = static_cast<long long>(tracker.getPeakBytes()) - before;
+      measureCatalogueMemory(catalogue).print(report);
+      if (MemoryTracker::isEnabled()) {
+        report << "heap_catalogue_live_bytes " << live << '\n'
+               << "heap_ingest_peak_bytes " << peak << '\n';
+      } else {
+        report << "# heap counts need a build with -DPARTICLES_TRACK_ALLOCATIONS\n";
+      }
+    }
+    job.report = report.str();
+    job.hasReport = true;
+  }
+
+  // Report sketch quantiles of a key, e.g. for trigger thresholds
+  static void quantiles(Job& job, const CliOptions& options) {
+    QuantileSketch sketch = keyQuantileSketch(job.columns, columnKeyFromName(options.key), options.threads);
+    std::ostringstream report;
+    report << "# " << job.input << '\n' << "count " << sketch.getCount() << '\n';
+    if (!sketch.empty()) {
+      for (double q : {0.0, 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 1.0}) {
+        report << "q" << q << ' ' << sketch.quantile(q) << '\n';
+      }
+    }
+    job.report = report.str();
+    job.hasReport = true;
+  }
+
+  int generate(const CliOptions& options) {
+    if (options.output.empty()) {
+      throw std::invalid_argument("generate needs --output");
+    }
+    ParticleGenerator generator;
+    generator.threads = options.threads;
+    ParticleColumns columns = generator.generate(options.count, options.seed);
+    writeCatalogue(columns, options.output, options.outputFormat.value_or(catalogueFormatFromPath(options.output)),
+                   compressionOptions(options));
+    return 0;
+  }
+
+  // Generate (or read) -> decay -> summarise one batch at a time; memory does not grow with --count
+  int stream(const CliOptions& options) {
+#ifdef __cpp_impl_coroutine
+    ParticleGenerator generator;
+    generator.threads = options.threads;
+    Generator<ParticleColumns> batches = options.inputs.empty()
+        ? generateBatches(generator, options.count, options.seed, options.batchRows)
+        : readBatches(options.inputs, options.inputFormat, options.batchRows);
+    if (options.decay) {
+      batches = decayBatches(std::move(batches), DecayEngine(options.seed));
+    }
+    std::unique_ptr<CatalogueWriter> writer;
+    if (!options.output.empty()) {
+      writer = std::make_unique<CatalogueWriter>(options.output, options.outputFormat, compressionOptions(options));
+    }
+    StreamSummary summary(columnKeyFromName(options.key), options.threads);
+    for (const ParticleColumns& batch : batches) {
+      summary.add(batch);
+      if (writer) {
+        writer->write(batch);
+      }
+    }
+    if (writer) {
+      writer->finish();
+    }
+    summary.print(std::cout);
+    return 0;
+#else
+    (void)options;
+    throw std::runtime_error("stream needs a build with C++20 coroutines");
+#endif
+  }
+
+  // Stream a k-way merge of sorted inputs into one output, one batch per input in memory
+  int merge(const CliOptions& options) {
+    if (options.inputs.empty()) {
+      throw std::invalid_argument("No input files given");
+    }
+    std::vector<std::unique_ptr<CatalogueReader>> readers;
+    std::vector<CatalogueReader*> inputs;
+    for (const auto& input : options.inputs) {
+      readers.push_back(std::make_unique<CatalogueReader>(input, options.inputFormat));
+      inputs.push_back(readers.back().get());
+    }
+    CatalogueWriter writer(options.output, options.outputFormat, compressionOptions(options));
+    Deduplicator deduplicator(options.tolerance, options.threads);
+    mergeSorted(inputs, columnKeyFromName(options.key), options.descending, [&](const ParticleColumns& batch) {
+      if (!options.dedup) {
+        writer.write(batch);
+        return;
+      }
+      ParticleColumns unique = batch;
+      deduplicator.filter(unique);
+      writer.write(unique);
+    });
+    writer.finish();
+    if (options.dedup && !options.output.empty()) {
+      std::cerr << "Merged " << writer.getRowsWritten() << " particles, dropped "
+                << deduplicator.getDuplicateCount() << " duplicates\n";
+    }
+    return 0;
+  }
+
+  // Compare two catalogues and print a summary followed by up to --limit rows of each change
+  int diff(const CliOptions& options) {
+    if (options.inputs.size() != 2) {
+      throw std::invalid_argument("diff needs exactly two inputs");
+    }
+    auto load = [&](const std::string& path) {
+      return readCatalogue(path, options.inputFormat.value_or(catalogueFormatFromPath(path)), options.threads);
+    };
+    ParticleColumns before = load(options.inputs[0]);
+    ParticleColumns after = load(options.inputs[1]);
+    CatalogueDiff result = diffCatalogues(before, after, options.tolerance, options.threads);
+    std::ostringstream report;
+    report << "removed " << result.removed.size() << '\n'
+           << "added " << result.added.size() << '\n'
+           << "changed " << result.changed.size() << '\n'
+           << "unchanged " << result.unchanged << '\n';
+    for (size_t i = 0; i < std::min(options.limit, result.removed.size()); ++i) {
+      report << "- ";
+      writeTextRows(before, result.removed[i], result.removed[i] + 1, report);
+    }
+    for (size_t i = 0; i < std::min(options.limit, result.added.size()); ++i) {
+      report << "+ ";
+      writeTextRows(after, result.added[i], result.added[i] + 1, report);
+    }
+    for (size_t i = 0; i < std::min(options.limit, result.changed.size()); ++i) {
+      report << "< ";
+      writeTextRows(before, result.changed[i].first, result.changed[i].first + 1, report);
+      report << "> ";
+      writeTextRows(after, result.changed[i].second, result.changed[i].second + 1, report);
+    }
+    if (options.output.empty()) {
+      std::cout << report.str();
+    } else {
+      std::ofstream out(options.output);
+      if (!(out << report.str())) {
+        throw std::runtime_error("Cannot write " + options.output);
+      }
+    }
+    return result.identical() ? 0 : 2;
+  }
+
+  // Load every input into one in-memory catalogue and serve queries until SIGINT/SIGTERM
+  int serve(const CliOptions& options) {
+    if (options.socketPath.empty() && options.port < 0) {
+      throw std::invalid_argument("serve needs --socket or --port");
+    }
+    ParticleColumns columns;
+    for (const auto& input : options.inputs) {
+      columns.appendColumns(readCatalogue(input, options.inputFormat.value_or(catalogueFormatFromPath(input)), options.threads));
+    }
+    QueryServer server(std::move(columns), options.threads);
+    return serveUntilStopped(server, options);
+  }
+
+  // Partition the inputs across worker processes and answer queries through a coordinator
+  int shard(const CliOptions& options) {
+    if (options.inputs.empty()) {
+      throw std::invalid_argument("shard needs inputs");
+    }
+    ShardPartition partition = shardPartitionFromName(options.partition);
+    if (partition == ShardPartition::Event && options.eventSize == 0) {
+      throw std::invalid_argument("--partition event needs --event-size");
+    }
+    // Every worker streams the inputs batch by batch and keeps only its own rows
+    auto load = [&options, partition](size_t shard) {
+      ParticleColumns columns, batch;
+      size_t firstRow = 0;
+      for (const auto& input : options.inputs) {
+        CatalogueReader reader(input, options.inputFormat, options.batchRows);
+        while (reader.next(batch)) {
+          appendShardRows(columns, batch, firstRow, shard, options.shards, partition, options.eventSize, options.tolerance);
+          firstRow += batch.size();
+        }
+      }
+      return columns;
+    };
+    std::string prefix = options.socketPath.empty() ? "/tmp/particles-shard-" + std::to_string(getpid()) : options.socketPath;
+    ShardWorkers workers(options.shards, prefix, load, options.threads);
+    ShardCoordinator coordinator(workers.getSocketPaths());
+    if (options.socketPath.empty() && options.port < 0) {
+      std::string request;
+      while (std::getline(std::cin, request)) {
+        if (!request.empty()) {
+          std::cout << coordinator.handle(request) << std::endl;
+        }
+      }
+      return 0;
+    }
+    QueryServer server([&coordinator](const std::string& request) { return coordinator.handle(request); }, options.threads);
+    return serveUntilStopped(server, options);
+  }
+
+  // Listen on --socket and/or --port and answer requests until SIGINT/SIGTERM
+  static int serveUntilStopped(QueryServer& server, const CliOptions& options) {
+    if (!options.socketPath.empty()) {
+      server.listenUnix(options.socketPath);
+      std::cerr << "Listening on " << options.socketPath << '\n';
+    }
+    if (options.port >= 0) {
+      std::cerr << "Listening on 127.0.0.1:" << server.listenTcp(options.port) << '\n';
+    }
+    activeServer() = &server;
+    std::signal(SIGINT, stopActiveServer);
+    std::signal(SIGTERM, stopActiveServer);
+    server.run();
+    activeServer() = nullptr;
+    return 0;
+  }
+
+  static QueryServer*& activeServer() {
+    static QueryServer* server = nullptr;
+    return server;
+  }
+
+  static void stopActiveServer(int) {
+    if (activeServer()) {
+      activeServer()->stop();
+    }
+  }
+
+  // Time each operation on freshly generated data
+  int bench(const CliOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    auto report = [&options](const char* name, Clock::time_point start) {
+      double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      std::cout << name << ' ' << seconds * 1e3 << " ms, "
+                << (seconds > 0 ? options.count / seconds / 1e6 : 0.0) << " Mrows/s\n";
+    };
+
+    ParticleGenerator generator;
+    generator.threads = options.threads;
+    auto start = Clock::now();
+    ParticleColumns columns = generator.generate(options.count, options.seed);
+    report("generate", start);
+
+    start = Clock::now();
+    CompressedCatalogue compressed = CompressedCatalogue::compress(columns, compressionOptions(options));
+    report("compress", start);
+    std::cout << "compression_ratio "
+              << static_cast<double>(compressed.getUncompressedBytes()) / std::max<size_t>(1, compressed.getCompressedBytes())
+              << '\n';
+
+    start = Clock::now();
+    ParticleColumns restored = compressed.decompress(options.threads);
+    report("decompress", start);
+
+    start = Clock::now();
+    ColumnTotals totals = computeTotals(restored, options.threads);
+    report("aggregate", start);
+
+    auto floatMomenta = MomentumColumns<float>::fromColumns(restored, options.threads);
+    auto doubleMomenta = MomentumColumns<double>::fromColumns(restored, options.threads);
+    start = Clock::now();
+    FourMomentum naiveSum = sumMomentum(doubleMomenta, SummationPolicy::Naive, options.threads);
+    report("sum_double_naive", start);
+    start = Clock::now();
+    FourMomentum compensatedSum = sumMomentum(doubleMomenta, SummationPolicy::Compensated, options.threads);
+    report("sum_double_compensated", start);
+    start = Clock::now();
+    FourMomentum floatSum = sumMomentum(floatMomenta, SummationPolicy::Compensated, options.threads);
+    report("sum_float_compensated", start);
+    std::cout << "sum_pz naive " << naiveSum.getPz() << " compensated " << compensatedSum.getPz()
+              << " float " << floatSum.getPz() << '\n';
+
+    Job job;
+    job.columns = std::move(restored);
+    start = Clock::now();
+    sortColumns(job, options);
+    report("sort", start);
+
+    start = Clock::now();
+    std::ostringstream csv;
+    writeCsv(job.columns, csv);
+    report("csv_write", start);
+    return totals.rows == options.count ? 0 : 1;
+  }
+
+  // Report read bandwidth for every (CPU node, memory node) pair, then time totals over columns
+  // partitioned by node against the same scan over unpartitioned columns
+  int numaBench(const CliOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    NumaThreadPool pool(options.threads);
+    const NumaTopology& topology = pool.getTopology();
+    size_t nodes = pool.nodeCount();
+    std::cout << "numa_nodes " << nodes << '\n';
+    for (size_t node = 0; node < nodes; ++node) {
+      std::cout << "node " << topology.getNodes()[node].id << " cpus " << topology.getNodes()[node].cpus.size()
+                << " workers " << pool.threadsOnNode(node) << '\n';
+    }
+
+    // One array of --count doubles per memory node, bound to it and then scanned from each node
+    for (size_t memoryNode = 0; memoryNode < nodes; ++memoryNode) {
+      std::vector<double> data;
+      pool.forEachNode([&](size_t node) {
+        if (node == memoryNode) {
+          data.assign(options.count, 1.0);
+          topology.bindMemory(data.data(), data.size() * sizeof(double), memoryNode);
+        }
+      });
+      for (size_t cpuNode = 0; cpuNode < nodes; ++cpuNode) {
+        std::vector<size_t> counts(nodes, 0);
+        counts[cpuNode] = data.size();
+        std::vector<double> sums(pool.threadsOnNode(cpuNode), 0.0);
+        double best = 0;
+        for (int repeat = 0; repeat < 3; ++repeat) {
+          auto start = Clock::now();
+          pool.parallelForNodes(counts, [&](size_t, size_t begin, size_t end, size_t chunk) {
+            sums[chunk] = std::accumulate(data.begin() + begin, data.begin() + end, 0.0);
+          });
+          double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+          best = std::max(best, seconds > 0 ? data.size() * sizeof(double) / seconds / 1e9 : 0.0);
+        }
+        std::cout << "bandwidth cpu_node " << topology.getNodes()[cpuNode].id << " memory_node "
+                  << topology.getNodes()[memoryNode].id << ' ' << best << " GB/s\n";
+      }
+    }
+
+    auto report = [&options](const char* name, Clock::time_point start) {
+      double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      std::cout << name << ' ' << seconds * 1e3 << " ms, "
+                << (seconds > 0 ? options.count / seconds / 1e6 : 0.0) << " Mrows/s\n";
+    };
+    ParticleGenerator generator;
+    generator.threads = options.threads == 0 ? 0 : options.threads * static_cast<unsigned>(nodes);
+    ParticleColumns columns = generator.generate(options.count, options.seed);
+    auto start = Clock::now();
+    ColumnTotals flat = computeTotals(columns, generator.threads);
+    report("aggregate_flat", start);
+    for (NumaPlacement placement : {NumaPlacement::FirstTouch, NumaPlacement::Interleave}) {
+      NumaPartitionedColumns partitioned = NumaPartitionedColumns::build(columns, pool, placement);
+      start = Clock::now();
+      ColumnTotals totals = partitioned.computeTotals(pool);
+      report(placement == NumaPlacement::FirstTouch ? "aggregate_first_touch" : "aggregate_interleave", start);
+      if (totals.rows != flat.rows) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+};
+
+#endif // BATCHCLI_H
@@ -0,0 +1,66 @@
+// BoundedQueue.h - Defines BoundedQueue, a blocking fixed-capacity queue connecting pipeline stages.
+// Author: Raul Scanlon, Date: 31/05/2024
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Multi-producer, multi-consumer queue; push blocks while full, pop blocks while empty.
+// After close(), pushes are rejected and pop drains the remaining items and then returns nullopt.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity == 0 ? 1 : capacity) {}
+
+  // Add an item, waiting for space; returns false if the queue was closed
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // Take the oldest item, waiting for one; returns nullopt once closed and empty
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty()) {
+      return std::nullopt;
+    }
+    T item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return item;
+  }
+
+  // Stop accepting items and wake every waiting thread
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return items.size();
+  }
+
+private:
+  mutable std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed = false;
+};
+
+#endif // BOUNDEDQUEUE_H
@@ -0,0 +1,225 @@
+// CatalogueIO.h - Defines reading and writing of catalogue columns as CSV, compressed (.pcat) or text files.
+// Author: Raul Scanlon, Date: 31/05/2024
+
+#ifndef CATALOGUEIO_H
+#define CATALOGUEIO_H
+
+#include <charconv>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "AsyncFileStream.h"
+#include "CompressedCatalogue.h"
+#include "ParticleColumns.h"
+
+// On-disk catalogue formats
+enum class CatalogueFormat {
+  Csv,         // One particle per line, header row first
+  Compressed,  // CompressedCatalogue file
+  Text         // Human-readable dump (write only)
+};
+
+// Look up a format by name: "csv", "pcat" or "text"
+inline CatalogueFormat catalogueFormatFromName(const std::string& name) {
+  if (name == "csv") return CatalogueFormat::Csv;
+  if (name == "pcat" || name == "compressed") return CatalogueFormat::Compressed;
+  if (name == "text" || name == "txt") return CatalogueFormat::Text;
+  throw std::invalid_argument("Unknown catalogue format: " + name);
+}
+
+// Guess a format from a file extension, defaulting to CSV
+inline CatalogueFormat catalogueFormatFromPath(const std::string& path) {
+  auto dot = path.rfind('.');
+  std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+  if (extension == "pcat") return CatalogueFormat::Compressed;
+  if (extension == "txt") return CatalogueFormat::Text;
+  return CatalogueFormat::Csv;
+}
+
+// File extension used for a format
+inline std::string catalogueFormatExtension(CatalogueFormat format) {
+  switch (format) {
+  case CatalogueFormat::Compressed: return "pcat";
+  case CatalogueFormat::Text: return "txt";
+  default: return "csv";
+  }
+}
+
+// Append a number in shortest round-trip form
+inline void appendCsvNumber(std::string& line, double value) {
+  char buffer[32];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  line.append(buffer, result.ptr);
+}
+
+inline void appendCsvNumber(std::string& line, long value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  line.append(buffer, result.ptr);
+}
+
+// Parse a whole CSV field as a number
+template <typename T>
+T parseCsvNumber(const std::string& field, size_t lineNumber) {
+  T value{};
+  auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+  if (result.ec != std::errc() || result.ptr != field.data() + field.size()) {
+    throw std::runtime_error("Invalid number '" + field + "' on line " + std::to_string(lineNumber));
+  }
+  return value;
+}
+
+// Column header of the CSV format
+inline const char* catalogueCsvHeader() {
+  return "kind,charge,spin,E,px,py,pz,restMass,baryonNumber,leptonNumber,flags,"
+         "calorimeter1,calorimeter2,calorimeter3,calorimeter4,name,colour,colour2";
+}
+
+// Write rows [begin, end) as CSV lines (no header)
+inline void writeCsvRows(const ParticleColumns& columns, size_t begin, size_t end, std::string& out) {
+  for (size_t row = begin; row < end; ++row) {
+    out += kindName(columns.kind[row]);
+    for (double value : {columns.charge[row], columns.spin[row], columns.energy[row], columns.px[row],
+                         columns.py[row], columns.pz[row], columns.restMass[row], columns.baryonNumber[row]}) {
+      out += ',';
+      appendCsvNumber(out, value);
+    }
+    out += ',';
+    appendCsvNumber(out, static_cast<long>(columns.leptonNumber[row]));
+    out += ',';
+    appendCsvNumber(out, static_cast<long>(columns.flags[row]));
+    for (const auto& layer : columns.calorimeter) {
+      out += ',';
+      appendCsvNumber(out, layer[row]);
+    }
+    for (std::uint16_t id : {columns.nameId[row], columns.colourId[row], columns.colour2Id[row]}) {
+      out += ',';
+      out += columns.stringAt(id);
+    }
+    out += '\n';
+  }
+}
+
+// Write columns as CSV with a header row
+inline void writeCsv(const ParticleColumns& columns, std::ostream& out) {
+  out << catalogueCsvHeader() << '\n';
+  std::string chunk;
+  for (size_t begin = 0; begin < columns.size(); begin += 4096) {
+    chunk.clear();
+    writeCsvRows(columns, begin, std::min(columns.size(), begin + 4096), chunk);
+    out.write(chunk.data(), chunk.size());
+  }
+}
+
+// Append up to maxRows CSV rows from in to columns, returning the number read; lineNumber
+// carries the position between calls so a file can be read in batches
+inline size_t readCsvRows(std::istream& in, ParticleColumns& columns, size_t maxRows, size_t& lineNumber) {
+  std::string line;
+  std::vector<std::string> fields;
+  size_t rows = 0;
+  while (rows < maxRows && std::getline(in, line)) {
+    ++lineNumber;
+    if (line.empty() || (lineNumber == 1 && line.rfind("kind,", 0) == 0)) {
+      continue;
+    }
+    fields.clear();
+    size_t start = 0;
+    while (true) {
+      size_t comma = line.find(',', start);
+      fields.push_back(line.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+      if (comma == std::string::npos) {
+        break;
+      }
+      start = comma + 1;
+    }
+    if (fields.size() != 18) {
+      throw std::runtime_error("Expected 18 fields on line " + std::to_string(lineNumber));
+    }
+    ParticleKind kind = kindFromName(fields[0]);
+    if (kind == ParticleKind::Unknown) {
+      throw std::runtime_error("Unknown particle kind '" + fields[0] + "' on line " + std::to_string(lineNumber));
+    }
+    columns.kind.push_back(kind);
+    columns.charge.push_back(parseCsvNumber<double>(fields[1], lineNumber));
+    columns.spin.push_back(parseCsvNumber<double>(fields[2], lineNumber));
+    columns.energy.push_back(parseCsvNumber<double>(fields[3], lineNumber));
+    columns.px.push_back(parseCsvNumber<double>(fields[4], lineNumber));
+    columns.py.push_back(parseCsvNumber<double>(fields[5], lineNumber));
+    columns.pz.push_back(parseCsvNumber<double>(fields[6], lineNumber));
+    columns.restMass.push_back(parseCsvNumber<double>(fields[7], lineNumber));
+    columns.baryonNumber.push_back(parseCsvNumber<double>(fields[8], lineNumber));
+    columns.leptonNumber.push_back(parseCsvNumber<std::int32_t>(fields[9], lineNumber));
+    columns.flags.push_back(parseCsvNumber<std::uint8_t>(fields[10], lineNumber));
+    for (size_t layer = 0; layer < 4; ++layer) {
+      columns.calorimeter[layer].push_back(parseCsvNumber<double>(fields[11 + layer], lineNumber));
+    }
+    auto stringId = [&columns](const std::string& value) {
+      return value.empty() ? ParticleColumns::noString : columns.internString(value);
+    };
+    columns.nameId.push_back(stringId(fields[15]));
+    columns.colourId.push_back(stringId(fields[16]));
+    columns.colour2Id.push_back(stringId(fields[17]));
+    ++rows;
+  }
+  if (in.bad()) {
+    throw std::runtime_error("Read error after line " + std::to_string(lineNumber));
+  }
+  return rows;
+}
+
+// Read CSV written by writeCsv
+inline ParticleColumns readCsv(std::istream& in) {
+  ParticleColumns columns;
+  size_t lineNumber = 0;
+  readCsvRows(in, columns, std::numeric_limits<size_t>::max(), lineNumber);
+  return columns;
+}
+
+// Write rows [begin, end) in a readable one-line-per-particle form, similar to Particle::print()
+inline void writeTextRows(const ParticleColumns& columns, size_t begin, size_t end, std::ostream& out) {
+  for (size_t row = begin; row < end; ++row) {
+    out << kindName(columns.kind[row]);
+    if (columns.nameId[row] != ParticleColumns::noString) {
+      out << " (" << columns.stringAt(columns.nameId[row]) << ")";
+    }
+    out << ": Charge = " << columns.charge[row] << ", Spin = " << columns.spin[row]
+        << ", Rest Mass = " << columns.restMass[row] << ", Momentum = E: " << columns.energy[row]
+        << ", px: " << columns.px[row] << ", py: " << columns.py[row] << ", pz: " << columns.pz[row] << '\n';
+  }
+}
+
+// Read a catalogue file
+inline ParticleColumns readCatalogue(const std::string& path, CatalogueFormat format, unsigned threads = 0) {
+  if (format == CatalogueFormat::Compressed) {
+    return CompressedCatalogue::load(path).decompress(threads);
+  }
+  if (format == CatalogueFormat::Text) {
+    throw std::invalid_argument("Text dumps cannot be read back");
+  }
+  AsyncInputFile in(path);
+  return readCsv(in);
+}
+
+// Write a catalogue file
+inline void writeCatalogue(const ParticleColumns& columns, const std::string& path, CatalogueFormat format,
+                           const CompressionOptions& options = CompressionOptions()) {
+  if (format == CatalogueFormat::Compressed) {
+    CompressedCatalogue::compress(columns, options).save(path);
+    return;
+  }
+  AsyncOutputFile out(path);
+  if (format == CatalogueFormat::Text) {
+    writeTextRows(columns, 0, columns.size(), out);
+  } else {
+    writeCsv(columns, out);
+  }
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Failed writing " + path);
+  }
+}
+
+#endif // CATALOGUEIO_H
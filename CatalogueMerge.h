@@ -0,0 +1,262 @@
+// CatalogueMerge.h - Defines k-way merging, duplicate removal and diffing of catalogue columns.
+// Author: Raul Scanlon, Date: 02/06/2024
+
+#ifndef CATALOGUEMERGE_H
+#define CATALOGUEMERGE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "CatalogueReader.h"
+#include "ColumnKey.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+
+// Identity of a particle for duplicate detection: its kind and its four-momentum rounded to a
+// grid of the given tolerance. Particles that share a key are duplicates; with tolerance 0
+// the key holds the exact bit patterns.
+struct MomentumKey {
+  ParticleKind kind = ParticleKind::Unknown;
+  std::int64_t e = 0, px = 0, py = 0, pz = 0;
+
+  bool operator==(const MomentumKey& other) const {
+    return kind == other.kind && e == other.e && px == other.px && py == other.py && pz == other.pz;
+  }
+
+  // Build the key of one row
+  static MomentumKey of(const ParticleColumns& columns, size_t row, double tolerance) {
+    auto quantize = [tolerance](double value) -> std::int64_t {
+      if (tolerance <= 0) {
+        std::int64_t bits;
+        value = value == 0 ? 0.0 : value; // -0 and +0 are the same momentum
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+      }
+      return static_cast<std::int64_t>(std::floor(value / tolerance + 0.5));
+    };
+    return {columns.kind[row], quantize(columns.energy[row]), quantize(columns.px[row]), quantize(columns.py[row]),
+            quantize(columns.pz[row])};
+  }
+};
+
+struct MomentumKeyHash {
+  size_t operator()(const MomentumKey& key) const {
+    std::uint64_t hash = static_cast<std::uint64_t>(key.kind) * 0x9E3779B97F4A7C15ULL;
+    for (std::int64_t part : {key.e, key.px, key.py, key.pz}) {
+      hash ^= static_cast<std::uint64_t>(part) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    }
+    hash ^= hash >> 31;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return static_cast<size_t>(hash ^ (hash >> 29));
+  }
+};
+
+// Compute the key and its hash for every row, in parallel
+inline void computeMomentumKeys(const ParticleColumns& columns, double tolerance, unsigned threads,
+                                std::vector<MomentumKey>& keys, std::vector<size_t>& hashes) {
+  keys.resize(columns.size());
+  hashes.resize(columns.size());
+  parallelFor(columns.size(), threads, [&](size_t begin, size_t end, size_t) {
+    for (size_t row = begin; row < end; ++row) {
+      keys[row] = MomentumKey::of(columns, row, tolerance);
+      hashes[row] = MomentumKeyHash()(keys[row]);
+    }
+  });
+}
+
+// Removes rows whose key was already seen, across any number of batches. The seen keys are
+// split into one shard per thread by hash, so every thread dedups its own shard of each batch
+// without locking; memory grows with the number of distinct keys, not with the rows read.
+class Deduplicator {
+public:
+  explicit Deduplicator(double tolerance = 0.0, unsigned threads = 0)
+    : tolerance(tolerance), threads(threads == 0 ? defaultThreadCount() : threads), seen(this->threads) {}
+
+  // Get the rows of batch whose key has not been seen before (first occurrence wins), in order
+  std::vector<size_t> uniqueRows(const ParticleColumns& batch) {
+    std::vector<MomentumKey> keys;
+    std::vector<size_t> hashes;
+    computeMomentumKeys(batch, tolerance, threads, keys, hashes);
+    std::vector<std::uint8_t> keep(batch.size(), 0);
+    parallelFor(seen.size(), threads, [&](size_t begin, size_t end, size_t) {
+      for (size_t shard = begin; shard < end; ++shard) {
+        for (size_t row = 0; row < batch.size(); ++row) {
+          if (hashes[row] % seen.size() == shard && seen[shard].insert(keys[row]).second) {
+            keep[row] = 1;
+          }
+        }
+      }
+    });
+    std::vector<size_t> rows;
+    for (size_t row = 0; row < batch.size(); ++row) {
+      if (keep[row]) {
+        rows.push_back(row);
+      }
+    }
+    duplicates += batch.size() - rows.size();
+    return rows;
+  }
+
+  // Drop duplicate rows from batch in place
+  void filter(ParticleColumns& batch) {
+    std::vector<size_t> rows = uniqueRows(batch);
+    if (rows.size() != batch.size()) {
+      batch.retainRows(rows);
+    }
+  }
+
+  size_t getDuplicateCount() const { return duplicates; }
+
+private:
+  double tolerance;
+  unsigned threads;
+  std::vector<std::unordered_set<MomentumKey, MomentumKeyHash>> seen;
+  size_t duplicates = 0;
+};
+
+// Merge inputs that are each sorted by key (ascending, or descending if requested) into one
+// sorted sequence, handed to sink in batches of batchRows. Only one batch per input is held in
+// memory. Ties are taken from the earlier input first.
+inline void mergeSorted(std::vector<CatalogueReader*> inputs, ColumnKey key, bool descending,
+                        const std::function<void(const ParticleColumns&)>& sink, size_t batchRows = 65536) {
+  struct Cursor {
+    ParticleColumns batch;
+    size_t row = 0;
+    double value = 0;
+  };
+  std::vector<Cursor> cursors(inputs.size());
+  // Heap entries are input indices; the input whose current value ranks first is on top
+  auto after = [&](size_t a, size_t b) {
+    if (cursors[a].value != cursors[b].value) {
+      return descending ? cursors[a].value < cursors[b].value : cursors[a].value > cursors[b].value;
+    }
+    return a > b;
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(after)> heap(after);
+  auto advance = [&](size_t input) {
+    Cursor& cursor = cursors[input];
+    while (cursor.row >= cursor.batch.size()) {
+      if (!inputs[input]->next(cursor.batch)) {
+        return;
+      }
+      cursor.row = 0;
+    }
+    cursor.value = columnKeyValue(cursor.batch, key, cursor.row);
+    heap.push(input);
+  };
+  for (size_t input = 0; input < inputs.size(); ++input) {
+    advance(input);
+  }
+
+  ParticleColumns output;
+  output.reserve(batchRows);
+  while (!heap.empty()) {
+    size_t input = heap.top();
+    heap.pop();
+    Cursor& cursor = cursors[input];
+    output.appendRow(cursor.batch, cursor.row++);
+    if (output.size() >= batchRows) {
+      sink(output);
+      output = ParticleColumns();
+      output.reserve(batchRows);
+    }
+    advance(input);
+  }
+  if (output.size() > 0) {
+    sink(output);
+  }
+}
+
+// Rows that differ between two catalogues. Particles are matched by MomentumKey; a matched pair
+// whose other attributes (charge, spin, masses, quantum numbers, flags, energy deposits or
+// names) differ is reported as changed.
+struct CatalogueDiff {
+  std::vector<size_t> removed;                     // Rows of `before` with no match in `after`
+  std::vector<size_t> added;                       // Rows of `after` with no match in `before`
+  std::vector<std::pair<size_t, size_t>> changed;  // (row in before, row in after)
+  size_t unchanged = 0;
+
+  bool identical() const { return removed.empty() && added.empty() && changed.empty(); }
+};
+
+// Check whether two matched rows carry the same attributes
+inline bool sameAttributes(const ParticleColumns& a, size_t rowA, const ParticleColumns& b, size_t rowB) {
+  if (a.charge[rowA] != b.charge[rowB] || a.spin[rowA] != b.spin[rowB] || a.restMass[rowA] != b.restMass[rowB] ||
+      a.baryonNumber[rowA] != b.baryonNumber[rowB] || a.leptonNumber[rowA] != b.leptonNumber[rowB] ||
+      a.flags[rowA] != b.flags[rowB]) {
+    return false;
+  }
+  for (size_t layer = 0; layer < 4; ++layer) {
+    if (a.calorimeter[layer][rowA] != b.calorimeter[layer][rowB]) {
+      return false;
+    }
+  }
+  return a.stringAt(a.nameId[rowA]) == b.stringAt(b.nameId[rowB]) &&
+         a.stringAt(a.colourId[rowA]) == b.stringAt(b.colourId[rowB]) &&
+         a.stringAt(a.colour2Id[rowA]) == b.stringAt(b.colour2Id[rowB]);
+}
+
+// Diff two catalogues in memory. Keys are sharded by hash across threads; within a key,
+// rows are paired in order, so repeated particles are matched as a multiset.
+inline CatalogueDiff diffCatalogues(const ParticleColumns& before, const ParticleColumns& after,
+                                    double tolerance = 0.0, unsigned threads = 0) {
+  std::vector<MomentumKey> keysBefore, keysAfter;
+  std::vector<size_t> hashesBefore, hashesAfter;
+  computeMomentumKeys(before, tolerance, threads, keysBefore, hashesBefore);
+  computeMomentumKeys(after, tolerance, threads, keysAfter, hashesAfter);
+
+  size_t shards = threads == 0 ? defaultThreadCount() : threads;
+  std::vector<CatalogueDiff> partials(shards);
+  parallelFor(shards, threads, [&](size_t begin, size_t end, size_t) {
+    for (size_t shard = begin; shard < end; ++shard) {
+      CatalogueDiff& partial = partials[shard];
+      std::unordered_map<MomentumKey, std::vector<size_t>, MomentumKeyHash> pending;
+      for (size_t row = before.size(); row-- > 0;) {
+        if (hashesBefore[row] % shards == shard) {
+          pending[keysBefore[row]].push_back(row); // Reversed, so back() is the earliest row
+        }
+      }
+      for (size_t row = 0; row < after.size(); ++row) {
+        if (hashesAfter[row] % shards != shard) {
+          continue;
+        }
+        auto found = pending.find(keysAfter[row]);
+        if (found == pending.end() || found->second.empty()) {
+          partial.added.push_back(row);
+          continue;
+        }
+        size_t match = found->second.back();
+        found->second.pop_back();
+        if (sameAttributes(before, match, after, row)) {
+          ++partial.unchanged;
+        } else {
+          partial.changed.emplace_back(match, row);
+        }
+      }
+      for (const auto& entry : pending) {
+        partial.removed.insert(partial.removed.end(), entry.second.begin(), entry.second.end());
+      }
+    }
+  });
+
+  CatalogueDiff diff;
+  for (const auto& partial : partials) {
+    diff.removed.insert(diff.removed.end(), partial.removed.begin(), partial.removed.end());
+    diff.added.insert(diff.added.end(), partial.added.begin(), partial.added.end());
+    diff.changed.insert(diff.changed.end(), partial.changed.begin(), partial.changed.end());
+    diff.unchanged += partial.unchanged;
+  }
+  std::sort(diff.removed.begin(), diff.removed.end());
+  std::sort(diff.added.begin(), diff.added.end());
+  std::sort(diff.changed.begin(), diff.changed.end());
+  return diff;
+}
+
+#endif // CATALOGUEMERGE_H
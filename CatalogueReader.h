@@ -0,0 +1,73 @@
+// CatalogueReader.h - Defines CatalogueReader, which reads a catalogue file or columns in bounded batches.
+// Author: Raul Scanlon, Date: 02/06/2024
+
+#ifndef CATALOGUEREADER_H
+#define CATALOGUEREADER_H
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "CatalogueIO.h"
+
+// Yields a catalogue as a sequence of column batches so that files larger than memory can be
+// processed. Compressed files are decoded one block at a time (the compressed image stays in
+// memory); CSV files are parsed batchRows lines at a time while the next chunks are read ahead.
+class CatalogueReader {
+public:
+  CatalogueReader(const std::string& path, std::optional<CatalogueFormat> format = std::nullopt, size_t batchRows = 65536)
+    : name(path), batchRows(std::max<size_t>(batchRows, 1)) {
+    CatalogueFormat resolved = format.value_or(catalogueFormatFromPath(path));
+    if (resolved == CatalogueFormat::Compressed) {
+      compressed = std::make_unique<CompressedCatalogue>(CompressedCatalogue::load(path));
+    } else if (resolved == CatalogueFormat::Csv) {
+      csv = std::make_unique<AsyncInputFile>(path);
+    } else {
+      throw std::invalid_argument("Text dumps cannot be read back");
+    }
+  }
+
+  // Read columns that are already in memory in batches (the columns must outlive the reader)
+  explicit CatalogueReader(const ParticleColumns& columns, size_t batchRows = 65536)
+    : name("<memory>"), batchRows(std::max<size_t>(batchRows, 1)), memory(&columns) {}
+
+  // Replace batch with the next rows; returns false once the input is exhausted
+  bool next(ParticleColumns& batch) {
+    if (compressed) {
+      if (nextBlock >= compressed->getBlockCount()) {
+        return false;
+      }
+      batch = compressed->decompressBlock(nextBlock++);
+      return true;
+    }
+    if (csv) {
+      batch = ParticleColumns();
+      return readCsvRows(*csv, batch, batchRows, lineNumber) > 0;
+    }
+    if (nextRow >= memory->size()) {
+      return false;
+    }
+    std::vector<size_t> rows;
+    for (size_t row = nextRow; row < std::min(memory->size(), nextRow + batchRows); ++row) {
+      rows.push_back(row);
+    }
+    nextRow += rows.size();
+    batch = memory->gather(rows);
+    return true;
+  }
+
+  const std::string& getName() const { return name; }
+
+private:
+  std::string name;
+  size_t batchRows;
+  std::unique_ptr<CompressedCatalogue> compressed;
+  size_t nextBlock = 0;
+  std::unique_ptr<AsyncInputFile> csv;
+  size_t lineNumber = 0;
+  const ParticleColumns* memory = nullptr;
+  size_t nextRow = 0;
+};
+
+#endif // CATALOGUEREADER_H
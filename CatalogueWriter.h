@@ -0,0 +1,83 @@
+// CatalogueWriter.h - Defines CatalogueWriter, which writes a catalogue file one batch of columns at a time.
+// Author: Raul Scanlon, Date: 02/06/2024
+
+#ifndef CATALOGUEWRITER_H
+#define CATALOGUEWRITER_H
+
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "CatalogueIO.h"
+
+// Counterpart of CatalogueReader. CSV and text rows are written as each batch arrives, with the
+// disk writes running in the background; compressed output keeps only the encoded blocks in
+// memory and writes the file on finish().
+// An empty path writes CSV or text to standard output.
+class CatalogueWriter {
+public:
+  CatalogueWriter(const std::string& path, std::optional<CatalogueFormat> format = std::nullopt,
+                  const CompressionOptions& options = CompressionOptions())
+    : path(path), options(options) {
+    this->format = format.value_or(path.empty() ? CatalogueFormat::Text : catalogueFormatFromPath(path));
+    if (this->format == CatalogueFormat::Compressed) {
+      if (path.empty()) {
+        throw std::invalid_argument("Compressed output needs a file path");
+      }
+      return;
+    }
+    if (!path.empty()) {
+      file = std::make_unique<AsyncOutputFile>(path);
+    }
+    if (this->format == CatalogueFormat::Csv) {
+      stream() << catalogueCsvHeader() << '\n';
+    }
+  }
+
+  // Append a batch of rows
+  void write(const ParticleColumns& batch) {
+    rowsWritten += batch.size();
+    if (format == CatalogueFormat::Compressed) {
+      compressed.append(batch, options);
+    } else if (format == CatalogueFormat::Csv) {
+      std::string chunk;
+      writeCsvRows(batch, 0, batch.size(), chunk);
+      stream().write(chunk.data(), chunk.size());
+    } else {
+      writeTextRows(batch, 0, batch.size(), stream());
+    }
+    if (!stream()) {
+      throw std::runtime_error("Failed writing " + path);
+    }
+  }
+
+  // Flush everything to disk; call once after the last batch
+  void finish() {
+    if (format == CatalogueFormat::Compressed) {
+      compressed.save(path);
+    } else {
+      stream().flush();
+      if (file) {
+        file->close();
+      }
+      if (!stream()) {
+        throw std::runtime_error("Failed writing " + path);
+      }
+    }
+  }
+
+  size_t getRowsWritten() const { return rowsWritten; }
+
+private:
+  std::string path;
+  CatalogueFormat format;
+  CompressionOptions options;
+  std::unique_ptr<AsyncOutputFile> file; // Null when writing to standard output
+  CompressedCatalogue compressed;
+  size_t rowsWritten = 0;
+
+  std::ostream& stream() { return file ? static_cast<std::ostream&>(*file) : std::cout; }
+};
+
+#endif // CATALOGUEWRITER_H
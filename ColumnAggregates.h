@@ -0,0 +1,104 @@
+// ColumnAggregates.h - Defines ColumnTotals, mergeable catalogue totals computed over particle columns.
+// Author: Raul Scanlon, Date: 31/05/2024
+
+#ifndef COLUMNAGGREGATES_H
+#define COLUMNAGGREGATES_H
+
+#include <array>
+#include <cmath>
+#include <ostream>
+#include <vector>
+#include "CompensatedSum.h"
+#include "FourMomentum.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+
+// Totals over a set of rows; partial totals from separate ranges (or files) merge by addition
+struct ColumnTotals {
+  size_t rows = 0;
+  double energy = 0, px = 0, py = 0, pz = 0;
+  double charge = 0;
+  long leptonNumber = 0;
+  double baryonNumber = 0;
+  std::array<size_t, particleKindCount + 1> kindCounts{};
+
+  // Add the totals of another range
+  void merge(const ColumnTotals& other) {
+    rows += other.rows;
+    energy += other.energy;
+    px += other.px;
+    py += other.py;
+    pz += other.pz;
+    charge += other.charge;
+    leptonNumber += other.leptonNumber;
+    baryonNumber += other.baryonNumber;
+    for (size_t kind = 0; kind < kindCounts.size(); ++kind) {
+      kindCounts[kind] += other.kindCounts[kind];
+    }
+  }
+
+  FourMomentum getTotalFourMomentum() const { return FourMomentum(energy, px, py, pz); }
+
+  // Write the totals as "name value" lines
+  void print(std::ostream& out) const {
+    out << "rows " << rows << '\n'
+        << "total_E " << energy << '\n'
+        << "total_px " << px << '\n'
+        << "total_py " << py << '\n'
+        << "total_pz " << pz << '\n'
+        << "total_charge " << charge << '\n'
+        << "total_lepton_number " << leptonNumber << '\n'
+        << "total_baryon_number " << baryonNumber << '\n';
+    for (size_t kind = 0; kind < particleKindCount; ++kind) {
+      if (kindCounts[kind] > 0) {
+        out << "count_" << kindName(static_cast<ParticleKind>(kind)) << ' ' << kindCounts[kind] << '\n';
+      }
+    }
+  }
+};
+
+// Compute totals over rows [begin, end); sums of real-valued columns follow the summation policy
+inline ColumnTotals computeTotals(const ParticleColumns& columns, size_t begin, size_t end,
+                                  SummationPolicy policy = SummationPolicy::Compensated) {
+  ColumnTotals totals;
+  totals.rows = end - begin;
+  MomentumAccumulator momentum(policy);
+  NeumaierSum charge, baryonNumber;
+  for (size_t row = begin; row < end; ++row) {
+    momentum.add(columns.energy[row], columns.px[row], columns.py[row], columns.pz[row]);
+    if (policy == SummationPolicy::Compensated) {
+      charge.add(columns.charge[row]);
+      baryonNumber.add(columns.baryonNumber[row]);
+    } else {
+      totals.charge += columns.charge[row];
+      totals.baryonNumber += columns.baryonNumber[row];
+    }
+    totals.leptonNumber += columns.leptonNumber[row];
+    totals.kindCounts[static_cast<size_t>(columns.kind[row])]++;
+  }
+  FourMomentum total = momentum.getTotal();
+  totals.energy = total.getEnergy();
+  totals.px = total.getPx();
+  totals.py = total.getPy();
+  totals.pz = total.getPz();
+  totals.charge += charge.value();
+  totals.baryonNumber += baryonNumber.value();
+  return totals;
+}
+
+// Compute totals over all rows with per-thread partials merged at the end
+inline ColumnTotals computeTotals(const ParticleColumns& columns, unsigned threads = 0,
+                                  SummationPolicy policy = SummationPolicy::Compensated) {
+  size_t workers = threads == 0 ? defaultThreadCount() : threads;
+  std::vector<ColumnTotals> partials(workers);
+  parallelFor(columns.size(), threads, [&](size_t begin, size_t end, size_t chunk) {
+    partials[chunk] = computeTotals(columns, begin, end, policy);
+  });
+  ColumnTotals totals;
+  for (const auto& partial : partials) {
+    totals.merge(partial);
+  }
+  return totals;
+}
+
+#endif // COLUMNAGGREGATES_H
@@ -0,0 +1,116 @@
+// ColumnKey.h - Defines ColumnKey, the per-particle quantities that catalogue columns can be sorted or ranked by.
+// Author: Raul Scanlon, Date: 31/05/2024
+
+#ifndef COLUMNKEY_H
+#define COLUMNKEY_H
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "PartialSelection.h"
+#include "ParticleColumns.h"
+
+// Quantities derived from a particle row
+enum class ColumnKey {
+  Charge,
+  Energy,
+  Px,
+  Py,
+  Pz,
+  Pt,        // Transverse momentum
+  Mass,      // Invariant mass of the four-momentum
+  RestMass,
+  Eta,       // Pseudorapidity
+  Phi
+};
+
+// Look up a key by name (case-insensitive), e.g. "energy", "pt", "mass"
+inline ColumnKey columnKeyFromName(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  if (name == "charge") return ColumnKey::Charge;
+  if (name == "energy" || name == "e") return ColumnKey::Energy;
+  if (name == "px") return ColumnKey::Px;
+  if (name == "py") return ColumnKey::Py;
+  if (name == "pz") return ColumnKey::Pz;
+  if (name == "pt") return ColumnKey::Pt;
+  if (name == "mass" || name == "m") return ColumnKey::Mass;
+  if (name == "restmass") return ColumnKey::RestMass;
+  if (name == "eta") return ColumnKey::Eta;
+  if (name == "phi") return ColumnKey::Phi;
+  throw std::invalid_argument("Unknown column key: " + name);
+}
+
+// Format a key value for a label in the shortest form that reads back exactly (e.g. 2.5, 100, 5e-07)
+inline std::string formatKeyValue(double value) {
+  char buffer[32];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  return std::string(buffer, result.ptr);
+}
+
+// Get the value of a key that depends only on the four-momentum (Charge and RestMass give 0)
+inline double momentumKeyValue(ColumnKey key, double E, double px, double py, double pz) {
+  switch (key) {
+  case ColumnKey::Energy: return E;
+  case ColumnKey::Px: return px;
+  case ColumnKey::Py: return py;
+  case ColumnKey::Pz: return pz;
+  case ColumnKey::Pt: return std::sqrt(px * px + py * py);
+  case ColumnKey::Mass: {
+    double m2 = E * E - px * px - py * py - pz * pz;
+    return m2 > 0 ? std::sqrt(m2) : 0.0;
+  }
+  case ColumnKey::Eta: {
+    double pt = std::sqrt(px * px + py * py);
+    return pt > 0 ? std::asinh(pz / pt) : std::copysign(1e6, pz);
+  }
+  case ColumnKey::Phi: return std::atan2(py, px);
+  case ColumnKey::Charge:
+  case ColumnKey::RestMass: break;
+  }
+  return 0.0;
+}
+
+// Get the value of a key for one row
+inline double columnKeyValue(const ParticleColumns& columns, ColumnKey key, size_t row) {
+  switch (key) {
+  case ColumnKey::Charge: return columns.charge[row];
+  case ColumnKey::RestMass: return columns.restMass[row];
+  default: return momentumKeyValue(key, columns.energy[row], columns.px[row], columns.py[row], columns.pz[row]);
+  }
+}
+
+// Evaluate a key for rows [begin, end) into out[0 .. end - begin)
+inline void columnKeyValues(const ParticleColumns& columns, ColumnKey key, size_t begin, size_t end, double* out) {
+  for (size_t row = begin; row < end; ++row) {
+    out[row - begin] = columnKeyValue(columns, key, row);
+  }
+}
+
+// Get the k rows with the largest key (smallest if largest is false), best first
+inline std::vector<size_t> topKRows(const ParticleColumns& columns, ColumnKey key, size_t k, bool largest = true,
+                                    unsigned threads = 0) {
+  auto selected = selectTopK(columns.size(), k, [&](size_t row) { return columnKeyValue(columns, key, row); },
+                             largest, threads);
+  std::vector<size_t> rows;
+  rows.reserve(selected.size());
+  for (const auto& entry : selected) {
+    rows.push_back(entry.index);
+  }
+  return rows;
+}
+
+// Get the key value at position n of the ascending order, without sorting the columns
+inline double nthKeyValue(const ParticleColumns& columns, ColumnKey key, size_t n, unsigned threads = 0) {
+  return selectNth(columns.size(), n, [&](size_t row) { return columnKeyValue(columns, key, row); }, threads);
+}
+
+// Build an approximate quantile sketch of a key over all rows
+inline QuantileSketch keyQuantileSketch(const ParticleColumns& columns, ColumnKey key, unsigned threads = 0) {
+  return buildQuantileSketch(columns.size(), [&](size_t row) { return columnKeyValue(columns, key, row); }, threads);
+}
+
+#endif // COLUMNKEY_H
@@ -0,0 +1,96 @@
+// CompensatedSum.h - Defines NeumaierSum and MomentumAccumulator, error-compensated accumulators
+// for catalogue totals, and the SummationPolicy that selects between them.
+// Author: Raul Scanlon, Date: 03/06/2024
+
+#ifndef COMPENSATEDSUM_H
+#define COMPENSATEDSUM_H
+
+#include <cmath>
+#include "FourMomentum.h"
+
+// How totals are accumulated. Both accumulate in double whatever the storage precision.
+enum class SummationPolicy {
+  Naive,       // Plain double additions (fastest; error grows with the number of terms)
+  Compensated  // Neumaier summation (error independent of the number of terms)
+};
+
+// Running sum that carries the rounding error of each addition in a separate term
+// (Neumaier's improvement of Kahan summation, which also handles terms larger than the sum)
+class NeumaierSum {
+public:
+  void add(double value) {
+    double total = sum + value;
+    if (std::abs(sum) >= std::abs(value)) {
+      compensation += (sum - total) + value;
+    } else {
+      compensation += (value - total) + sum;
+    }
+    sum = total;
+  }
+
+  // Add another partial sum, e.g. from a different thread
+  void merge(const NeumaierSum& other) {
+    add(other.sum);
+    add(other.compensation);
+  }
+
+  double value() const { return sum + compensation; }
+
+private:
+  double sum = 0.0;
+  double compensation = 0.0;
+};
+
+// Accumulates four-momenta under a summation policy; removal subtracts exactly as addition adds
+class MomentumAccumulator {
+public:
+  explicit MomentumAccumulator(SummationPolicy policy = SummationPolicy::Compensated) : policy(policy) {}
+
+  template <typename T>
+  void add(const BasicFourMomentum<T>& momentum, double sign = 1.0) {
+    add(sign * momentum.getEnergy(), sign * momentum.getPx(), sign * momentum.getPy(), sign * momentum.getPz());
+  }
+
+  void add(double E, double px, double py, double pz) {
+    if (policy == SummationPolicy::Compensated) {
+      sums[0].add(E);
+      sums[1].add(px);
+      sums[2].add(py);
+      sums[3].add(pz);
+    } else {
+      naive[0] += E;
+      naive[1] += px;
+      naive[2] += py;
+      naive[3] += pz;
+    }
+  }
+
+  // Add another accumulator's total (its compensation terms are carried over)
+  void merge(const MomentumAccumulator& other) {
+    for (int i = 0; i < 4; ++i) {
+      if (policy == SummationPolicy::Compensated) {
+        sums[i].merge(other.sums[i]);
+        sums[i].add(other.naive[i]);
+      } else {
+        naive[i] += other.naive[i] + other.sums[i].value();
+      }
+    }
+  }
+
+  FourMomentum getTotal() const {
+    double total[4];
+    for (int i = 0; i < 4; ++i) {
+      total[i] = naive[i] + sums[i].value();
+    }
+    return FourMomentum(total[0], total[1], total[2], total[3]);
+  }
+
+  SummationPolicy getPolicy() const { return policy; }
+
+private:
+  SummationPolicy policy;
+  NeumaierSum sums[4];
+  double naive[4] = {0, 0, 0, 0};
+};
+
+#endif // COMPENSATEDSUM_H
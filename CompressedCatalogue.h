@@ -0,0 +1,334 @@
+// CompressedCatalogue.h - Defines CompressedCatalogue, a block-compressed column store for cold or archived catalogues.
+// Author: Raul Scanlon, Date: 28/05/2024
+
+#ifndef COMPRESSEDCATALOGUE_H
+#define COMPRESSEDCATALOGUE_H
+
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "AsyncFileStream.h"
+#include "CompressionCodecs.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+
+// Options controlling how a catalogue is compressed
+struct CompressionOptions {
+  size_t blockRows = 65536;       // Rows per independently decodable block
+  int momentumMantissaBits = 52;  // Mantissa bits kept for E/px/py/pz; below 52 is lossy
+  unsigned threads = 0;           // 0 uses every hardware thread
+};
+
+// Catalogue columns split into blocks, each column encoded with the cheapest codec:
+// dictionary + bit-packing for discrete values, byte-shuffle + LZ for everything else.
+class CompressedCatalogue {
+public:
+  // Compress columnar particle data
+  static CompressedCatalogue compress(const ParticleColumns& columns, const CompressionOptions& options = CompressionOptions()) {
+    if (options.blockRows == 0) {
+      throw std::invalid_argument("Block size must be positive");
+    }
+    CompressedCatalogue result;
+    result.rowCount = columns.size();
+    result.mantissaBits = options.momentumMantissaBits;
+    result.strings = columns.strings;
+    result.uncompressedBytes = columns.size() * columns.bytesPerRow();
+
+    size_t blockCount = (columns.size() + options.blockRows - 1) / options.blockRows;
+    result.blocks.resize(blockCount);
+    parallelFor(blockCount, options.threads, [&](size_t begin, size_t end, size_t) {
+      for (size_t block = begin; block < end; ++block) {
+        size_t first = block * options.blockRows;
+        size_t rows = std::min(options.blockRows, columns.size() - first);
+        Block& target = result.blocks[block];
+        target.rows = static_cast<std::uint32_t>(rows);
+        columns.forEachColumn([&](const auto& column, bool isMomentum) {
+          encodeColumn(column.data() + first, rows, isMomentum ? options.momentumMantissaBits : 52, target.data);
+        });
+      }
+    });
+    return result;
+  }
+
+  // Compress more rows as additional blocks, e.g. when the catalogue is written batch by batch
+  void append(const ParticleColumns& columns, const CompressionOptions& options = CompressionOptions()) {
+    if (rowCount == 0) {
+      mantissaBits = options.momentumMantissaBits;
+    } else if (options.momentumMantissaBits != mantissaBits) {
+      throw std::invalid_argument("Appended blocks must use the same momentum precision");
+    }
+    ParticleColumns remapped;
+    remapped.setStrings(strings);
+    remapped.appendColumns(columns);
+    CompressedCatalogue tail = compress(remapped, options);
+    strings = remapped.strings;
+    rowCount += tail.rowCount;
+    uncompressedBytes += tail.uncompressedBytes;
+    for (auto& block : tail.blocks) {
+      blocks.push_back(std::move(block));
+    }
+  }
+
+  // Compress every particle in a catalogue
+  static CompressedCatalogue compress(const ParticleCatalogue& catalogue, const CompressionOptions& options = CompressionOptions()) {
+    return compress(ParticleColumns::fromCatalogue(catalogue), options);
+  }
+
+  // Decompress all blocks in parallel
+  ParticleColumns decompress(unsigned threads = 0) const {
+    ParticleColumns columns;
+    columns.setStrings(strings);
+    columns.resize(rowCount);
+
+    std::vector<size_t> firstRow(blocks.size(), 0);
+    for (size_t block = 1; block < blocks.size(); ++block) {
+      firstRow[block] = firstRow[block - 1] + blocks[block - 1].rows;
+    }
+    parallelFor(blocks.size(), threads, [&](size_t begin, size_t end, size_t) {
+      for (size_t block = begin; block < end; ++block) {
+        decodeBlock(blocks[block], columns, firstRow[block]);
+      }
+    });
+    return columns;
+  }
+
+  // Decompress a single block
+  ParticleColumns decompressBlock(size_t block) const {
+    const Block& source = blocks.at(block);
+    ParticleColumns columns;
+    columns.setStrings(strings);
+    columns.resize(source.rows);
+    decodeBlock(source, columns, 0);
+    return columns;
+  }
+
+  size_t getRowCount() const { return rowCount; }
+  size_t getBlockCount() const { return blocks.size(); }
+  size_t getBlockRowCount(size_t block) const { return blocks.at(block).rows; }
+  size_t getUncompressedBytes() const { return uncompressedBytes; }
+  bool isLossy() const { return mantissaBits < 52; }
+
+  // Get the total encoded size of all blocks
+  size_t getCompressedBytes() const {
+    size_t bytes = 0;
+    for (const auto& block : blocks) {
+      bytes += block.data.size();
+    }
+    return bytes;
+  }
+
+  // Write the compressed catalogue to a file
+  void save(const std::string& path) const {
+    ByteBuffer header;
+    appendBytes(header, fileMagic, sizeof(fileMagic));
+    appendValue(header, fileVersion);
+    appendValue(header, static_cast<std::uint64_t>(rowCount));
+    appendValue(header, static_cast<std::uint64_t>(uncompressedBytes));
+    appendValue(header, static_cast<std::int32_t>(mantissaBits));
+    appendValue(header, static_cast<std::uint32_t>(strings.size()));
+    for (const auto& value : strings) {
+      appendValue(header, static_cast<std::uint32_t>(value.size()));
+      appendBytes(header, value.data(), value.size());
+    }
+    appendValue(header, static_cast<std::uint64_t>(blocks.size()));
+
+    AsyncOutputFile out(path);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    for (const auto& block : blocks) {
+      ByteBuffer blockHeader;
+      appendValue(blockHeader, block.rows);
+      appendValue(blockHeader, static_cast<std::uint64_t>(block.data.size()));
+      out.write(reinterpret_cast<const char*>(blockHeader.data()), blockHeader.size());
+      out.write(reinterpret_cast<const char*>(block.data.data()), block.data.size());
+    }
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Failed writing " + path);
+    }
+  }
+
+  // Read a compressed catalogue written by save()
+  static CompressedCatalogue load(const std::string& path) {
+    AsyncInputFile in(path);
+    ByteBuffer file(in.size());
+    in.read(reinterpret_cast<char*>(file.data()), static_cast<std::streamsize>(file.size()));
+    if (static_cast<size_t>(in.gcount()) != file.size()) {
+      throw std::runtime_error("Failed reading " + path);
+    }
+    return fromBytes(file);
+  }
+
+  // Parse a compressed catalogue from an in-memory file image
+  static CompressedCatalogue fromBytes(const ByteBuffer& file) {
+    ByteReader reader(file.data(), file.size());
+    if (std::memcmp(reader.take(sizeof(fileMagic)), fileMagic, sizeof(fileMagic)) != 0) {
+      throw std::runtime_error("Not a compressed particle catalogue");
+    }
+    if (reader.read<std::uint32_t>() != fileVersion) {
+      throw std::runtime_error("Unsupported compressed catalogue version");
+    }
+    CompressedCatalogue result;
+    result.rowCount = reader.read<std::uint64_t>();
+    result.uncompressedBytes = reader.read<std::uint64_t>();
+    result.mantissaBits = reader.read<std::int32_t>();
+    std::uint32_t stringCount = reader.read<std::uint32_t>();
+    for (std::uint32_t i = 0; i < stringCount; ++i) {
+      std::uint32_t length = reader.read<std::uint32_t>();
+      const char* text = reinterpret_cast<const char*>(reader.take(length));
+      result.strings.emplace_back(text, length);
+    }
+    std::uint64_t blockCount = reader.read<std::uint64_t>();
+    size_t rows = 0;
+    for (std::uint64_t i = 0; i < blockCount; ++i) {
+      Block block;
+      block.rows = reader.read<std::uint32_t>();
+      std::uint64_t size = reader.read<std::uint64_t>();
+      const std::uint8_t* data = reader.take(size);
+      block.data.assign(data, data + size);
+      rows += block.rows;
+      result.blocks.push_back(std::move(block));
+    }
+    if (rows != result.rowCount) {
+      throw std::runtime_error("Compressed catalogue row count mismatch");
+    }
+    return result;
+  }
+
+private:
+  struct Block {
+    std::uint32_t rows = 0;
+    ByteBuffer data;
+  };
+
+  enum class ColumnEncoding : std::uint8_t {
+    Dictionary = 1,  // Distinct values + bit-packed indices
+    ShuffleLz = 2,   // Byte-shuffled then LZ compressed
+    Shuffle = 3      // Byte-shuffled only (LZ did not help)
+  };
+
+  static constexpr char fileMagic[4] = {'P', 'C', 'A', 'T'};
+  static constexpr std::uint32_t fileVersion = 1;
+  static constexpr size_t maxDictionarySize = 256;
+
+  std::vector<std::string> strings;
+  std::vector<Block> blocks;
+  size_t rowCount = 0;
+  size_t uncompressedBytes = 0;
+  int mantissaBits = 52;
+
+  template <typename T>
+  static std::uint64_t bitPattern(const T& value) {
+    std::uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+  }
+
+  // Encode `count` values, preferring a dictionary when the block has few distinct values
+  template <typename T>
+  static void encodeColumn(const T* source, size_t count, int keepBits, ByteBuffer& out) {
+    static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= 8, "Unsupported column type");
+    std::vector<T> values(source, source + count);
+    if constexpr (std::is_floating_point<T>::value) {
+      if (keepBits < 52) {
+        for (auto& value : values) {
+          value = static_cast<T>(truncateMantissa(value, keepBits));
+        }
+      }
+    }
+
+    std::unordered_map<std::uint64_t, std::uint32_t> dictionaryIndex;
+    std::vector<T> dictionary;
+    std::vector<std::uint32_t> indices(count);
+    bool useDictionary = true;
+    for (size_t i = 0; i < count; ++i) {
+      auto inserted = dictionaryIndex.emplace(bitPattern(values[i]), static_cast<std::uint32_t>(dictionary.size()));
+      if (inserted.second) {
+        if (dictionary.size() == maxDictionarySize) {
+          useDictionary = false;
+          break;
+        }
+        dictionary.push_back(values[i]);
+      }
+      indices[i] = inserted.first->second;
+    }
+
+    if (useDictionary) {
+      int bits = dictionary.empty() ? 0 : bitsRequired(static_cast<std::uint32_t>(dictionary.size() - 1));
+      out.push_back(static_cast<std::uint8_t>(ColumnEncoding::Dictionary));
+      appendValue(out, static_cast<std::uint16_t>(dictionary.size()));
+      appendBytes(out, dictionary.data(), dictionary.size() * sizeof(T));
+      out.push_back(static_cast<std::uint8_t>(bits));
+      bitPack(indices.data(), count, bits, out);
+      return;
+    }
+
+    ByteBuffer shuffled(count * sizeof(T));
+    byteShuffle(reinterpret_cast<const std::uint8_t*>(values.data()), count, sizeof(T), shuffled.data());
+    ByteBuffer packed = LzCodec::compress(shuffled.data(), shuffled.size());
+    bool compressed = packed.size() < shuffled.size();
+    const ByteBuffer& payload = compressed ? packed : shuffled;
+    out.push_back(static_cast<std::uint8_t>(compressed ? ColumnEncoding::ShuffleLz : ColumnEncoding::Shuffle));
+    appendValue(out, static_cast<std::uint64_t>(payload.size()));
+    appendBytes(out, payload.data(), payload.size());
+  }
+
+  template <typename T>
+  static void decodeColumn(ByteReader& reader, size_t count, T* target) {
+    auto encoding = static_cast<ColumnEncoding>(reader.read<std::uint8_t>());
+    switch (encoding) {
+    case ColumnEncoding::Dictionary: {
+      std::uint16_t dictionarySize = reader.read<std::uint16_t>();
+      std::vector<T> dictionary(dictionarySize);
+      std::memcpy(dictionary.data(), reader.take(dictionarySize * sizeof(T)), dictionarySize * sizeof(T));
+      int bits = reader.read<std::uint8_t>();
+      if (bits > 16) {
+        throw std::runtime_error("Corrupt dictionary column");
+      }
+      std::vector<std::uint32_t> indices(count, 0);
+      bitUnpack(reader.take((count * bits + 7) / 8), count, bits, indices.data());
+      for (size_t i = 0; i < count; ++i) {
+        if (indices[i] >= dictionarySize) {
+          throw std::runtime_error("Corrupt dictionary index");
+        }
+        target[i] = dictionary[indices[i]];
+      }
+      break;
+    }
+    case ColumnEncoding::ShuffleLz:
+    case ColumnEncoding::Shuffle: {
+      std::uint64_t size = reader.read<std::uint64_t>();
+      const std::uint8_t* payload = reader.take(size);
+      ByteBuffer shuffled(count * sizeof(T));
+      if (encoding == ColumnEncoding::ShuffleLz) {
+        LzCodec::decompress(payload, size, shuffled.data(), shuffled.size());
+      } else if (size == shuffled.size()) {
+        std::memcpy(shuffled.data(), payload, size);
+      } else {
+        throw std::runtime_error("Corrupt shuffled column");
+      }
+      byteUnshuffle(shuffled.data(), count, sizeof(T), reinterpret_cast<std::uint8_t*>(target));
+      break;
+    }
+    default:
+      throw std::runtime_error("Unknown column encoding");
+    }
+  }
+
+  // Decode one block into rows [firstRow, firstRow + block.rows) of preallocated columns
+  static void decodeBlock(const Block& block, ParticleColumns& columns, size_t firstRow) {
+    ByteReader reader(block.data.data(), block.data.size());
+    columns.forEachColumn([&](auto& column, bool) {
+      decodeColumn(reader, block.rows, column.data() + firstRow);
+    });
+    if (!reader.atEnd()) {
+      throw std::runtime_error("Trailing bytes in compressed block");
+    }
+  }
+};
+
+#endif // COMPRESSEDCATALOGUE_H
@@ -0,0 +1,264 @@
+// CompressionCodecs.h - Defines the low-level codecs used for compressed catalogue columns:
+// bit-packing, byte-shuffling, a small LZ77 block codec and mantissa truncation.
+// Author: Raul Scanlon, Date: 28/05/2024
+
+#ifndef COMPRESSIONCODECS_H
+#define COMPRESSIONCODECS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using ByteBuffer = std::vector<std::uint8_t>;
+
+// Append raw bytes to a buffer
+inline void appendBytes(ByteBuffer& out, const void* data, size_t size) {
+  const auto* bytes = static_cast<const std::uint8_t*>(data);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+// Append a trivially copyable value to a buffer
+template <typename T>
+void appendValue(ByteBuffer& out, const T& value) {
+  appendBytes(out, &value, sizeof(T));
+}
+
+// Bounds-checked sequential reader over a byte range
+class ByteReader {
+public:
+  ByteReader(const std::uint8_t* data, size_t size) : data(data), size(size), position(0) {}
+
+  // Take the next `count` bytes, throwing if the input is too short
+  const std::uint8_t* take(size_t count) {
+    if (count > size - position) {
+      throw std::runtime_error("Unexpected end of compressed data");
+    }
+    const std::uint8_t* start = data + position;
+    position += count;
+    return start;
+  }
+
+  template <typename T>
+  T read() {
+    T value;
+    std::memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  bool atEnd() const { return position == size; }
+
+private:
+  const std::uint8_t* data;
+  size_t size;
+  size_t position;
+};
+
+// Get the number of bits needed to store values in [0, maxValue]
+inline int bitsRequired(std::uint32_t maxValue) {
+  int bits = 0;
+  while (maxValue > 0) {
+    ++bits;
+    maxValue >>= 1;
+  }
+  return bits;
+}
+
+// Pack `count` values of `bits` bits each (LSB first) onto the end of a buffer
+inline void bitPack(const std::uint32_t* values, size_t count, int bits, ByteBuffer& out) {
+  if (bits == 0) {
+    return;
+  }
+  size_t start = out.size();
+  out.resize(start + (count * bits + 7) / 8, 0);
+  std::uint8_t* packed = out.data() + start;
+  size_t bitPosition = 0;
+  for (size_t i = 0; i < count; ++i) {
+    std::uint64_t value = values[i];
+    for (int written = 0; written < bits;) {
+      size_t byte = bitPosition >> 3;
+      int shift = static_cast<int>(bitPosition & 7);
+      int chunk = std::min(bits - written, 8 - shift);
+      packed[byte] |= static_cast<std::uint8_t>(((value >> written) & ((1u << chunk) - 1)) << shift);
+      written += chunk;
+      bitPosition += chunk;
+    }
+  }
+}
+
+// Unpack `count` values of `bits` bits each
+inline void bitUnpack(const std::uint8_t* packed, size_t count, int bits, std::uint32_t* values) {
+  size_t bitPosition = 0;
+  for (size_t i = 0; i < count; ++i) {
+    std::uint32_t value = 0;
+    for (int read = 0; read < bits;) {
+      size_t byte = bitPosition >> 3;
+      int shift = static_cast<int>(bitPosition & 7);
+      int chunk = std::min(bits - read, 8 - shift);
+      value |= static_cast<std::uint32_t>((packed[byte] >> shift) & ((1u << chunk) - 1)) << read;
+      read += chunk;
+      bitPosition += chunk;
+    }
+    values[i] = value;
+  }
+}
+
+// Group byte k of every element together so slowly varying bytes (signs, exponents) form long runs
+inline void byteShuffle(const std::uint8_t* in, size_t count, size_t elementSize, std::uint8_t* out) {
+  for (size_t byte = 0; byte < elementSize; ++byte) {
+    std::uint8_t* lane = out + byte * count;
+    for (size_t i = 0; i < count; ++i) {
+      lane[i] = in[i * elementSize + byte];
+    }
+  }
+}
+
+// Reverse byteShuffle
+inline void byteUnshuffle(const std::uint8_t* in, size_t count, size_t elementSize, std::uint8_t* out) {
+  for (size_t byte = 0; byte < elementSize; ++byte) {
+    const std::uint8_t* lane = in + byte * count;
+    for (size_t i = 0; i < count; ++i) {
+      out[i * elementSize + byte] = lane[i];
+    }
+  }
+}
+
+// Round a double to keep only `keepBits` of its 52 mantissa bits (lossy, for momenta)
+inline double truncateMantissa(double value, int keepBits) {
+  if (keepBits >= 52 || !std::isfinite(value)) {
+    return value;
+  }
+  int dropBits = 52 - (keepBits < 0 ? 0 : keepBits);
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  bits += std::uint64_t(1) << (dropBits - 1); // Round to nearest
+  bits &= ~((std::uint64_t(1) << dropBits) - 1);
+  double rounded;
+  std::memcpy(&rounded, &bits, sizeof(rounded));
+  return rounded;
+}
+
+// Fast LZ77 block codec (LZ4-style token/literal/match sequences with 16-bit offsets)
+class LzCodec {
+public:
+  static ByteBuffer compress(const std::uint8_t* in, size_t size) {
+    ByteBuffer out;
+    out.reserve(size / 2 + 16);
+    size_t anchor = 0;
+    if (size > minMatch + lastLiterals) {
+      std::vector<std::uint32_t> table(size_t(1) << hashBits, 0);
+      size_t position = 0;
+      size_t matchLimit = size - lastLiterals;
+      while (position + minMatch <= matchLimit) {
+        std::uint32_t sequence = load32(in + position);
+        std::uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+        size_t candidate = table[hash];
+        table[hash] = static_cast<std::uint32_t>(position + 1);
+        if (candidate != 0 && position + 1 - candidate <= maxOffset && load32(in + candidate - 1) == sequence) {
+          --candidate;
+          size_t length = minMatch;
+          while (position + length < matchLimit && in[candidate + length] == in[position + length]) {
+            ++length;
+          }
+          writeSequence(out, in + anchor, position - anchor, position - candidate, length);
+          position += length;
+          anchor = position;
+        } else {
+          // Skip faster through incompressible data
+          position += 1 + ((position - anchor) >> 6);
+        }
+      }
+    }
+    writeSequence(out, in + anchor, size - anchor, 0, 0);
+    return out;
+  }
+
+  static void decompress(const std::uint8_t* in, size_t size, std::uint8_t* out, size_t outSize) {
+    size_t inPos = 0, outPos = 0;
+    while (inPos < size) {
+      std::uint8_t token = in[inPos++];
+      size_t literals = readLength(in, size, inPos, token >> 4);
+      if (literals > size - inPos || literals > outSize - outPos) {
+        throw std::runtime_error("Corrupt LZ block: literal run out of range");
+      }
+      std::memcpy(out + outPos, in + inPos, literals);
+      inPos += literals;
+      outPos += literals;
+      if (inPos == size) {
+        break;
+      }
+      if (size - inPos < 2) {
+        throw std::runtime_error("Corrupt LZ block: truncated offset");
+      }
+      size_t offset = in[inPos] | (size_t(in[inPos + 1]) << 8);
+      inPos += 2;
+      size_t length = readLength(in, size, inPos, token & 15) + minMatch;
+      if (offset == 0 || offset > outPos || length > outSize - outPos) {
+        throw std::runtime_error("Corrupt LZ block: match out of range");
+      }
+      for (size_t i = 0; i < length; ++i, ++outPos) {
+        out[outPos] = out[outPos - offset]; // Overlapping copies are intended
+      }
+    }
+    if (outPos != outSize) {
+      throw std::runtime_error("Corrupt LZ block: size mismatch");
+    }
+  }
+
+private:
+  static constexpr size_t minMatch = 4;
+  static constexpr size_t lastLiterals = 5;
+  static constexpr size_t maxOffset = 65535;
+  static constexpr int hashBits = 14;
+
+  static std::uint32_t load32(const std::uint8_t* p) {
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  static void writeLength(ByteBuffer& out, size_t length) {
+    while (length >= 255) {
+      out.push_back(255);
+      length -= 255;
+    }
+    out.push_back(static_cast<std::uint8_t>(length));
+  }
+
+  static size_t readLength(const std::uint8_t* in, size_t size, size_t& inPos, size_t length) {
+    if (length == 15) {
+      std::uint8_t extra;
+      do {
+        if (inPos >= size) {
+          throw std::runtime_error("Corrupt LZ block: truncated length");
+        }
+        extra = in[inPos++];
+        length += extra;
+      } while (extra == 255);
+    }
+    return length;
+  }
+
+  // Write literals followed by a match; a zero-length match marks the final literal-only sequence
+  static void writeSequence(ByteBuffer& out, const std::uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength == 0 ? 0 : matchLength - minMatch;
+    out.push_back(static_cast<std::uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+    if (literalCount >= 15) {
+      writeLength(out, literalCount - 15);
+    }
+    appendBytes(out, literals, literalCount);
+    if (matchLength == 0) {
+      return;
+    }
+    out.push_back(static_cast<std::uint8_t>(offset & 0xFF));
+    out.push_back(static_cast<std::uint8_t>(offset >> 8));
+    if (matchCode >= 15) {
+      writeLength(out, matchCode - 15);
+    }
+  }
+};
+
+#endif // COMPRESSIONCODECS_H
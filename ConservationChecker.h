@@ -0,0 +1,184 @@
+// ConservationChecker.h - Defines a batch checker for conservation laws across many parent/children decay groups.
+// Author: Raul Scanlon, Date: 29/05/2024
+
+#ifndef CONSERVATIONCHECKER_H
+#define CONSERVATIONCHECKER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "ParallelFor.h"
+#include "ParticleCatalogue.h"
+#include "ParticleColumns.h"
+
+// Bits set in a group's violation mask
+enum ConservationViolation : std::uint8_t {
+  ViolationNone = 0,
+  ViolationCharge = 1,
+  ViolationFourMomentum = 2,
+  ViolationLeptonNumber = 4,
+  ViolationBaryonNumber = 8
+};
+
+// Decay groups in compressed-row layout: children of group g are rows
+// [childOffsets[g], childOffsets[g + 1]) of `children`.
+struct DecayGroups {
+  ParticleColumns parents;
+  ParticleColumns children;
+  std::vector<std::uint32_t> childOffsets{0};
+
+  size_t size() const { return parents.size(); }
+
+  // Add one parent and its direct decay products as a group
+  void addGroup(const Particle& parent) {
+    parents.append(parent);
+    for (const auto& product : parent.getDecayProducts()) {
+      children.append(*product);
+    }
+    childOffsets.push_back(static_cast<std::uint32_t>(children.size()));
+  }
+
+  // Add a group for every decaying particle in a decay tree (the particle and all descendants)
+  void addTree(const Particle& root) {
+    if (root.getDecayProducts().empty()) {
+      return;
+    }
+    addGroup(root);
+    for (const auto& product : root.getDecayProducts()) {
+      addTree(*product);
+    }
+  }
+
+  // Collect every decay group reachable from a catalogue
+  static DecayGroups fromCatalogue(const ParticleCatalogue& catalogue) {
+    DecayGroups groups;
+    for (const auto& particle : catalogue.getParticles()) {
+      groups.addTree(*particle);
+    }
+    return groups;
+  }
+};
+
+// Result of a batch check: one violation mask per group plus per-law totals
+struct ConservationReport {
+  std::vector<std::uint8_t> violations;
+  size_t chargeViolations = 0;
+  size_t fourMomentumViolations = 0;
+  size_t leptonNumberViolations = 0;
+  size_t baryonNumberViolations = 0;
+  size_t violatingGroups = 0;
+
+  bool allConserved() const { return violatingGroups == 0; }
+};
+
+// Checks charge, four-momentum, lepton number and baryon number for every group in one pass
+class ConservationChecker {
+public:
+  double chargeTolerance = 1e-2;           // Matches Particle::checkDecayConsistency
+  double momentumTolerance = 1e-6;         // Absolute, per component
+  double momentumRelativeTolerance = 1e-9; // Relative to the parent's energy
+  double baryonTolerance = 1e-6;
+
+  // Check every group, splitting the groups across threads
+  ConservationReport check(const DecayGroups& groups, unsigned threads = 0) const {
+    ConservationReport report;
+    report.violations.assign(groups.size(), ViolationNone);
+    parallelFor(groups.size(), threads, [&](size_t begin, size_t end, size_t) {
+      checkRange(groups, begin, end, report.violations.data());
+    });
+    for (std::uint8_t mask : report.violations) {
+      report.chargeViolations += (mask & ViolationCharge) != 0;
+      report.fourMomentumViolations += (mask & ViolationFourMomentum) != 0;
+      report.leptonNumberViolations += (mask & ViolationLeptonNumber) != 0;
+      report.baryonNumberViolations += (mask & ViolationBaryonNumber) != 0;
+      report.violatingGroups += mask != ViolationNone;
+    }
+    return report;
+  }
+
+  // Check the decay of a single particle, returning its violation mask
+  std::uint8_t checkParticle(const Particle& parent) const {
+    DecayGroups group;
+    group.addGroup(parent);
+    std::uint8_t mask = ViolationNone;
+    checkRange(group, 0, 1, &mask);
+    return mask;
+  }
+
+private:
+  static constexpr size_t blockGroups = 1024; // Groups reduced and compared together
+
+  // Two passes per block of groups. A segmented reduction sums each group's children into
+  // per-group arrays; then one flat, branch-free pass compares those sums with the contiguous
+  // parent columns. Only the compare pass vectorizes (GCC does so at -O3 for x86-64-v2 and
+  // later): segments have variable length, so the reduction stays a plain sum per group.
+  void checkRange(const DecayGroups& groups, size_t begin, size_t end, std::uint8_t* out) const {
+    const ParticleColumns& parents = groups.parents;
+    const ParticleColumns& children = groups.children;
+    const std::uint32_t* offsets = groups.childOffsets.data();
+    size_t block = std::min(blockGroups, end - begin);
+    std::vector<double> sums(6 * block);
+    std::vector<std::int32_t> leptonSums(block);
+    double* sumCharge = sums.data();
+    double* sumE = sumCharge + block;
+    double* sumPx = sumE + block;
+    double* sumPy = sumPx + block;
+    double* sumPz = sumPy + block;
+    double* sumBaryon = sumPz + block;
+    std::int32_t* sumLepton = leptonSums.data();
+    // Copied out of the object: the byte stores to out could alias it, which blocks vectorizing
+    const double absolute = momentumTolerance, relative = momentumRelativeTolerance;
+    const double chargeLimit = chargeTolerance, baryonLimit = baryonTolerance;
+
+    for (size_t first = begin; first < end; first += block) {
+      size_t count = std::min(block, end - first);
+
+      // Segmented reduction over the child columns
+      for (size_t group = 0; group < count; ++group) {
+        double charge = 0, E = 0, px = 0, py = 0, pz = 0, baryon = 0;
+        std::int32_t lepton = 0;
+        for (std::uint32_t child = offsets[first + group]; child < offsets[first + group + 1]; ++child) {
+          charge += children.charge[child];
+          E += children.energy[child];
+          px += children.px[child];
+          py += children.py[child];
+          pz += children.pz[child];
+          baryon += children.baryonNumber[child];
+          lepton += children.leptonNumber[child];
+        }
+        sumCharge[group] = charge;
+        sumE[group] = E;
+        sumPx[group] = px;
+        sumPy[group] = py;
+        sumPz[group] = pz;
+        sumBaryon[group] = baryon;
+        sumLepton[group] = lepton;
+      }
+
+      // Flat compare against the parents
+      const double* parentCharge = parents.charge.data() + first;
+      const double* parentE = parents.energy.data() + first;
+      const double* parentPx = parents.px.data() + first;
+      const double* parentPy = parents.py.data() + first;
+      const double* parentPz = parents.pz.data() + first;
+      const double* parentBaryon = parents.baryonNumber.data() + first;
+      const std::int32_t* parentLepton = parents.leptonNumber.data() + first;
+      std::uint8_t* mask = out + first;
+      for (size_t group = 0; group < count; ++group) {
+        double momentumLimit = absolute + relative * std::abs(parentE[group]);
+        int momentumBad = (std::abs(sumE[group] - parentE[group]) > momentumLimit) |
+                          (std::abs(sumPx[group] - parentPx[group]) > momentumLimit) |
+                          (std::abs(sumPy[group] - parentPy[group]) > momentumLimit) |
+                          (std::abs(sumPz[group] - parentPz[group]) > momentumLimit);
+        mask[group] = static_cast<std::uint8_t>(
+            (std::abs(sumCharge[group] - parentCharge[group]) > chargeLimit) * ViolationCharge |
+            momentumBad * ViolationFourMomentum |
+            (sumLepton[group] != parentLepton[group]) * ViolationLeptonNumber |
+            (std::abs(sumBaryon[group] - parentBaryon[group]) > baryonLimit) * ViolationBaryonNumber);
+      }
+    }
+  }
+};
+
+#endif // CONSERVATIONCHECKER_H
@@ -0,0 +1,378 @@
+// CutFlow.h - Defines RowMask, a packed per-row selection bitmask, Cut, a selection evaluated over catalogue
+// columns, and CutFlow, which applies a sequence of cuts and reports how many rows survive each one.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef CUTFLOW_H
+#define CUTFLOW_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ColumnKey.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+#include "ParticleKind.h"
+
+// One bit per row, 64 rows per word; bits past the last row are always zero so that counts and
+// complements need no special casing
+class RowMask {
+public:
+  explicit RowMask(size_t rows = 0, bool value = false)
+    : rows(rows), words((rows + 63) / 64, value ? ~std::uint64_t(0) : 0) {
+    clearTail();
+  }
+
+  size_t size() const { return rows; }
+  const std::vector<std::uint64_t>& getWords() const { return words; }
+  std::vector<std::uint64_t>& getWords() { return words; }
+
+  bool test(size_t row) const { return words[row / 64] >> (row % 64) & 1; }
+
+  // Get the number of selected rows
+  size_t count() const {
+    size_t total = 0;
+    for (std::uint64_t word : words) {
+      total += static_cast<size_t>(__builtin_popcountll(word));
+    }
+    return total;
+  }
+
+  RowMask& operator&=(const RowMask& other) {
+    checkSize(other);
+    for (size_t i = 0; i < words.size(); ++i) {
+      words[i] &= other.words[i];
+    }
+    return *this;
+  }
+
+  RowMask& operator|=(const RowMask& other) {
+    checkSize(other);
+    for (size_t i = 0; i < words.size(); ++i) {
+      words[i] |= other.words[i];
+    }
+    return *this;
+  }
+
+  RowMask operator~() const {
+    RowMask result(*this);
+    for (auto& word : result.words) {
+      word = ~word;
+    }
+    result.clearTail();
+    return result;
+  }
+
+  friend RowMask operator&(RowMask a, const RowMask& b) { return a &= b; }
+  friend RowMask operator|(RowMask a, const RowMask& b) { return a |= b; }
+
+  // Get the selected rows in ascending order, e.g. for ParticleColumns::gather
+  std::vector<size_t> indices() const {
+    std::vector<size_t> result;
+    result.reserve(count());
+    for (size_t i = 0; i < words.size(); ++i) {
+      for (std::uint64_t word = words[i]; word != 0; word &= word - 1) {
+        result.push_back(i * 64 + static_cast<size_t>(__builtin_ctzll(word)));
+      }
+    }
+    return result;
+  }
+
+private:
+  size_t rows;
+  std::vector<std::uint64_t> words;
+
+  void clearTail() {
+    if (rows % 64 != 0) {
+      words.back() &= (std::uint64_t(1) << (rows % 64)) - 1;
+    }
+  }
+
+  void checkSize(const RowMask& other) const {
+    if (other.rows != rows) {
+      throw std::invalid_argument("Row masks of different sizes");
+    }
+  }
+};
+
+// A selection over rows. Its kernel fills match[i] (0 or 1) for rows [begin, begin + i) of at most
+// 64 rows at a time; kernels are branch-free loops over the plain column arrays, so they
+// vectorize, and the 64 results are packed into one mask word. A cut may instead build its whole
+// mask itself (see fromMask), when it has its own batching.
+class Cut {
+public:
+  using Kernel = std::function<void(const ParticleColumns&, size_t begin, size_t end, std::uint8_t* match)>;
+  using MaskBuilder = std::function<RowMask(const ParticleColumns&, unsigned threads)>;
+
+  Cut(std::string name, Kernel kernel) : name(std::move(name)), kernel(std::move(kernel)) {}
+
+  // A cut evaluated by a function returning the mask of every row, e.g. a compiled filter
+  // expression (FilterExpression.h), which runs its program over batches larger than 64 rows
+  static Cut fromMask(std::string name, MaskBuilder builder) {
+    Cut cut(std::move(name), Kernel());
+    cut.maskBuilder = std::move(builder);
+    return cut;
+  }
+
+  const std::string& getName() const { return name; }
+
+  // Rows of any of the given kinds
+  static Cut kind(std::vector<ParticleKind> kinds) {
+    std::string label = "kind=";
+    for (size_t i = 0; i < kinds.size(); ++i) {
+      label += (i ? "," : "") + kindName(kinds[i]);
+    }
+    return Cut(label, [kinds](const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) {
+      const ParticleKind* kind = columns.kind.data() + begin;
+      std::fill(match, match + (end - begin), 0);
+      for (ParticleKind wanted : kinds) {
+        for (size_t i = 0; i < end - begin; ++i) {
+          match[i] |= kind[i] == wanted;
+        }
+      }
+    });
+  }
+
+  // Rows whose charge has the given sign (-1, 0 or 1)
+  static Cut chargeSign(int sign) {
+    std::string label = sign > 0 ? "charge=+" : sign < 0 ? "charge=-" : "charge=0";
+    return Cut(label, [sign](const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) {
+      const double* charge = columns.charge.data() + begin;
+      for (size_t i = 0; i < end - begin; ++i) {
+        match[i] = ((charge[i] > 0) - (charge[i] < 0)) == sign;
+      }
+    });
+  }
+
+  // Rows with low <= key <= high, e.g. an energy threshold or an invariant-mass window
+  static Cut range(ColumnKey key, double low, double high, std::string label) {
+    return Cut(std::move(label), [key, low, high](const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) {
+      double values[64];
+      columnKeyValues(columns, key, begin, end, values);
+      for (size_t i = 0; i < end - begin; ++i) {
+        match[i] = (values[i] >= low) & (values[i] <= high);
+      }
+    });
+  }
+
+  // Rows with key > limit (above) or key < limit (below), e.g. an energy threshold
+  static Cut threshold(ColumnKey key, double limit, bool above, std::string label) {
+    return Cut(std::move(label), [key, limit, above](const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) {
+      double values[64];
+      columnKeyValues(columns, key, begin, end, values);
+      if (above) {
+        for (size_t i = 0; i < end - begin; ++i) {
+          match[i] = values[i] > limit;
+        }
+      } else {
+        for (size_t i = 0; i < end - begin; ++i) {
+          match[i] = values[i] < limit;
+        }
+      }
+    });
+  }
+
+  // Isolated muons
+  static Cut muonIsolated() {
+    return Cut("isolated", [](const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) {
+      const ParticleKind* kind = columns.kind.data() + begin;
+      const std::uint8_t* flags = columns.flags.data() + begin;
+      for (size_t i = 0; i < end - begin; ++i) {
+        match[i] = (kind[i] == ParticleKind::Muon) & ((flags[i] & FlagIsolation) != 0);
+      }
+    });
+  }
+
+  // Electrons whose calorimeter layer (0-3) holds between low and high of their deposited energy
+  static Cut calorimeterFraction(size_t layer, double low, double high) {
+    if (layer >= 4) {
+      throw std::invalid_argument("Calorimeter layer must be 1-4");
+    }
+    std::string label = "calofraction" + std::to_string(layer + 1) + "=" + formatKeyValue(low) + ":" + formatKeyValue(high);
+    return Cut(label, [layer, low, high](const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) {
+      const ParticleKind* kind = columns.kind.data() + begin;
+      const double* layers[4];
+      for (size_t l = 0; l < 4; ++l) {
+        layers[l] = columns.calorimeter[l].data() + begin;
+      }
+      for (size_t i = 0; i < end - begin; ++i) {
+        double total = layers[0][i] + layers[1][i] + layers[2][i] + layers[3][i];
+        double fraction = layers[layer][i] / (total > 0 ? total : 1.0);
+        match[i] = (kind[i] == ParticleKind::Electron) & (total > 0) & (fraction >= low) & (fraction <= high);
+      }
+    });
+  }
+
+  // Parse one cut:
+  //   kind=muon[,electron...]   charge=+|-|0   isolated   calofractionN=LOW:HIGH (N = 1-4)
+  //   KEY>X   KEY<X (strict)   KEY=LOW:HIGH (inclusive)   for any ColumnKey name (energy, pt, mass, eta, ...)
+  static Cut parse(const std::string& spec) {
+    if (spec == "isolated") {
+      return muonIsolated();
+    }
+    size_t op = spec.find_first_of("=<>");
+    if (op == std::string::npos || op == 0) {
+      throw std::invalid_argument("Cannot parse cut '" + spec + "'");
+    }
+    std::string field = spec.substr(0, op), value = spec.substr(op + 1);
+    std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+    char relation = spec[op];
+    if (field == "kind" && relation == '=') {
+      std::vector<ParticleKind> kinds;
+      for (size_t start = 0; start <= value.size();) {
+        size_t comma = std::min(value.find(',', start), value.size());
+        ParticleKind kind = kindFromName(value.substr(start, comma - start));
+        if (kind == ParticleKind::Unknown) {
+          throw std::invalid_argument("Unknown particle kind in cut '" + spec + "'");
+        }
+        kinds.push_back(kind);
+        start = comma + 1;
+      }
+      return Cut::kind(kinds);
+    }
+    if (field == "charge" && relation == '=' && (value == "+" || value == "-" || value == "0")) {
+      return chargeSign(value == "+" ? 1 : value == "-" ? -1 : 0);
+    }
+    if (field.rfind("calofraction", 0) == 0 && field.size() == 13 && relation == '=') {
+      auto window = parseWindow(value, spec);
+      return calorimeterFraction(static_cast<size_t>(field[12] - '1'), window.first, window.second);
+    }
+    ColumnKey key = columnKeyFromName(field);
+    if (relation == '>' || relation == '<') {
+      return threshold(key, parseNumber(value, spec), relation == '>', spec);
+    }
+    auto window = parseWindow(value, spec);
+    return range(key, window.first, window.second, spec);
+  }
+
+  // Evaluate the cut over every row
+  RowMask evaluate(const ParticleColumns& columns, unsigned threads = 0) const {
+    if (maskBuilder) {
+      return maskBuilder(columns, threads);
+    }
+    RowMask mask(columns.size());
+    std::uint64_t* words = mask.getWords().data();
+    parallelFor(mask.getWords().size(), threads, [&](size_t first, size_t last, size_t) {
+      std::uint8_t match[64];
+      for (size_t word = first; word < last; ++word) {
+        size_t begin = word * 64, end = std::min(columns.size(), begin + 64);
+        kernel(columns, begin, end, match);
+        std::uint64_t bits = 0;
+        for (size_t i = 0; i < end - begin; ++i) {
+          bits |= std::uint64_t(match[i] & 1) << i;
+        }
+        words[word] = bits;
+      }
+    });
+    return mask;
+  }
+
+private:
+  std::string name;
+  Kernel kernel;
+  MaskBuilder maskBuilder;
+
+  static std::pair<double, double> parseWindow(const std::string& value, const std::string& spec) {
+    size_t colon = value.find(':');
+    if (colon == std::string::npos) {
+      throw std::invalid_argument("Cut '" + spec + "' needs a LOW:HIGH window");
+    }
+    return {parseNumber(value.substr(0, colon), spec), parseNumber(value.substr(colon + 1), spec)};
+  }
+
+  static double parseNumber(const std::string& text, const std::string& spec) {
+    char* end = nullptr;
+    double number = std::strtod(text.c_str(), &end);
+    if (text.empty() || std::isspace(static_cast<unsigned char>(text[0])) || end != text.c_str() + text.size()) {
+      throw std::invalid_argument("Cut '" + spec + "' has an invalid number '" + text + "'");
+    }
+    return number;
+  }
+};
+
+// Rows surviving each step of a cut flow
+struct CutFlowStep {
+  std::string name;
+  size_t passed = 0;     // Rows passing this step alone
+  size_t cumulative = 0; // Rows passing this and every earlier step
+};
+
+struct CutFlowTable {
+  size_t total = 0;
+  std::vector<CutFlowStep> steps;
+  RowMask selected; // Rows passing every step
+
+  // Write "cut passed cumulative efficiency" lines, efficiency relative to the previous step
+  void print(std::ostream& out) const {
+    out << "cut passed cumulative efficiency\n"
+        << "all " << total << ' ' << total << " 1\n";
+    size_t previous = total;
+    for (const auto& step : steps) {
+      out << step.name << ' ' << step.passed << ' ' << step.cumulative << ' '
+          << (previous > 0 ? static_cast<double>(step.cumulative) / static_cast<double>(previous) : 0.0) << '\n';
+      previous = step.cumulative;
+    }
+  }
+};
+
+// An ordered list of steps, each the OR of one or more cuts; a row is selected if it passes every
+// step. Each cut is evaluated once into a mask and the table comes from popcounts of the masks.
+class CutFlow {
+public:
+  // Append a step that keeps rows passing cut
+  CutFlow& add(Cut cut) {
+    steps.push_back({std::move(cut)});
+    return *this;
+  }
+
+  // Append a step that keeps rows passing any of cuts
+  CutFlow& addAnyOf(std::vector<Cut> cuts) {
+    if (cuts.empty()) {
+      throw std::invalid_argument("A cut-flow step needs at least one cut");
+    }
+    steps.push_back(std::move(cuts));
+    return *this;
+  }
+
+  // Append a step parsed from "CUT|CUT|..." (see Cut::parse)
+  CutFlow& add(const std::string& spec) {
+    std::vector<Cut> cuts;
+    for (size_t start = 0; start <= spec.size();) {
+      size_t bar = std::min(spec.find('|', start), spec.size());
+      cuts.push_back(Cut::parse(spec.substr(start, bar - start)));
+      start = bar + 1;
+    }
+    return addAnyOf(std::move(cuts));
+  }
+
+  size_t stepCount() const { return steps.size(); }
+
+  // Evaluate every cut over the columns and build the cut-flow table
+  CutFlowTable run(const ParticleColumns& columns, unsigned threads = 0) const {
+    CutFlowTable table;
+    table.total = columns.size();
+    table.selected = RowMask(columns.size(), true);
+    for (const auto& step : steps) {
+      RowMask mask = step[0].evaluate(columns, threads);
+      std::string name = step[0].getName();
+      for (size_t i = 1; i < step.size(); ++i) {
+        mask |= step[i].evaluate(columns, threads);
+        name += "|" + step[i].getName();
+      }
+      table.selected &= mask;
+      table.steps.push_back({name, mask.count(), table.selected.count()});
+    }
+    return table;
+  }
+
+private:
+  std::vector<std::vector<Cut>> steps;
+};
+
+#endif // CUTFLOW_H
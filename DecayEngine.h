@@ -0,0 +1,233 @@
+// DecayEngine.h - Defines DecayEngine, which decays unstable particles (tau, W, Z, Higgs) into their products.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef DECAYENGINE_H
+#define DECAYENGINE_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+#include "Particle.h"
+#include "electron.h"
+#include "neutrino.h"
+#include "quark.h"
+#include "photon.h"
+#include "tau.h"
+#include "WBoson.h"
+#include "ZBoson.h"
+#include "HiggsBoson.h"
+#include "ParallelFor.h"
+#include "PhiloxRandom.h"
+
+// Picks decay channels from a RandomStream keyed by (seed, event id), so the products of an event
+// depend only on those two numbers: events can be decayed in any order, on any thread, and a
+// single event can be regenerated later without replaying the rest of the run.
+class DecayEngine {
+public:
+  explicit DecayEngine(std::uint64_t seed = 1) : seed(seed) {}
+
+  std::uint64_t getSeed() const { return seed; }
+
+  // Print each decay and its products to a stream (nullptr for silent decays)
+  void setLog(std::ostream* stream) { log = stream; }
+
+  // Decay one particle as event `eventId`; returns false if the particle is stable
+  bool decay(const std::shared_ptr<Particle>& particle, std::uint64_t eventId) const {
+    RandomStream random = eventStream(eventId);
+    return decay(particle, random);
+  }
+
+  // Get the channel stream of event `eventId`. ParticleGenerator draws row r from (seed, r), so the
+  // key is salted: otherwise a row's species would decide its first decay channel.
+  RandomStream eventStream(std::uint64_t eventId) const { return RandomStream(seed ^ streamSalt, eventId); }
+
+  // Decay particles[i] as event firstEventId + i, in parallel
+  void decayAll(const std::vector<std::shared_ptr<Particle>>& particles, std::uint64_t firstEventId = 0,
+                unsigned threads = 0) const {
+    parallelFor(particles.size(), threads, [&](size_t begin, size_t end, size_t) {
+      for (size_t i = begin; i < end; ++i) {
+        decay(particles[i], firstEventId + i);
+      }
+    });
+  }
+
+  // Decay one particle with channels drawn from the given stream
+  bool decay(const std::shared_ptr<Particle>& particle, RandomStream& random) const {
+    std::vector<std::shared_ptr<Particle>> decayProducts = products(*particle, random);
+    if (decayProducts.empty()) {
+      return false;
+    }
+    checkConservation(*particle, decayProducts);
+    for (const auto& product : decayProducts) {
+      attach(*particle, product);
+    }
+    return true;
+  }
+
+  // Throw if the products' charge, lepton number or baryon number do not sum to the parent's
+  static void checkConservation(const Particle& parent, const std::vector<std::shared_ptr<Particle>>& products) {
+    double charge = 0, baryonNumber = 0;
+    int leptonNumber = 0;
+    for (const auto& product : products) {
+      charge += product->getCharge();
+      leptonNumber += product->getLeptonNumber();
+      baryonNumber += product->getBaryonNumber();
+    }
+    if (std::abs(charge - parent.getCharge()) > 1e-2) {
+      throw std::runtime_error("Decay products' charges do not sum up to the original " + parent.getTypeName() + "'s charge");
+    }
+    if (leptonNumber != parent.getLeptonNumber()) {
+      throw std::runtime_error("Decay products' lepton numbers do not sum up to the original " + parent.getTypeName() + "'s lepton number");
+    }
+    if (std::abs(baryonNumber - parent.getBaryonNumber()) > 1e-6) {
+      throw std::runtime_error("Decay products' baryon numbers do not sum up to the original " + parent.getTypeName() + "'s baryon number");
+    }
+  }
+
+  // Build the products of one decay without attaching them to the parent (empty if stable)
+  std::vector<std::shared_ptr<Particle>> products(const Particle& particle, RandomStream& random) const {
+    if (auto tau = dynamic_cast<const Tau*>(&particle)) {
+      // Tau decays: leptonic to an electron and two neutrinos, hadronic to a quark pair and a neutrino
+      std::shared_ptr<Particle> decayProduct1, decayProduct2, decayProduct3;
+      announce("Handling Tau decay");
+      bool leptonic = random.choose(2) == 0;
+      if (tau->getCharge() > 0) {
+        if (leptonic) {
+          decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, -1, tau->getFourMomentum(), 0.511, true); // Positron
+          decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, 1, tau->getFourMomentum(), 0.0, "Neutrino", false, false);
+          decayProduct3 = std::make_shared<Neutrino>(0.0, 0.5, -1, tau->getFourMomentum(), 0.0, "Anti-Neutrino", false, true);
+        } else {
+          decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "red", tau->getFourMomentum(), 2.3, "Up Quark", false);
+          decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", tau->getFourMomentum(), 4.8, "Anti-Down Quark", true);
+          decayProduct3 = std::make_shared<Neutrino>(0.0, 0.5, -1, tau->getFourMomentum(), 0.0, "Anti-Neutrino", false, true);
+        }
+      } else {
+        if (leptonic) {
+          decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, tau->getFourMomentum(), 0.511);
+          decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, 1, tau->getFourMomentum(), 0.0, "Neutrino", false, false);
+          decayProduct3 = std::make_shared<Neutrino>(0.0, 0.5, -1, tau->getFourMomentum(), 0.0, "Anti-Neutrino", false, true);
+        } else {
+          decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", tau->getFourMomentum(), 2.3, "Anti-Up Quark", true);
+          decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "red", tau->getFourMomentum(), 4.8, "Down Quark", false);
+          decayProduct3 = std::make_shared<Neutrino>(0.0, 0.5, 1, tau->getFourMomentum(), 0.0, "Neutrino", false, false);
+        }
+      }
+
+      report({decayProduct1, decayProduct2, decayProduct3});
+      return {decayProduct1, decayProduct2, decayProduct3};
+
+    } else if (dynamic_cast<const HiggsBoson*>(&particle)) {
+      // Higgs decays
+      std::shared_ptr<Particle> decayProduct1, decayProduct2;
+      announce("Handling Higgs decay");
+      switch (random.choose(4)) {
+        case 0:
+          decayProduct1 = std::make_shared<ZBoson>(0.0, 1.0, FourMomentum(45.6, 0.0, 0.0, 0.0), 91200.0);
+          decayProduct2 = std::make_shared<ZBoson>(0.0, 1.0, FourMomentum(45.6, 0.0, 0.0, 0.0), 91200.0);
+          break;
+        case 1:
+          decayProduct1 = std::make_shared<WBoson>(1.0, 1.0, FourMomentum(40.2, 0.0, 0.0, 0.0), 80400.0);
+          decayProduct2 = std::make_shared<WBoson>(1.0, 1.0, FourMomentum(40.2, 0.0, 0.0, 0.0), 80400.0, true);
+          break;
+        case 2:
+          decayProduct1 = std::make_shared<Photon>(FourMomentum(62.55, 0.0, 0.0, 0.0));
+          decayProduct2 = std::make_shared<Photon>(FourMomentum(62.55, 0.0, 0.0, 0.0));
+          break;
+        default:
+          decayProduct1 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "red", FourMomentum(4180.0, 0.0, 0.0, 0.0), 4.18, "Bottom Quark", false);
+          decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", FourMomentum(4180.0, 0.0, 0.0, 0.0), 4.18, "Anti-Bottom", true);
+          break;
+      }
+
+      report({decayProduct1, decayProduct2});
+      return {decayProduct1, decayProduct2};
+
+    } else if (auto wboson = dynamic_cast<const WBoson*>(&particle)) {
+      // W boson decays
+      std::shared_ptr<Particle> decayProduct1, decayProduct2;
+      bool leptonic = random.choose(2) == 0;
+      if (wboson->getCharge() > 0) {
+        announce("Handling W+ Boson decay");
+        if (leptonic) {
+          decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, -1, wboson->getFourMomentum(), 0.511, true); // Positron (anti-electron)
+          decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, 1, wboson->getFourMomentum(), 0.0, "Neutrino", false, false);
+        } else {
+          decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "red", wboson->getFourMomentum(), 2.3, "up", false); // Up quark
+          decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", wboson->getFourMomentum(), 4.8, "anti-down", true); // Anti-down quark
+        }
+      } else {
+        announce("Handling W- Boson decay");
+        if (leptonic) {
+          decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, wboson->getFourMomentum(), 0.511); // Electron
+          decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, -1, wboson->getFourMomentum(), 0.0, "Anti-Neutrino", false, true); // Anti-neutrino
+        } else {
+          decayProduct1 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "blue", wboson->getFourMomentum(), 4.8, "down", false); // Down quark
+          decayProduct2 = std::make_shared<Quark>(2.0 / 3.0, 0.5, -1.0 / 3.0, "anti-blue", wboson->getFourMomentum(), 2.3, "anti-up", true); // Anti-up quark
+        }
+      }
+
+      report({decayProduct1, decayProduct2});
+      return {decayProduct1, decayProduct2};
+
+    } else if (auto zboson = dynamic_cast<const ZBoson*>(&particle)) {
+      // Z boson decays
+      std::shared_ptr<Particle> decayProduct1, decayProduct2;
+      announce("Handling Z Boson decay");
+
+      if (random.choose(2) == 0) {
+        // Leptonic decay
+        decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, zboson->getFourMomentum(), 0.511);
+        decayProduct2 = std::make_shared<Electron>(-1.0, 0.5, -1, zboson->getFourMomentum(), 0.511, true);
+      } else {
+        // Hadronic decay
+        decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "red", zboson->getFourMomentum(), 2.3, "Up Quark", false);
+        decayProduct2 = std::make_shared<Quark>(2.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", zboson->getFourMomentum(), 2.3, "Anti-Up Quark", true);
+      }
+
+      report({decayProduct1, decayProduct2});
+      return {decayProduct1, decayProduct2};
+
+    }
+    return {};
+  }
+
+private:
+  static constexpr std::uint64_t streamSalt = 0xD1B54A32D192ED03ull;
+
+  std::uint64_t seed;
+  std::ostream* log = nullptr;
+
+  // Add a product to whichever unstable type the parent is
+  static void attach(Particle& parent, const std::shared_ptr<Particle>& product) {
+    if (auto tau = dynamic_cast<Tau*>(&parent)) {
+      tau->addDecayProduct(product);
+    } else if (auto higgs = dynamic_cast<HiggsBoson*>(&parent)) {
+      higgs->addDecayProduct(product);
+    } else if (auto wboson = dynamic_cast<WBoson*>(&parent)) {
+      wboson->addDecayProduct(product);
+    } else if (auto zboson = dynamic_cast<ZBoson*>(&parent)) {
+      zboson->addDecayProduct(product);
+    }
+  }
+
+  void announce(const char* message) const {
+    if (log) {
+      *log << message << std::endl;
+    }
+  }
+
+  void report(const std::vector<std::shared_ptr<Particle>>& products) const {
+    if (!log) {
+      return;
+    }
+    *log << "Decay products created: " << std::endl;
+    for (size_t i = 0; i < products.size(); ++i) {
+      *log << "Decay product " << i + 1 << ": " << products[i]->getTypeName() << " (Charge: " << products[i]->getCharge() << ")" << std::endl;
+    }
+  }
+};
+
+#endif // DECAYENGINE_H
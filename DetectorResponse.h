@@ -0,0 +1,183 @@
+// DetectorResponse.h - Defines DetectorResponse, a batch stage that fills electron calorimeter
+// depositions and muon isolation flags for a whole catalogue.
+// Author: Raul Scanlon, Date: 30/05/2024
+
+#ifndef DETECTORRESPONSE_H
+#define DETECTORRESPONSE_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include "ParallelFor.h"
+#include "ParticleCatalogue.h"
+#include "ParticleColumns.h"
+
+// Emulates the detector on synthetic samples:
+//  - electrons shower longitudinally following a gamma-distribution profile
+//    dE/dt ~ t^(a-1) e^(-bt), with the maximum at t = ln(E/Ec) - 0.5 radiation lengths,
+//    integrated over the four calorimeter layers;
+//  - muons are isolated when the scalar pT sum of visible particles inside a
+//    cone of radius deltaR (excluding the muon) is below a fraction of the muon pT.
+class DetectorResponse {
+public:
+  double criticalEnergy = 11.0; // Ec in MeV
+  double profileSlope = 0.5; // b, per radiation length
+  std::array<double, 5> layerBoundaries = {0, 2, 8, 18, 26}; // In radiation lengths
+  double isolationCone = 0.3; // deltaR
+  double isolationFraction = 0.1; // Max cone pT sum / muon pT
+  unsigned threads = 0; // 0 uses every hardware thread
+
+  // Fill calorimeter columns and the isolation flag for every electron and muon row
+  void apply(ParticleColumns& columns) const {
+    std::vector<size_t> electrons, muons;
+    for (size_t row = 0; row < columns.size(); ++row) {
+      if (columns.kind[row] == ParticleKind::Electron) {
+        electrons.push_back(row);
+      } else if (columns.kind[row] == ParticleKind::Muon) {
+        muons.push_back(row);
+      }
+    }
+
+    // Electron showers, in batches so the per-step loop runs over contiguous arrays
+    size_t batches = (electrons.size() + batchSize - 1) / batchSize;
+    parallelFor(batches, threads, [&](size_t begin, size_t end, size_t) {
+      std::array<double, batchSize> energy;
+      std::array<std::array<double, batchSize>, 4> deposits;
+      for (size_t batch = begin; batch < end; ++batch) {
+        size_t first = batch * batchSize;
+        size_t count = std::min(batchSize, electrons.size() - first);
+        for (size_t i = 0; i < count; ++i) {
+          energy[i] = columns.energy[electrons[first + i]];
+        }
+        shower(energy.data(), count, deposits);
+        for (size_t i = 0; i < count; ++i) {
+          for (size_t layer = 0; layer < 4; ++layer) {
+            columns.calorimeter[layer][electrons[first + i]] = deposits[layer][i];
+          }
+        }
+      }
+    });
+
+    // Muon isolation
+    std::vector<bool> isolated = computeIsolation(columns, muons);
+    for (size_t i = 0; i < muons.size(); ++i) {
+      std::uint8_t& rowFlags = columns.flags[muons[i]];
+      rowFlags = isolated[i] ? (rowFlags | FlagIsolation) : (rowFlags & ~FlagIsolation);
+    }
+  }
+
+  // Run the stage over a catalogue, writing results back into the Electron and Muon objects
+  void apply(ParticleCatalogue& catalogue) const {
+    ParticleColumns columns = ParticleColumns::fromCatalogue(catalogue);
+    apply(columns);
+    const auto& particles = catalogue.getParticles();
+    for (size_t row = 0; row < particles.size(); ++row) {
+      if (columns.kind[row] == ParticleKind::Electron) {
+        auto& electron = static_cast<Electron&>(*particles[row]);
+        for (size_t layer = 0; layer < 4; ++layer) {
+          electron.setCalorimeterEnergy(layer, columns.calorimeter[layer][row]);
+        }
+      } else if (columns.kind[row] == ParticleKind::Muon) {
+        static_cast<Muon&>(*particles[row]).setIsolation((columns.flags[row] & FlagIsolation) != 0);
+      }
+    }
+  }
+
+private:
+  static constexpr size_t batchSize = 256;
+  static constexpr double integrationStep = 0.25; // Radiation lengths
+  static constexpr double profileEnd = 40.0; // Depth treated as full containment
+
+  // Integrate the longitudinal profile of `count` showers over every layer
+  void shower(const double* energy, size_t count, std::array<std::array<double, batchSize>, 4>& deposits) const {
+    std::array<double, batchSize> alphaMinusOne, total;
+    for (size_t i = 0; i < count; ++i) {
+      double tMax = std::max(0.0, std::log(std::max(energy[i], 1e-12) / criticalEnergy) - 0.5);
+      alphaMinusOne[i] = profileSlope * tMax; // a - 1 = b * tMax
+      total[i] = 0;
+    }
+    for (auto& layer : deposits) {
+      std::fill(layer.begin(), layer.begin() + count, 0.0);
+    }
+
+    for (double t = 0.5 * integrationStep; t < profileEnd; t += integrationStep) {
+      int layer = layerOf(t);
+      double logT = std::log(profileSlope * t);
+      double bt = profileSlope * t;
+      double* layerSum = layer >= 0 ? deposits[layer].data() : nullptr;
+      for (size_t i = 0; i < count; ++i) {
+        double weight = std::exp(alphaMinusOne[i] * logT - bt);
+        total[i] += weight;
+        if (layerSum) {
+          layerSum[i] += weight;
+        }
+      }
+    }
+
+    for (size_t layer = 0; layer < 4; ++layer) {
+      for (size_t i = 0; i < count; ++i) {
+        deposits[layer][i] = total[i] > 0 ? energy[i] * deposits[layer][i] / total[i] : 0.0;
+      }
+    }
+  }
+
+  // Get the calorimeter layer containing depth t, or -1 beyond the last layer
+  int layerOf(double t) const {
+    for (int layer = 0; layer < 4; ++layer) {
+      if (t >= layerBoundaries[layer] && t < layerBoundaries[layer + 1]) {
+        return layer;
+      }
+    }
+    return -1;
+  }
+
+  // Cone pT sums for the given muon rows using eta-sorted neighbour windows
+  std::vector<bool> computeIsolation(const ParticleColumns& columns, const std::vector<size_t>& muons) const {
+    size_t rows = columns.size();
+    std::vector<double> eta(rows), phi(rows), pt(rows);
+    for (size_t row = 0; row < rows; ++row) {
+      double px = columns.px[row], py = columns.py[row];
+      pt[row] = std::sqrt(px * px + py * py);
+      phi[row] = std::atan2(py, px);
+      eta[row] = pt[row] > 0 ? std::asinh(columns.pz[row] / pt[row]) : std::copysign(1e6, columns.pz[row]);
+      if (columns.kind[row] == ParticleKind::Neutrino) {
+        pt[row] = 0; // Invisible to the detector
+      }
+    }
+
+    std::vector<size_t> order(rows);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&eta](size_t a, size_t b) { return eta[a] < eta[b]; });
+    std::vector<double> sortedEta(rows), sortedPhi(rows), sortedPt(rows);
+    for (size_t i = 0; i < rows; ++i) {
+      sortedEta[i] = eta[order[i]];
+      sortedPhi[i] = phi[order[i]];
+      sortedPt[i] = pt[order[i]];
+    }
+
+    const double cone2 = isolationCone * isolationCone;
+    const double twoPi = 6.283185307179586;
+    std::vector<char> isolated(muons.size());
+    parallelFor(muons.size(), threads, [&](size_t begin, size_t end, size_t) {
+      for (size_t i = begin; i < end; ++i) {
+        size_t row = muons[i];
+        size_t first = std::lower_bound(sortedEta.begin(), sortedEta.end(), eta[row] - isolationCone) - sortedEta.begin();
+        size_t last = std::upper_bound(sortedEta.begin(), sortedEta.end(), eta[row] + isolationCone) - sortedEta.begin();
+        double sum = 0;
+        for (size_t j = first; j < last; ++j) {
+          double dEta = sortedEta[j] - eta[row];
+          double dPhi = std::abs(sortedPhi[j] - phi[row]);
+          dPhi = std::min(dPhi, twoPi - dPhi);
+          sum += (dEta * dEta + dPhi * dPhi < cone2) ? sortedPt[j] : 0.0;
+        }
+        sum -= pt[row]; // The muon itself sits at deltaR = 0
+        isolated[i] = sum <= isolationFraction * pt[row];
+      }
+    });
+    return std::vector<bool>(isolated.begin(), isolated.end());
+  }
+};
+
+#endif // DETECTORRESPONSE_H
@@ -0,0 +1,833 @@
+// FilterExpression.h - Defines FilterExpression, a row selection written as text such as
+// "kind==Electron && E>20 && abs(charge)==1", compiled once into bytecode that a small virtual
+// machine runs over batches of catalogue columns.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef FILTEREXPRESSION_H
+#define FILTEREXPRESSION_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ColumnKey.h"
+#include "CutFlow.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+#include "ParticleKind.h"
+
+// Instructions of a compiled filter. Number registers hold one double per row of a batch and
+// mask registers one 0/1 byte per row. Binary number and comparison instructions take their right
+// operand from register b, or from the instruction's constant when b is noRegister.
+enum class FilterOp : std::uint8_t {
+  LoadColumn,   // number[dst] = a double column (no copy: the register points into the columns)
+  LoadLepton,   // number[dst] = lepton number
+  LoadKey,      // number[dst] = a derived ColumnKey (pt, mass, eta, phi)
+  LoadConstant, // number[dst] = constant
+  LoadFlag,     // mask[dst] = (flags & field) != 0
+  KindEquals,   // mask[dst] = kind == field
+  FillMask,     // mask[dst] = constant != 0
+  Negate,       // number[dst] = -number[a]
+  Abs,
+  Sqrt,
+  Add,          // number[dst] = number[a] + right
+  Subtract,
+  Multiply,
+  Divide,
+  Min,
+  Max,
+  Less,         // mask[dst] = number[a] < right
+  LessEqual,
+  Greater,
+  GreaterEqual,
+  Equal,
+  NotEqual,
+  And,          // mask[dst] = mask[a] & mask[b]
+  Or,
+  Not           // mask[dst] = !mask[a]
+};
+
+// Double columns a filter can read directly
+enum class FilterColumn : std::uint8_t {
+  Charge, Spin, Energy, Px, Py, Pz, RestMass, BaryonNumber, Calorimeter1, Calorimeter2, Calorimeter3, Calorimeter4
+};
+
+struct FilterInstruction {
+  static constexpr std::uint16_t noRegister = 0xFFFF;
+
+  FilterOp op;
+  std::uint16_t dst = 0;
+  std::uint16_t a = noRegister;
+  std::uint16_t b = noRegister;
+  std::uint8_t field = 0; // FilterColumn, ColumnKey, flag bits or ParticleKind, depending on op
+  double constant = 0;
+};
+
+// A compiled selection. Grammar, loosest binding first:
+//   a || b    a && b    !a    x == y  x != y  x < y  x <= y  x > y  x >= y    x + y  x - y    x * y  x / y    -x
+// with numbers, parentheses, abs(x), sqrt(x), min(x, y), max(x, y), true and false. Names are
+// case-insensitive: kind, charge, spin, E (energy), px, py, pz, pt, m (mass), restmass, eta, phi,
+// baryon, lepton, calo1 .. calo4, and the flags isolated and interacting. kind compares with
+// particle kind names (kind==Electron, kind!=Muon). The program is type checked and constant
+// folded when compiled; evaluation runs each instruction as a branch-free loop over batchRows
+// rows, so there is no per-row interpretation and the loops vectorize.
+class FilterExpression {
+public:
+  static constexpr size_t batchRows = 1024;
+
+  explicit FilterExpression(const std::string& text) : text(text) {
+    Compiler compiler(*this);
+    compiler.compile();
+  }
+
+  const std::string& getText() const { return text; }
+  const std::vector<FilterInstruction>& getInstructions() const { return program; }
+
+  // Tell a filter expression from a CutFlow cut spec (which has no spaces, parentheses, !, &&,
+  // ||, ==, <= or >=)
+  static bool looksLikeExpression(const std::string& spec) {
+    for (const char* marker : {" ", "(", "!", "&&", "||", "==", "<=", ">="}) {
+      if (spec.find(marker) != std::string::npos) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Evaluate rows [begin, end) into match[0 .. end - begin) (0 or 1 per row)
+  void evaluate(const ParticleColumns& columns, size_t begin, size_t end, std::uint8_t* match) const {
+    Scratch& scratch = threadScratch();
+    for (size_t first = begin; first < end; first += batchRows) {
+      size_t last = std::min(end, first + batchRows);
+      run(columns, first, last, scratch);
+      const std::uint8_t* result = scratch.mask(resultRegister);
+      std::copy(result, result + (last - first), match + (first - begin));
+    }
+  }
+
+  // Evaluate every row
+  RowMask evaluate(const ParticleColumns& columns, unsigned threads = 0) const {
+    RowMask mask(columns.size());
+    std::uint64_t* words = mask.getWords().data();
+    size_t batches = (columns.size() + batchRows - 1) / batchRows;
+    // A batch covers whole mask words, so threads never share a word
+    parallelFor(batches, threads, [&](size_t first, size_t last, size_t) {
+      Scratch& scratch = threadScratch();
+      for (size_t batch = first; batch < last; ++batch) {
+        size_t begin = batch * batchRows, end = std::min(columns.size(), begin + batchRows);
+        run(columns, begin, end, scratch);
+        const std::uint8_t* result = scratch.mask(resultRegister);
+        for (size_t word = begin / 64; word * 64 < end; ++word) {
+          words[word] = packBits(result + (word * 64 - begin), std::min<size_t>(64, end - word * 64));
+        }
+      }
+    });
+    return mask;
+  }
+
+  // Write the program, one instruction per line (n = number register, m = mask register)
+  void disassemble(std::ostream& out) const {
+    static const char* names[] = {"load", "lepton", "key", "const", "flag", "kind==", "fill", "neg", "abs", "sqrt",
+                                  "add", "sub", "mul", "div", "min", "max", "lt", "le", "gt", "ge", "eq", "ne",
+                                  "and", "or", "not"};
+    for (const auto& instruction : program) {
+      const char* operand = instruction.op >= FilterOp::And ? " m" : " n";
+      out << names[static_cast<size_t>(instruction.op)] << (writesMask(instruction.op) ? " m" : " n") << instruction.dst;
+      if (instruction.a != FilterInstruction::noRegister) {
+        out << operand << instruction.a;
+      }
+      if (instruction.b != FilterInstruction::noRegister) {
+        out << operand << instruction.b;
+      } else if (instruction.op >= FilterOp::Add && instruction.op <= FilterOp::NotEqual) {
+        out << ' ' << instruction.constant;
+      } else if (instruction.op == FilterOp::LoadConstant || instruction.op == FilterOp::FillMask) {
+        out << ' ' << instruction.constant;
+      } else if (instruction.op <= FilterOp::KindEquals) {
+        out << " #" << static_cast<int>(instruction.field);
+      }
+      out << '\n';
+    }
+  }
+
+private:
+  std::string text;
+  std::vector<FilterInstruction> program;
+  size_t numberRegisters = 0;
+  size_t maskRegisters = 0;
+  std::uint16_t resultRegister = 0; // Mask register holding the selection
+
+  static bool writesMask(FilterOp op) {
+    return op == FilterOp::LoadFlag || op == FilterOp::KindEquals || op == FilterOp::FillMask || op >= FilterOp::Less;
+  }
+
+  // Per-thread register storage, grown to fit the largest program run on the thread
+  struct Scratch {
+    std::vector<double> numbers;
+    std::vector<std::uint8_t> masks;
+    std::vector<const double*> number; // Where each number register's values are for this batch
+
+    void fit(size_t numberRegisters, size_t maskRegisters) {
+      if (numbers.size() < numberRegisters * batchRows) {
+        numbers.resize(numberRegisters * batchRows);
+        number.resize(numberRegisters);
+      }
+      if (masks.size() < maskRegisters * batchRows) {
+        masks.resize(maskRegisters * batchRows);
+      }
+    }
+
+    double* numberOut(std::uint16_t reg) {
+      number[reg] = numbers.data() + reg * batchRows;
+      return numbers.data() + reg * batchRows;
+    }
+    std::uint8_t* mask(std::uint16_t reg) { return masks.data() + reg * batchRows; }
+  };
+
+  // Pack up to 64 bytes of 0 or 1 into the low bits of a word, eight at a time: multiplying the
+  // eight bytes of a (little-endian) word by 0x0102040810204080 gathers their low bits into the top byte
+  static std::uint64_t packBits(const std::uint8_t* bytes, size_t rows) {
+    std::uint64_t bits = 0;
+    size_t i = 0;
+    for (; i + 8 <= rows; i += 8) {
+      std::uint64_t eight;
+      std::memcpy(&eight, bytes + i, sizeof(eight));
+      bits |= ((eight * 0x0102040810204080ULL) >> 56) << i;
+    }
+    for (; i < rows; ++i) {
+      bits |= std::uint64_t(bytes[i] & 1) << i;
+    }
+    return bits;
+  }
+
+  static Scratch& threadScratch() {
+    thread_local Scratch scratch;
+    return scratch;
+  }
+
+  static const double* columnData(const ParticleColumns& columns, FilterColumn column) {
+    switch (column) {
+    case FilterColumn::Charge: return columns.charge.data();
+    case FilterColumn::Spin: return columns.spin.data();
+    case FilterColumn::Energy: return columns.energy.data();
+    case FilterColumn::Px: return columns.px.data();
+    case FilterColumn::Py: return columns.py.data();
+    case FilterColumn::Pz: return columns.pz.data();
+    case FilterColumn::RestMass: return columns.restMass.data();
+    case FilterColumn::BaryonNumber: return columns.baryonNumber.data();
+    case FilterColumn::Calorimeter1: return columns.calorimeter[0].data();
+    case FilterColumn::Calorimeter2: return columns.calorimeter[1].data();
+    case FilterColumn::Calorimeter3: return columns.calorimeter[2].data();
+    case FilterColumn::Calorimeter4: return columns.calorimeter[3].data();
+    }
+    return nullptr;
+  }
+
+  // Right operand loops: register or immediate
+  template <typename Apply>
+  static void numberLoop(const double* x, const double* y, double constant, size_t n, double* out, Apply apply) {
+    if (y) {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = apply(x[i], y[i]);
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = apply(x[i], constant);
+      }
+    }
+  }
+
+  template <typename Apply>
+  static void compareLoop(const double* x, const double* y, double constant, size_t n, std::uint8_t* out, Apply apply) {
+    if (y) {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = apply(x[i], y[i]);
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = apply(x[i], constant);
+      }
+    }
+  }
+
+  // Run the program over rows [begin, end), leaving the selection in resultRegister
+  void run(const ParticleColumns& columns, size_t begin, size_t end, Scratch& scratch) const {
+    scratch.fit(numberRegisters, maskRegisters);
+    size_t n = end - begin;
+    for (const auto& in : program) {
+      const double* x = in.a != FilterInstruction::noRegister && in.op < FilterOp::And ? scratch.number[in.a] : nullptr;
+      const double* y = in.b != FilterInstruction::noRegister && in.op < FilterOp::And ? scratch.number[in.b] : nullptr;
+      double c = in.constant;
+      switch (in.op) {
+      case FilterOp::LoadColumn:
+        scratch.number[in.dst] = columnData(columns, static_cast<FilterColumn>(in.field)) + begin;
+        break;
+      case FilterOp::LoadLepton: {
+        double* out = scratch.numberOut(in.dst);
+        const std::int32_t* lepton = columns.leptonNumber.data() + begin;
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = lepton[i];
+        }
+        break;
+      }
+      case FilterOp::LoadKey: {
+        double* out = scratch.numberOut(in.dst);
+        const double *e = columns.energy.data() + begin, *px = columns.px.data() + begin;
+        const double *py = columns.py.data() + begin, *pz = columns.pz.data() + begin;
+        ColumnKey key = static_cast<ColumnKey>(in.field);
+        if (key == ColumnKey::Pt) {
+          for (size_t i = 0; i < n; ++i) {
+            out[i] = std::sqrt(px[i] * px[i] + py[i] * py[i]);
+          }
+        } else if (key == ColumnKey::Mass) {
+          for (size_t i = 0; i < n; ++i) {
+            double m2 = e[i] * e[i] - px[i] * px[i] - py[i] * py[i] - pz[i] * pz[i];
+            out[i] = std::sqrt(m2 > 0 ? m2 : 0.0);
+          }
+        } else {
+          columnKeyValues(columns, key, begin, end, out);
+        }
+        break;
+      }
+      case FilterOp::LoadConstant:
+        std::fill(scratch.numberOut(in.dst), scratch.numberOut(in.dst) + n, c);
+        break;
+      case FilterOp::LoadFlag: {
+        std::uint8_t* out = scratch.mask(in.dst);
+        const std::uint8_t* flags = columns.flags.data() + begin;
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = (flags[i] & in.field) != 0;
+        }
+        break;
+      }
+      case FilterOp::KindEquals: {
+        std::uint8_t* out = scratch.mask(in.dst);
+        const ParticleKind* kind = columns.kind.data() + begin;
+        ParticleKind wanted = static_cast<ParticleKind>(in.field);
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = kind[i] == wanted;
+        }
+        break;
+      }
+      case FilterOp::FillMask:
+        std::fill(scratch.mask(in.dst), scratch.mask(in.dst) + n, static_cast<std::uint8_t>(c != 0));
+        break;
+      case FilterOp::Negate:
+        numberLoop(x, nullptr, 0, n, scratch.numberOut(in.dst), [](double v, double) { return -v; });
+        break;
+      case FilterOp::Abs:
+        numberLoop(x, nullptr, 0, n, scratch.numberOut(in.dst), [](double v, double) { return std::fabs(v); });
+        break;
+      case FilterOp::Sqrt:
+        numberLoop(x, nullptr, 0, n, scratch.numberOut(in.dst), [](double v, double) { return std::sqrt(v); });
+        break;
+      case FilterOp::Add:
+        numberLoop(x, y, c, n, scratch.numberOut(in.dst), [](double u, double v) { return u + v; });
+        break;
+      case FilterOp::Subtract:
+        numberLoop(x, y, c, n, scratch.numberOut(in.dst), [](double u, double v) { return u - v; });
+        break;
+      case FilterOp::Multiply:
+        numberLoop(x, y, c, n, scratch.numberOut(in.dst), [](double u, double v) { return u * v; });
+        break;
+      case FilterOp::Divide:
+        numberLoop(x, y, c, n, scratch.numberOut(in.dst), [](double u, double v) { return u / v; });
+        break;
+      case FilterOp::Min:
+        numberLoop(x, y, c, n, scratch.numberOut(in.dst), [](double u, double v) { return v < u ? v : u; });
+        break;
+      case FilterOp::Max:
+        numberLoop(x, y, c, n, scratch.numberOut(in.dst), [](double u, double v) { return u < v ? v : u; });
+        break;
+      case FilterOp::Less:
+        compareLoop(x, y, c, n, scratch.mask(in.dst), [](double u, double v) { return u < v; });
+        break;
+      case FilterOp::LessEqual:
+        compareLoop(x, y, c, n, scratch.mask(in.dst), [](double u, double v) { return u <= v; });
+        break;
+      case FilterOp::Greater:
+        compareLoop(x, y, c, n, scratch.mask(in.dst), [](double u, double v) { return u > v; });
+        break;
+      case FilterOp::GreaterEqual:
+        compareLoop(x, y, c, n, scratch.mask(in.dst), [](double u, double v) { return u >= v; });
+        break;
+      case FilterOp::Equal:
+        compareLoop(x, y, c, n, scratch.mask(in.dst), [](double u, double v) { return u == v; });
+        break;
+      case FilterOp::NotEqual:
+        compareLoop(x, y, c, n, scratch.mask(in.dst), [](double u, double v) { return u != v; });
+        break;
+      case FilterOp::And: {
+        std::uint8_t* out = scratch.mask(in.dst);
+        const std::uint8_t *p = scratch.mask(in.a), *q = scratch.mask(in.b);
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = p[i] & q[i];
+        }
+        break;
+      }
+      case FilterOp::Or: {
+        std::uint8_t* out = scratch.mask(in.dst);
+        const std::uint8_t *p = scratch.mask(in.a), *q = scratch.mask(in.b);
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = p[i] | q[i];
+        }
+        break;
+      }
+      case FilterOp::Not: {
+        std::uint8_t* out = scratch.mask(in.dst);
+        const std::uint8_t* p = scratch.mask(in.a);
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = p[i] ^ 1;
+        }
+        break;
+      }
+      }
+    }
+  }
+
+  // Recursive-descent parser that emits instructions as it goes
+  class Compiler {
+  public:
+    explicit Compiler(FilterExpression& target) : target(target), text(target.text) {}
+
+    void compile() {
+      Value result = parseOr();
+      skipSpace();
+      if (position != text.size()) {
+        fail("unexpected '" + text.substr(position, 1) + "'");
+      }
+      if (result.type != Type::Mask) {
+        fail("the expression must be a condition, e.g. E>20", 0);
+      }
+      target.resultRegister = toRegister(result).reg;
+      eliminateDeadCode();
+    }
+
+  private:
+    enum class Type { Number, Mask, Kind };
+
+    // A compiled subexpression: a register, or a constant still open to folding (kind column
+    // references are kept symbolic until compared)
+    struct Value {
+      Type type = Type::Number;
+      bool constant = false;
+      double value = 0;
+      std::uint16_t reg = FilterInstruction::noRegister;
+    };
+
+    FilterExpression& target;
+    const std::string& text;
+    size_t position = 0;
+
+    // Drop instructions whose result folding made unused (e.g. the E > 1 of "true || E > 1").
+    // Every register is written once, so one backward pass finds them.
+    void eliminateDeadCode() {
+      std::vector<bool> neededNumber(target.numberRegisters), neededMask(target.maskRegisters);
+      neededMask[target.resultRegister] = true;
+      std::vector<FilterInstruction> kept;
+      for (auto it = target.program.rbegin(); it != target.program.rend(); ++it) {
+        bool maskResult = writesMask(it->op);
+        if (!(maskResult ? neededMask[it->dst] : neededNumber[it->dst])) {
+          continue;
+        }
+        bool maskOperands = it->op >= FilterOp::And;
+        for (std::uint16_t operand : {it->a, it->b}) {
+          if (operand != FilterInstruction::noRegister) {
+            (maskOperands ? neededMask : neededNumber)[operand] = true;
+          }
+        }
+        kept.push_back(*it);
+      }
+      target.program.assign(kept.rbegin(), kept.rend());
+    }
+
+    [[noreturn]] void fail(const std::string& message, size_t at = std::string::npos) const {
+      size_t where = at == std::string::npos ? position : at;
+      throw std::invalid_argument("Filter '" + text + "': " + message + " at position " + std::to_string(where + 1));
+    }
+
+    void skipSpace() {
+      while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+        ++position;
+      }
+    }
+
+    bool accept(const char* token) {
+      skipSpace();
+      size_t length = std::char_traits<char>::length(token);
+      if (text.compare(position, length, token) != 0) {
+        return false;
+      }
+      // "<" must not swallow the first half of "<=", nor "!" of "!="
+      if (length == 1 && position + 1 < text.size() && text[position + 1] == '=' && std::strchr("<>!=", token[0])) {
+        return false;
+      }
+      position += length;
+      return true;
+    }
+
+    void expect(const char* token) {
+      if (!accept(token)) {
+        fail(std::string("expected '") + token + "'");
+      }
+    }
+
+    std::uint16_t newNumber() { return checkRegister(target.numberRegisters++); }
+    std::uint16_t newMask() { return checkRegister(target.maskRegisters++); }
+
+    std::uint16_t checkRegister(size_t reg) {
+      if (reg >= FilterInstruction::noRegister) {
+        fail("expression too large");
+      }
+      return static_cast<std::uint16_t>(reg);
+    }
+
+    Value emit(FilterInstruction instruction, Type type) {
+      target.program.push_back(instruction);
+      Value value;
+      value.type = type;
+      value.reg = instruction.dst;
+      return value;
+    }
+
+    static Value constant(Type type, double value) {
+      Value folded;
+      folded.type = type;
+      folded.constant = true;
+      folded.value = value;
+      return folded;
+    }
+
+    // Put a constant into a register
+    Value toRegister(const Value& value) {
+      if (!value.constant) {
+        return value;
+      }
+      FilterInstruction instruction{};
+      instruction.op = value.type == Type::Mask ? FilterOp::FillMask : FilterOp::LoadConstant;
+      instruction.dst = value.type == Type::Mask ? newMask() : newNumber();
+      instruction.constant = value.value;
+      return emit(instruction, value.type);
+    }
+
+    void requireType(const Value& value, Type type, const char* what, size_t at) const {
+      if (value.type != type) {
+        fail(std::string(what) + (type == Type::Mask ? " needs conditions" : " needs numbers"), at);
+      }
+    }
+
+    Value parseOr() {
+      Value left = parseAnd();
+      while (true) {
+        size_t at = position;
+        if (!accept("||")) {
+          return left;
+        }
+        Value right = parseAnd();
+        left = logical(FilterOp::Or, left, right, at);
+      }
+    }
+
+    Value parseAnd() {
+      Value left = parseNot();
+      while (true) {
+        size_t at = position;
+        if (!accept("&&")) {
+          return left;
+        }
+        Value right = parseNot();
+        left = logical(FilterOp::And, left, right, at);
+      }
+    }
+
+    Value logical(FilterOp op, const Value& left, const Value& right, size_t at) {
+      requireType(left, Type::Mask, op == FilterOp::And ? "&&" : "||", at);
+      requireType(right, Type::Mask, op == FilterOp::And ? "&&" : "||", at);
+      bool isAnd = op == FilterOp::And;
+      // true && x == x, false && x == false, true || x == true, false || x == x
+      for (const Value* side : {&left, &right}) {
+        if (side->constant) {
+          const Value& other = side == &left ? right : left;
+          return (side->value != 0) == isAnd ? other : constant(Type::Mask, isAnd ? 0 : 1);
+        }
+      }
+      FilterInstruction instruction{};
+      instruction.op = op;
+      instruction.dst = newMask();
+      instruction.a = left.reg;
+      instruction.b = right.reg;
+      return emit(instruction, Type::Mask);
+    }
+
+    Value parseNot() {
+      size_t at = position;
+      if (accept("!")) {
+        Value operand = parseNot();
+        requireType(operand, Type::Mask, "!", at);
+        return negate(operand);
+      }
+      return parseComparison();
+    }
+
+    Value negate(const Value& operand) {
+      if (operand.constant) {
+        return constant(Type::Mask, operand.value == 0);
+      }
+      FilterInstruction instruction{};
+      instruction.op = FilterOp::Not;
+      instruction.dst = newMask();
+      instruction.a = operand.reg;
+      return emit(instruction, Type::Mask);
+    }
+
+    Value parseComparison() {
+      Value left = parseSum();
+      static const std::pair<const char*, FilterOp> operators[] = {
+        {"==", FilterOp::Equal}, {"!=", FilterOp::NotEqual}, {"<=", FilterOp::LessEqual},
+        {">=", FilterOp::GreaterEqual}, {"<", FilterOp::Less}, {">", FilterOp::Greater}};
+      for (const auto& entry : operators) {
+        size_t at = position;
+        if (accept(entry.first)) {
+          Value right = parseSum();
+          return compare(entry.second, left, right, at);
+        }
+      }
+      if (left.type == Type::Kind) {
+        fail("kind must be compared with == or !=");
+      }
+      return left;
+    }
+
+    Value compare(FilterOp op, Value left, Value right, size_t at) {
+      if (left.type == Type::Kind || right.type == Type::Kind) {
+        if (left.type != Type::Kind || right.type != Type::Kind || (op != FilterOp::Equal && op != FilterOp::NotEqual)) {
+          fail("kind can only be compared with == or != to a particle kind", at);
+        }
+        if (left.constant && right.constant) {
+          return constant(Type::Mask, (left.value == right.value) == (op == FilterOp::Equal));
+        }
+        if (!left.constant && !right.constant) {
+          return constant(Type::Mask, op == FilterOp::Equal); // kind == kind
+        }
+        const Value& literal = left.constant ? left : right;
+        FilterInstruction instruction{};
+        instruction.op = FilterOp::KindEquals;
+        instruction.dst = newMask();
+        instruction.field = static_cast<std::uint8_t>(literal.value);
+        Value equals = emit(instruction, Type::Mask);
+        return op == FilterOp::Equal ? equals : negate(equals);
+      }
+      requireType(left, Type::Number, "comparison", at);
+      requireType(right, Type::Number, "comparison", at);
+      if (left.constant && right.constant) {
+        double u = left.value, v = right.value;
+        bool result = op == FilterOp::Less ? u < v : op == FilterOp::LessEqual ? u <= v : op == FilterOp::Greater ? u > v
+                      : op == FilterOp::GreaterEqual ? u >= v : op == FilterOp::Equal ? u == v : u != v;
+        return constant(Type::Mask, result);
+      }
+      if (left.constant) {
+        // 20 < E is E > 20
+        std::swap(left, right);
+        op = op == FilterOp::Less ? FilterOp::Greater : op == FilterOp::Greater ? FilterOp::Less
+           : op == FilterOp::LessEqual ? FilterOp::GreaterEqual : op == FilterOp::GreaterEqual ? FilterOp::LessEqual : op;
+      }
+      return binary(op, left, right, Type::Mask);
+    }
+
+    // Emit a binary instruction with the right operand as an immediate when it is constant
+    Value binary(FilterOp op, const Value& left, const Value& right, Type result) {
+      FilterInstruction instruction{};
+      instruction.op = op;
+      instruction.dst = result == Type::Mask ? newMask() : newNumber();
+      instruction.a = toRegister(left).reg;
+      if (right.constant) {
+        instruction.constant = right.value;
+      } else {
+        instruction.b = right.reg;
+      }
+      return emit(instruction, result);
+    }
+
+    Value arithmetic(FilterOp op, Value left, Value right, size_t at) {
+      requireType(left, Type::Number, "arithmetic", at);
+      requireType(right, Type::Number, "arithmetic", at);
+      if (left.constant && right.constant) {
+        double u = left.value, v = right.value;
+        double result = op == FilterOp::Add ? u + v : op == FilterOp::Subtract ? u - v : op == FilterOp::Multiply ? u * v
+                        : op == FilterOp::Divide ? u / v : op == FilterOp::Min ? std::min(u, v) : std::max(u, v);
+        return constant(Type::Number, result);
+      }
+      bool commutative = op != FilterOp::Subtract && op != FilterOp::Divide;
+      if (left.constant && commutative) {
+        std::swap(left, right);
+      }
+      return binary(op, left, right, Type::Number);
+    }
+
+    Value parseSum() {
+      Value left = parseProduct();
+      while (true) {
+        size_t at = position;
+        if (accept("+")) {
+          left = arithmetic(FilterOp::Add, left, parseProduct(), at);
+        } else if (accept("-")) {
+          left = arithmetic(FilterOp::Subtract, left, parseProduct(), at);
+        } else {
+          return left;
+        }
+      }
+    }
+
+    Value parseProduct() {
+      Value left = parseUnary();
+      while (true) {
+        size_t at = position;
+        if (accept("*")) {
+          left = arithmetic(FilterOp::Multiply, left, parseUnary(), at);
+        } else if (accept("/")) {
+          left = arithmetic(FilterOp::Divide, left, parseUnary(), at);
+        } else {
+          return left;
+        }
+      }
+    }
+
+    Value unary(FilterOp op, const Value& operand, size_t at) {
+      requireType(operand, Type::Number, op == FilterOp::Negate ? "-" : op == FilterOp::Abs ? "abs" : "sqrt", at);
+      if (operand.constant) {
+        double v = operand.value;
+        return constant(Type::Number, op == FilterOp::Negate ? -v : op == FilterOp::Abs ? std::fabs(v) : std::sqrt(v));
+      }
+      FilterInstruction instruction{};
+      instruction.op = op;
+      instruction.dst = newNumber();
+      instruction.a = operand.reg;
+      return emit(instruction, Type::Number);
+    }
+
+    Value parseUnary() {
+      size_t at = position;
+      if (accept("-")) {
+        return unary(FilterOp::Negate, parseUnary(), at);
+      }
+      if (accept("+")) {
+        return parseUnary();
+      }
+      return parsePrimary();
+    }
+
+    Value parsePrimary() {
+      skipSpace();
+      size_t at = position;
+      if (position >= text.size()) {
+        fail("unexpected end");
+      }
+      if (accept("(")) {
+        Value inner = parseOr();
+        expect(")");
+        return inner;
+      }
+      char c = text[position];
+      if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+        const char* start = text.c_str() + position;
+        char* stop = nullptr;
+        double value = std::strtod(start, &stop);
+        if (stop == start) {
+          fail("malformed number");
+        }
+        position += static_cast<size_t>(stop - start);
+        return constant(Type::Number, value);
+      }
+      if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_') {
+        fail("unexpected '" + std::string(1, c) + "'");
+      }
+      size_t start = position;
+      while (position < text.size() && (std::isalnum(static_cast<unsigned char>(text[position])) || text[position] == '_')) {
+        ++position;
+      }
+      std::string name = text.substr(start, position - start);
+      std::string lower = name;
+      std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+      if (accept("(")) {
+        return call(lower, at);
+      }
+      return reference(name, lower, at);
+    }
+
+    Value call(const std::string& function, size_t at) {
+      Value first = parseOr();
+      if (function == "abs" || function == "sqrt") {
+        expect(")");
+        return unary(function == "abs" ? FilterOp::Abs : FilterOp::Sqrt, first, at);
+      }
+      if (function == "min" || function == "max") {
+        expect(",");
+        Value second = parseOr();
+        expect(")");
+        return arithmetic(function == "min" ? FilterOp::Min : FilterOp::Max, first, second, at);
+      }
+      fail("unknown function '" + function + "'", at);
+    }
+
+    Value load(FilterOp op, std::uint8_t field) {
+      FilterInstruction instruction{};
+      instruction.op = op;
+      instruction.dst = op == FilterOp::LoadFlag ? newMask() : newNumber();
+      instruction.field = field;
+      return emit(instruction, op == FilterOp::LoadFlag ? Type::Mask : Type::Number);
+    }
+
+    Value column(FilterColumn column) { return load(FilterOp::LoadColumn, static_cast<std::uint8_t>(column)); }
+    Value key(ColumnKey key) { return load(FilterOp::LoadKey, static_cast<std::uint8_t>(key)); }
+
+    Value reference(const std::string& name, const std::string& lower, size_t at) {
+      if (lower == "kind") {
+        Value kind;
+        kind.type = Type::Kind;
+        return kind;
+      }
+      if (lower == "true" || lower == "false") return constant(Type::Mask, lower == "true");
+      if (lower == "charge") return column(FilterColumn::Charge);
+      if (lower == "spin") return column(FilterColumn::Spin);
+      if (lower == "e" || lower == "energy") return column(FilterColumn::Energy);
+      if (lower == "px") return column(FilterColumn::Px);
+      if (lower == "py") return column(FilterColumn::Py);
+      if (lower == "pz") return column(FilterColumn::Pz);
+      if (lower == "restmass") return column(FilterColumn::RestMass);
+      if (lower == "baryon") return column(FilterColumn::BaryonNumber);
+      if (lower == "calo1") return column(FilterColumn::Calorimeter1);
+      if (lower == "calo2") return column(FilterColumn::Calorimeter2);
+      if (lower == "calo3") return column(FilterColumn::Calorimeter3);
+      if (lower == "calo4") return column(FilterColumn::Calorimeter4);
+      if (lower == "lepton") return load(FilterOp::LoadLepton, 0);
+      if (lower == "pt") return key(ColumnKey::Pt);
+      if (lower == "m" || lower == "mass") return key(ColumnKey::Mass);
+      if (lower == "eta") return key(ColumnKey::Eta);
+      if (lower == "phi") return key(ColumnKey::Phi);
+      if (lower == "isolated") return load(FilterOp::LoadFlag, FlagIsolation);
+      if (lower == "interacting") return load(FilterOp::LoadFlag, FlagInteraction);
+      ParticleKind kind = kindFromName(name);
+      if (kind == ParticleKind::Unknown) {
+        fail("unknown name '" + name + "'", at);
+      }
+      Value literal = constant(Type::Kind, static_cast<double>(kind));
+      return literal;
+    }
+  };
+};
+
+// A CutFlow step from a filter expression, evaluated batchRows rows at a time
+inline Cut expressionCut(const std::string& text) {
+  auto expression = std::make_shared<const FilterExpression>(text);
+  return Cut::fromMask(text, [expression](const ParticleColumns& columns, unsigned threads) {
+    return expression->evaluate(columns, threads);
+  });
+}
+
+#endif // FILTEREXPRESSION_H
@@ -7,49 +7,68 @@
 #include <cmath>
 #include <iostream>
 
-// Class representing the four-momentum of a particle
-class FourMomentum {
+// Class representing the four-momentum of a particle, stored with component type T.
+// FourMomentum (double) is used throughout; FourMomentumF (float) halves the storage of bulk
+// data. Derived quantities are always computed in double.
+template <typename T>
+class BasicFourMomentum {
 public:
-  FourMomentum(double E = 0, double px = 0, double py = 0, double pz = 0)
+  BasicFourMomentum(T E = 0, T px = 0, T py = 0, T pz = 0)
     : E(E), px(px), py(py), pz(pz) {}
 
-  double getEnergy() const { return E; }
-  double getPx() const { return px; }
-  double getPy() const { return py; }
-  double getPz() const { return pz; }
+  // Convert from another storage precision
+  template <typename U>
+  explicit BasicFourMomentum(const BasicFourMomentum<U>& other)
+    : E(static_cast<T>(other.getEnergy())), px(static_cast<T>(other.getPx())),
+      py(static_cast<T>(other.getPy())), pz(static_cast<T>(other.getPz())) {}
 
-  void setEnergy(double E) { this->E = E; }
-  void setPx(double px) { this->px = px; }
-  void setPy(double py) { this->py = py; }
-  void setPz(double pz) { this->pz = pz; }
+  T getEnergy() const { return E; }
+  T getPx() const { return px; }
+  T getPy() const { return py; }
+  T getPz() const { return pz; }
+
+  void setEnergy(T E) { this->E = E; }
+  void setPx(T px) { this->px = px; }
+  void setPy(T py) { this->py = py; }
+  void setPz(T pz) { this->pz = pz; }
 
   // Calculate the invariant mass
   double invariantMass() const {
-    return std::sqrt(E * E - px * px - py * py - pz * pz);
+    double e = E, x = px, y = py, z = pz;
+    return std::sqrt(e * e - x * x - y * y - z * z);
+  }
+
+  // Calculate the transverse momentum
+  double transverseMomentum() const {
+    double x = px, y = py;
+    return std::sqrt(x * x + y * y);
   }
 
   // Overloaded operators for four-momentum operations
-  FourMomentum operator+(const FourMomentum& other) const {
-    return FourMomentum(E + other.E, px + other.px, py + other.py, pz + other.pz);
+  BasicFourMomentum operator+(const BasicFourMomentum& other) const {
+    return BasicFourMomentum(E + other.E, px + other.px, py + other.py, pz + other.pz);
   }
 
-  FourMomentum operator-(const FourMomentum& other) const {
-    return FourMomentum(E - other.E, px - other.px, py - other.py, pz - other.pz);
+  BasicFourMomentum operator-(const BasicFourMomentum& other) const {
+    return BasicFourMomentum(E - other.E, px - other.px, py - other.py, pz - other.pz);
   }
 
-  double dot(const FourMomentum& other) const {
-    return E * other.E - (px * other.px + py * other.py + pz * other.pz);
+  double dot(const BasicFourMomentum& other) const {
+    return double(E) * other.E - (double(px) * other.px + double(py) * other.py + double(pz) * other.pz);
   }
 
   // Overloaded stream insertion operator for printing
-  friend std::ostream& operator<<(std::ostream& os, const FourMomentum& momentum) {
+  friend std::ostream& operator<<(std::ostream& os, const BasicFourMomentum& momentum) {
     os << "E: " << momentum.E << ", px: " << momentum.px
        << ", py: " << momentum.py << ", pz: " << momentum.pz;
     return os;
   }
 
 private:
-  double E, px, py, pz;
+  T E, px, py, pz;
 };
 
+using FourMomentum = BasicFourMomentum<double>;
+using FourMomentumF = BasicFourMomentum<float>;
+
 #endif // FOURMOMENTUM_H
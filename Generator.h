@@ -0,0 +1,129 @@
+// Generator.h - Defines Generator<T>, a lazily evaluated sequence produced by a C++20 coroutine.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+// Return type of a coroutine that co_yields values of T. Nothing runs until the first value is
+// requested and the coroutine is suspended again after every co_yield, so a consumer holds one
+// value at a time however long the sequence is. Exceptions thrown inside the coroutine are
+// rethrown from the call that resumed it. Single pass and move-only.
+template <typename T>
+class Generator {
+public:
+  struct promise_type {
+    T* current = nullptr;
+    std::exception_ptr error;
+
+    Generator get_return_object() { return Generator(Handle::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    // The yielded value lives in the coroutine frame until the coroutine is resumed
+    std::suspend_always yield_value(T& value) noexcept {
+      current = std::addressof(value);
+      return {};
+    }
+    std::suspend_always yield_value(T&& value) noexcept {
+      current = std::addressof(value);
+      return {};
+    }
+
+    void return_void() noexcept {}
+    void unhandled_exception() { error = std::current_exception(); }
+
+    // Disallow co_await inside a generator
+    template <typename U>
+    std::suspend_never await_transform(U&&) = delete;
+  };
+
+  using Handle = std::coroutine_handle<promise_type>;
+
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    iterator() = default;
+    explicit iterator(Handle handle) : handle(handle) {}
+
+    T& operator*() const { return *handle.promise().current; }
+    T* operator->() const { return handle.promise().current; }
+
+    iterator& operator++() {
+      advance(handle);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t) const { return !handle || handle.done(); }
+
+  private:
+    Handle handle;
+  };
+
+  Generator() = default;
+  Generator(Generator&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+  Generator& operator=(Generator&& other) noexcept {
+    if (this != &other) {
+      destroy();
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+  ~Generator() { destroy(); }
+
+  // Run to the first value; call once per generator
+  iterator begin() {
+    if (handle) {
+      advance(handle);
+    }
+    return iterator(handle);
+  }
+  std::default_sentinel_t end() const noexcept { return {}; }
+
+  // Pull the next value into value; returns false once the sequence is exhausted
+  bool next(T& value) {
+    if (!handle || handle.done()) {
+      return false;
+    }
+    advance(handle);
+    if (handle.done()) {
+      return false;
+    }
+    value = std::move(*handle.promise().current);
+    return true;
+  }
+
+private:
+  Handle handle;
+
+  explicit Generator(Handle handle) : handle(handle) {}
+
+  static void advance(Handle handle) {
+    handle.resume();
+    if (handle.done() && handle.promise().error) {
+      std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+    }
+  }
+
+  void destroy() {
+    if (handle) {
+      handle.destroy();
+      handle = nullptr;
+    }
+  }
+};
+
+#endif // GENERATOR_H
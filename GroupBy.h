@@ -0,0 +1,312 @@
+// GroupBy.h - Defines GroupBy, a hash group-by over catalogue columns with per-group momentum, energy and
+// mass aggregates.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef GROUPBY_H
+#define GROUPBY_H
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ColumnKey.h"
+#include "CompensatedSum.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+#include "ParticleKind.h"
+
+// What a row can be grouped by
+enum class GroupField {
+  Kind,
+  Charge,       // In units of e/3, so quark charges group exactly
+  Antiparticle, // Negative lepton or baryon number, or a W-; Z, Higgs, photons and gluons are their own antiparticles
+  Colour,       // Colour string of quarks (first colour of gluons); other kinds group as "none"
+  Binned        // floor(key / binWidth) for a kinematic ColumnKey
+};
+
+// One grouping field, e.g. parsed from "kind", "charge", "antiparticle", "colour" or "pt:10000"
+struct GroupKeySpec {
+  GroupField field = GroupField::Kind;
+  ColumnKey key = ColumnKey::Energy; // For Binned
+  double binWidth = 1.0;             // For Binned
+  std::string name;                  // Column title in reports
+
+  static GroupKeySpec parse(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    GroupKeySpec spec;
+    spec.name = text;
+    if (text == "kind") {
+      spec.field = GroupField::Kind;
+    } else if (text == "charge") {
+      spec.field = GroupField::Charge;
+    } else if (text == "antiparticle") {
+      spec.field = GroupField::Antiparticle;
+    } else if (text == "colour" || text == "color") {
+      spec.field = GroupField::Colour;
+      spec.name = "colour";
+    } else {
+      size_t colon = text.find(':');
+      if (colon == std::string::npos) {
+        throw std::invalid_argument("Unknown group key '" + text + "' (kind, charge, antiparticle, colour or KEY:WIDTH)");
+      }
+      spec.field = GroupField::Binned;
+      spec.key = columnKeyFromName(text.substr(0, colon));
+      spec.binWidth = std::stod(text.substr(colon + 1));
+      spec.name = text.substr(0, colon) + "_bin";
+      if (!(spec.binWidth > 0)) {
+        throw std::invalid_argument("Bin width must be positive in '" + text + "'");
+      }
+    }
+    return spec;
+  }
+};
+
+// Aggregates of one group. Sums are compensated; the mass variance uses Welford's update per row
+// and Chan's formula to merge partial groups.
+struct GroupAggregate {
+  size_t count = 0;
+  NeumaierSum energy, px, py, pz;
+  double minEnergy = std::numeric_limits<double>::infinity();
+  double maxEnergy = -std::numeric_limits<double>::infinity();
+  double massMean = 0.0;
+  double massM2 = 0.0; // Sum of squared deviations from massMean
+
+  void add(double E, double x, double y, double z, double mass) {
+    ++count;
+    energy.add(E);
+    px.add(x);
+    py.add(y);
+    pz.add(z);
+    minEnergy = std::min(minEnergy, E);
+    maxEnergy = std::max(maxEnergy, E);
+    double delta = mass - massMean;
+    massMean += delta / static_cast<double>(count);
+    massM2 += delta * (mass - massMean);
+  }
+
+  void merge(const GroupAggregate& other) {
+    if (other.count == 0) {
+      return;
+    }
+    size_t total = count + other.count;
+    double delta = other.massMean - massMean;
+    massMean += delta * static_cast<double>(other.count) / static_cast<double>(total);
+    massM2 += other.massM2 + delta * delta * static_cast<double>(count) * static_cast<double>(other.count) / static_cast<double>(total);
+    count = total;
+    energy.merge(other.energy);
+    px.merge(other.px);
+    py.merge(other.py);
+    pz.merge(other.pz);
+    minEnergy = std::min(minEnergy, other.minEnergy);
+    maxEnergy = std::max(maxEnergy, other.maxEnergy);
+  }
+
+  FourMomentum getTotalFourMomentum() const { return FourMomentum(energy.value(), px.value(), py.value(), pz.value()); }
+  double meanEnergy() const { return count ? energy.value() / static_cast<double>(count) : 0.0; }
+  double massVariance() const { return count ? massM2 / static_cast<double>(count) : 0.0; }
+};
+
+constexpr size_t maxGroupFields = 4;
+using GroupCodes = std::array<std::int64_t, maxGroupFields>;
+
+// A group: the codes of its key fields (unused fields are 0) and its aggregates
+struct Group {
+  GroupCodes codes{};
+  GroupAggregate aggregate;
+};
+
+// Open-addressing hash table from key codes to groups: linear probing over a power-of-two slot
+// array of group indices, grown at half load. Groups live in insertion order in a separate vector.
+class GroupTable {
+public:
+  GroupTable() : slots(16, empty) {}
+
+  GroupAggregate& find(const GroupCodes& codes) {
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hash(codes) & mask;; slot = (slot + 1) & mask) {
+      std::int32_t index = slots[slot];
+      if (index == empty) {
+        if (2 * (groups.size() + 1) > slots.size()) {
+          grow();
+          return find(codes);
+        }
+        slots[slot] = static_cast<std::int32_t>(groups.size());
+        groups.push_back({codes, GroupAggregate()});
+        return groups.back().aggregate;
+      }
+      if (groups[static_cast<size_t>(index)].codes == codes) {
+        return groups[static_cast<size_t>(index)].aggregate;
+      }
+    }
+  }
+
+  // Fold another table's groups into this one
+  void merge(const GroupTable& other) {
+    for (const Group& group : other.groups) {
+      find(group.codes).merge(group.aggregate);
+    }
+  }
+
+  std::vector<Group>& getGroups() { return groups; }
+  const std::vector<Group>& getGroups() const { return groups; }
+
+private:
+  static constexpr std::int32_t empty = -1;
+  std::vector<std::int32_t> slots;
+  std::vector<Group> groups;
+
+  static size_t hash(const GroupCodes& codes) {
+    std::uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (std::int64_t code : codes) {
+      h ^= static_cast<std::uint64_t>(code) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    }
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return static_cast<size_t>(h);
+  }
+
+  void grow() {
+    slots.assign(slots.size() * 2, empty);
+    size_t mask = slots.size() - 1;
+    for (size_t index = 0; index < groups.size(); ++index) {
+      size_t slot = hash(groups[index].codes) & mask;
+      while (slots[slot] != empty) {
+        slot = (slot + 1) & mask;
+      }
+      slots[slot] = static_cast<std::int32_t>(index);
+    }
+  }
+};
+
+// Groups in ascending key order, with what is needed to label them
+struct GroupByResult {
+  std::vector<GroupKeySpec> fields;
+  std::vector<std::string> strings; // Colour dictionary of the grouped columns
+  std::vector<Group> groups;
+
+  // Get the display value of field i of a group
+  std::string label(const Group& group, size_t i) const {
+    std::int64_t code = group.codes[i];
+    switch (fields[i].field) {
+    case GroupField::Kind:
+      return kindName(static_cast<ParticleKind>(code));
+    case GroupField::Charge:
+      return code % 3 == 0 ? std::to_string(code / 3) : std::to_string(code) + "/3";
+    case GroupField::Antiparticle:
+      return code ? "yes" : "no";
+    case GroupField::Colour:
+      return code < 0 ? "none" : strings.at(static_cast<size_t>(code));
+    case GroupField::Binned:
+      if (code == std::numeric_limits<std::int64_t>::min()) {
+        return "nan";
+      }
+      return "[" + formatKeyValue(static_cast<double>(code) * fields[i].binWidth) + "," +
+             formatKeyValue(static_cast<double>(code + 1) * fields[i].binWidth) + ")";
+    }
+    return "";
+  }
+
+  // Write one line per group: key fields, then count, momentum sums, energy statistics and mass variance
+  void print(std::ostream& out) const {
+    for (const auto& field : fields) {
+      out << field.name << ' ';
+    }
+    out << "count sum_E sum_px sum_py sum_pz mean_E min_E max_E var_mass\n";
+    for (const Group& group : groups) {
+      for (size_t i = 0; i < fields.size(); ++i) {
+        out << label(group, i) << ' ';
+      }
+      const GroupAggregate& a = group.aggregate;
+      out << a.count << ' ' << a.energy.value() << ' ' << a.px.value() << ' ' << a.py.value() << ' ' << a.pz.value()
+          << ' ' << a.meanEnergy() << ' ' << a.minEnergy << ' ' << a.maxEnergy << ' ' << a.massVariance() << '\n';
+    }
+  }
+};
+
+// Groups rows by up to maxGroupFields fields. Each thread aggregates its own range into a private
+// table; the tables are merged in chunk order, so a given thread count always gives the same
+// result (different counts may differ in the last bits of the floating-point aggregates).
+class GroupBy {
+public:
+  explicit GroupBy(std::vector<GroupKeySpec> fields) : fields(std::move(fields)) {
+    if (this->fields.empty() || this->fields.size() > maxGroupFields) {
+      throw std::invalid_argument("Group by needs 1 to " + std::to_string(maxGroupFields) + " fields");
+    }
+  }
+
+  // Parse a comma-separated field list, e.g. "kind,charge" or "kind,pt:10000"
+  static GroupBy parse(const std::string& text) {
+    std::vector<GroupKeySpec> specs;
+    for (size_t start = 0; start <= text.size();) {
+      size_t comma = std::min(text.find(',', start), text.size());
+      specs.push_back(GroupKeySpec::parse(text.substr(start, comma - start)));
+      start = comma + 1;
+    }
+    return GroupBy(std::move(specs));
+  }
+
+  GroupByResult run(const ParticleColumns& columns, unsigned threads = 0) const {
+    if (threads == 0) {
+      threads = defaultThreadCount();
+    }
+    std::vector<GroupTable> partials(std::max<size_t>(1, std::min<size_t>(threads, columns.size())));
+    parallelFor(columns.size(), threads, [&](size_t begin, size_t end, size_t chunk) {
+      GroupTable& table = partials[chunk];
+      GroupCodes codes{};
+      for (size_t row = begin; row < end; ++row) {
+        for (size_t i = 0; i < fields.size(); ++i) {
+          codes[i] = code(columns, fields[i], row);
+        }
+        double E = columns.energy[row], x = columns.px[row], y = columns.py[row], z = columns.pz[row];
+        table.find(codes).add(E, x, y, z, momentumKeyValue(ColumnKey::Mass, E, x, y, z));
+      }
+    });
+    GroupTable& merged = partials[0];
+    for (size_t chunk = 1; chunk < partials.size(); ++chunk) {
+      merged.merge(partials[chunk]);
+    }
+
+    GroupByResult result;
+    result.fields = fields;
+    result.strings = columns.strings;
+    result.groups = std::move(merged.getGroups());
+    std::sort(result.groups.begin(), result.groups.end(), [](const Group& a, const Group& b) { return a.codes < b.codes; });
+    return result;
+  }
+
+private:
+  std::vector<GroupKeySpec> fields;
+
+  static std::int64_t code(const ParticleColumns& columns, const GroupKeySpec& spec, size_t row) {
+    switch (spec.field) {
+    case GroupField::Kind:
+      return static_cast<std::int64_t>(columns.kind[row]);
+    case GroupField::Charge:
+      return std::llround(columns.charge[row] * 3.0);
+    case GroupField::Antiparticle:
+      return columns.leptonNumber[row] < 0 || columns.baryonNumber[row] < 0 ||
+             (columns.kind[row] == ParticleKind::WBoson && columns.charge[row] < 0);
+    case GroupField::Colour: {
+      bool coloured = columns.kind[row] == ParticleKind::Quark || columns.kind[row] == ParticleKind::Gluon;
+      return coloured && columns.colourId[row] != ParticleColumns::noString ? columns.colourId[row] : -1;
+    }
+    case GroupField::Binned: {
+      double value = columnKeyValue(columns, spec.key, row) / spec.binWidth;
+      if (std::isnan(value)) {
+        return std::numeric_limits<std::int64_t>::min();
+      }
+      return static_cast<std::int64_t>(std::floor(std::max(-9e18, std::min(9e18, value))));
+    }
+    }
+    return 0;
+  }
+};
+
+#endif // GROUPBY_H
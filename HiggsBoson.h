@@ -10,7 +10,7 @@
 #include <cmath>
 
 // Derived class for Higgs Bosons
-class HiggsBoson : public Boson {
+class HiggsBoson final : public Boson {
 public:
   HiggsBoson(double charge, double spin, const FourMomentum& momentum, double restMass, bool isAntiparticle = false)
     : Boson(charge, spin, momentum, restMass, isAntiparticle), isAntiparticle(isAntiparticle) {}
@@ -64,22 +64,12 @@ public:
     decayProducts.push_back(particle);
   }
 
-  const std::vector<std::shared_ptr<Particle>>& getDecayProducts() const {
+  const std::vector<std::shared_ptr<Particle>>& getDecayProducts() const override {
     return decayProducts;
   }
 
-  // Consistency check for decay products
-  void checkDecayConsistency() const {
-    double totalCharge = 0;
-    for (const auto& product : decayProducts) {
-      totalCharge += product->getCharge();
-    }
-    if (std::abs(totalCharge - getCharge()) > 1e-2) {
-      throw std::runtime_error("Decay products' charges do not sum up to the original Higgs Boson's charge");
-    }
-  }
-
   std::string getTypeName() const override { return "HiggsBoson"; }
+  ParticleKind getKind() const override { return ParticleKind::HiggsBoson; }
 
   double getCharge() const override { return charge; }
   double getSpin() const override { return spin; }
@@ -0,0 +1,208 @@
+// LorentzTransform.h - Defines LorentzTransform, a boost/rotation matrix applied to many four-vectors at once,
+// and TransformedColumns, a lazily transformed view of catalogue columns.
+// Author: Raul Scanlon, Date: 03/06/2024
+
+#ifndef LORENTZTRANSFORM_H
+#define LORENTZTRANSFORM_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "ColumnKey.h"
+#include "FourMomentum.h"
+#include "ParallelFor.h"
+#include "ParticleCatalogue.h"
+#include "ParticleColumns.h"
+
+// A 4x4 matrix acting on (E, px, py, pz). Build it once, then apply it to whole columns:
+// the batch kernel is a straight loop over contiguous arrays that the compiler vectorises.
+class LorentzTransform {
+public:
+  // Identity transform
+  LorentzTransform() {
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        m[i][j] = i == j ? 1.0 : 0.0;
+      }
+    }
+  }
+
+  // Boost that gives a particle at rest the velocity (bx, by, bz), in units of c
+  static LorentzTransform boost(double bx, double by, double bz) {
+    double b2 = bx * bx + by * by + bz * bz;
+    if (b2 >= 1.0) {
+      throw std::invalid_argument("Boost velocity must be below the speed of light");
+    }
+    LorentzTransform result;
+    if (b2 == 0.0) {
+      return result;
+    }
+    double gamma = 1.0 / std::sqrt(1.0 - b2);
+    double beta[3] = {bx, by, bz};
+    result.m[0][0] = gamma;
+    for (int i = 0; i < 3; ++i) {
+      result.m[0][i + 1] = result.m[i + 1][0] = gamma * beta[i];
+      for (int j = 0; j < 3; ++j) {
+        result.m[i + 1][j + 1] = (i == j ? 1.0 : 0.0) + (gamma - 1.0) * beta[i] * beta[j] / b2;
+      }
+    }
+    return result;
+  }
+
+  // Boost into the rest frame of a massive four-momentum, e.g. a Higgs boson or the total
+  // four-momentum of a catalogue (its centre-of-mass frame)
+  static LorentzTransform toRestFrame(const FourMomentum& momentum) {
+    double E = momentum.getEnergy();
+    if (E <= 0) {
+      throw std::invalid_argument("Rest frame needs positive energy");
+    }
+    return boost(-momentum.getPx() / E, -momentum.getPy() / E, -momentum.getPz() / E);
+  }
+
+  // Rotation by angle (radians) about the axis (ax, ay, az), right-handed
+  static LorentzTransform rotation(double ax, double ay, double az, double angle) {
+    double length = std::sqrt(ax * ax + ay * ay + az * az);
+    if (length == 0) {
+      throw std::invalid_argument("Rotation axis must be non-zero");
+    }
+    double u[3] = {ax / length, ay / length, az / length};
+    double c = std::cos(angle), s = std::sin(angle);
+    LorentzTransform result;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        result.m[i + 1][j + 1] = (i == j ? c : 0.0) + (1 - c) * u[i] * u[j];
+      }
+    }
+    result.m[1][2] -= s * u[2];
+    result.m[1][3] += s * u[1];
+    result.m[2][1] += s * u[2];
+    result.m[2][3] -= s * u[0];
+    result.m[3][1] -= s * u[1];
+    result.m[3][2] += s * u[0];
+    return result;
+  }
+
+  // Rotation about the beam (z) axis
+  static LorentzTransform rotationZ(double angle) { return rotation(0, 0, 1, angle); }
+
+  // Compose transforms: (a * b) applies b first, then a
+  LorentzTransform operator*(const LorentzTransform& other) const {
+    LorentzTransform result;
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        double sum = 0;
+        for (int k = 0; k < 4; ++k) {
+          sum += m[i][k] * other.m[k][j];
+        }
+        result.m[i][j] = sum;
+      }
+    }
+    return result;
+  }
+
+  // Get the inverse transform, using eta * transpose * eta rather than a general inversion
+  LorentzTransform inverse() const {
+    LorentzTransform result;
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        double sign = (i == 0) != (j == 0) ? -1.0 : 1.0;
+        result.m[i][j] = sign * m[j][i];
+      }
+    }
+    return result;
+  }
+
+  double at(int row, int column) const { return m[row][column]; }
+
+  // Transform one four-momentum
+  FourMomentum apply(const FourMomentum& p) const {
+    double in[4] = {p.getEnergy(), p.getPx(), p.getPy(), p.getPz()};
+    double out[4];
+    for (int i = 0; i < 4; ++i) {
+      out[i] = m[i][0] * in[0] + m[i][1] * in[1] + m[i][2] * in[2] + m[i][3] * in[3];
+    }
+    return FourMomentum(out[0], out[1], out[2], out[3]);
+  }
+
+  // Transform count four-vectors stored as separate arrays, in place
+  void apply(double* E, double* px, double* py, double* pz, size_t count) const {
+    const double m00 = m[0][0], m01 = m[0][1], m02 = m[0][2], m03 = m[0][3];
+    const double m10 = m[1][0], m11 = m[1][1], m12 = m[1][2], m13 = m[1][3];
+    const double m20 = m[2][0], m21 = m[2][1], m22 = m[2][2], m23 = m[2][3];
+    const double m30 = m[3][0], m31 = m[3][1], m32 = m[3][2], m33 = m[3][3];
+    for (size_t i = 0; i < count; ++i) {
+      double e = E[i], x = px[i], y = py[i], z = pz[i];
+      E[i] = m00 * e + m01 * x + m02 * y + m03 * z;
+      px[i] = m10 * e + m11 * x + m12 * y + m13 * z;
+      py[i] = m20 * e + m21 * x + m22 * y + m23 * z;
+      pz[i] = m30 * e + m31 * x + m32 * y + m33 * z;
+    }
+  }
+
+  // Transform every row of catalogue columns in place, in parallel
+  void apply(ParticleColumns& columns, unsigned threads = 0) const {
+    parallelFor(columns.size(), threads, [&](size_t begin, size_t end, size_t) {
+      apply(columns.energy.data() + begin, columns.px.data() + begin, columns.py.data() + begin,
+            columns.pz.data() + begin, end - begin);
+    });
+  }
+
+  // Transform every particle of a catalogue in place and refresh its cached totals
+  void apply(ParticleCatalogue& catalogue) const {
+    for (const auto& particle : catalogue.getParticles()) {
+      particle->setFourMomentum(apply(particle->getFourMomentumRef()));
+    }
+    catalogue.refreshAggregates();
+  }
+
+private:
+  double m[4][4];
+};
+
+// Columns seen through a transform without modifying them: momenta are transformed as they are
+// read, so a frame change used by only a few selections never writes a transformed copy.
+class TransformedColumns {
+public:
+  TransformedColumns(const ParticleColumns& source, const LorentzTransform& transform)
+    : source(source), transform(transform) {}
+
+  size_t size() const { return source.size(); }
+  const ParticleColumns& getSource() const { return source; }
+  const LorentzTransform& getTransform() const { return transform; }
+
+  // Get the transformed four-momentum of one row
+  FourMomentum momentum(size_t row) const {
+    return transform.apply(FourMomentum(source.energy[row], source.px[row], source.py[row], source.pz[row]));
+  }
+
+  // Get a key of one row in the transformed frame (charge and rest mass are frame independent)
+  double keyValue(ColumnKey key, size_t row) const {
+    if (key == ColumnKey::Charge || key == ColumnKey::RestMass) {
+      return columnKeyValue(source, key, row);
+    }
+    FourMomentum p = momentum(row);
+    return momentumKeyValue(key, p.getEnergy(), p.getPx(), p.getPy(), p.getPz());
+  }
+
+  // Transform rows [begin, end) into caller-provided arrays using the batch kernel
+  void momenta(size_t begin, size_t end, double* E, double* px, double* py, double* pz) const {
+    std::copy(source.energy.begin() + begin, source.energy.begin() + end, E);
+    std::copy(source.px.begin() + begin, source.px.begin() + end, px);
+    std::copy(source.py.begin() + begin, source.py.begin() + end, py);
+    std::copy(source.pz.begin() + begin, source.pz.begin() + end, pz);
+    transform.apply(E, px, py, pz, end - begin);
+  }
+
+  // Copy the source columns with the transform applied
+  ParticleColumns materialize(unsigned threads = 0) const {
+    ParticleColumns result = source;
+    transform.apply(result, threads);
+    return result;
+  }
+
+private:
+  const ParticleColumns& source;
+  LorentzTransform transform;
+};
+
+#endif // LORENTZTRANSFORM_H
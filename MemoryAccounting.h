@@ -0,0 +1,336 @@
+// MemoryAccounting.h - Defines MemoryTracker, a process-wide allocation counter fed by an operator new hook,
+// and the memory reports that break down what a ParticleCatalogue or ParticleColumns costs.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef MEMORYACCOUNTING_H
+#define MEMORYACCOUNTING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "ParticleCatalogue.h"
+#include "ParticleColumns.h"
+#include "electron.h"
+#include "muon.h"
+#include "tau.h"
+#include "neutrino.h"
+#include "quark.h"
+#include "gluon.h"
+#include "photon.h"
+#include "WBoson.h"
+#include "ZBoson.h"
+#include "HiggsBoson.h"
+
+// Live and peak bytes requested through operator new. Counting only happens once the hook below
+// is compiled in, since it taxes every allocation of the program: build the one translation unit
+// that includes this header (main.cpp) with -DPARTICLES_TRACK_ALLOCATIONS. Counters are
+// process-wide, so allocations made by other threads during a measurement are included.
+class MemoryTracker {
+public:
+  static MemoryTracker& global() {
+    static MemoryTracker tracker;
+    return tracker;
+  }
+
+  void allocated(size_t bytes) {
+    size_t now = live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (now > seen && !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {
+    }
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void released(size_t bytes) { live.fetch_sub(bytes, std::memory_order_relaxed); }
+
+  size_t getLiveBytes() const { return live.load(std::memory_order_relaxed); }
+  size_t getPeakBytes() const { return peak.load(std::memory_order_relaxed); }
+  std::uint64_t getAllocationCount() const { return allocations.load(std::memory_order_relaxed); }
+
+  // Start a new peak measurement from the current live bytes
+  void resetPeak() { peak.store(live.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+
+  // True if the operator new hook is compiled into this program
+  static bool isEnabled() {
+#ifdef PARTICLES_TRACK_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+  }
+
+private:
+  std::atomic<size_t> live{0};
+  std::atomic<size_t> peak{0};
+  std::atomic<std::uint64_t> allocations{0};
+};
+
+// Parts of a particle's memory; all but object are separate heap blocks or block headers
+enum class MemoryComponent {
+  Object,          // The particle's fields (sizeof the concrete class less the vtable pointer)
+  VtablePointer,   // One per polymorphic object
+  ControlBlock,    // shared_ptr reference counts and deleter, allocated with the object by make_shared
+  Strings,         // Heap buffers of name and colour strings too long for the small-string buffer
+  DecayVectors,    // Heap buffers of the decay-product vectors in Tau, W, Z and Higgs
+  AllocatorSlack   // malloc headers and rounding of every block above
+};
+
+constexpr size_t memoryComponentCount = 6;
+
+inline const char* memoryComponentName(MemoryComponent component) {
+  switch (component) {
+  case MemoryComponent::Object: return "object";
+  case MemoryComponent::VtablePointer: return "vptr";
+  case MemoryComponent::ControlBlock: return "control_block";
+  case MemoryComponent::Strings: return "strings";
+  case MemoryComponent::DecayVectors: return "decay_vectors";
+  default: return "allocator_slack";
+  }
+}
+
+// Bytes of a ParticleCatalogue by particle kind and component, plus the catalogue's own containers
+struct CatalogueMemoryReport {
+  std::array<size_t, particleKindCount + 1> counts{};
+  std::array<std::array<size_t, memoryComponentCount>, particleKindCount + 1> bytes{};
+  CatalogueContainerBytes containers;
+
+  size_t kindBytes(size_t kind) const {
+    size_t total = 0;
+    for (size_t value : bytes[kind]) {
+      total += value;
+    }
+    return total;
+  }
+
+  size_t componentBytes(MemoryComponent component) const {
+    size_t total = 0;
+    for (const auto& kind : bytes) {
+      total += kind[static_cast<size_t>(component)];
+    }
+    return total;
+  }
+
+  size_t totalBytes() const {
+    size_t total = containers.total();
+    for (size_t kind = 0; kind < bytes.size(); ++kind) {
+      total += kindBytes(kind);
+    }
+    return total;
+  }
+
+  // Write "name value" lines: per-kind component bytes, component totals and the grand total
+  void print(std::ostream& out) const {
+    for (size_t kind = 0; kind < bytes.size(); ++kind) {
+      if (counts[kind] == 0) {
+        continue;
+      }
+      std::string name = kindName(static_cast<ParticleKind>(kind));
+      out << "count_" << name << ' ' << counts[kind] << '\n';
+      for (size_t component = 0; component < memoryComponentCount; ++component) {
+        out << "bytes_" << name << '_' << memoryComponentName(static_cast<MemoryComponent>(component)) << ' '
+            << bytes[kind][component] << '\n';
+      }
+      out << "bytes_" << name << ' ' << kindBytes(kind) << " (" << kindBytes(kind) / counts[kind] << " per particle)\n";
+    }
+    for (size_t component = 0; component < memoryComponentCount; ++component) {
+      MemoryComponent value = static_cast<MemoryComponent>(component);
+      out << "bytes_" << memoryComponentName(value) << ' ' << componentBytes(value) << '\n';
+    }
+    out << "bytes_pointer_array " << containers.pointers << '\n'
+        << "bytes_pointer_slack " << containers.slack << '\n'
+        << "bytes_tombstones " << containers.tombstones << '\n'
+        << "bytes_identity " << containers.identity << '\n'
+        << "bytes_total " << totalBytes() << '\n'
+        << "bytes_total_requested " << totalBytes() - componentBytes(MemoryComponent::AllocatorSlack) << '\n';
+  }
+};
+
+// What glibc malloc takes for a request: an 8-byte header, rounded up to 16, at least 32
+inline size_t mallocBlockBytes(size_t bytes) {
+  return std::max<size_t>(32, (bytes + 8 + 15) & ~size_t(15));
+}
+
+// libstdc++ keeps strings of up to 15 characters inline; longer ones own length + 1 bytes
+// when copy-constructed, which is how every particle stores its strings
+inline size_t stringHeapBytes(const std::string& value) {
+  return value.size() > 15 ? value.size() + 1 : 0;
+}
+
+// sizeof the concrete class behind a kind
+inline size_t particleObjectBytes(ParticleKind kind) {
+  switch (kind) {
+  case ParticleKind::Electron: return sizeof(Electron);
+  case ParticleKind::Muon: return sizeof(Muon);
+  case ParticleKind::Tau: return sizeof(Tau);
+  case ParticleKind::Neutrino: return sizeof(Neutrino);
+  case ParticleKind::Quark: return sizeof(Quark);
+  case ParticleKind::Gluon: return sizeof(Gluon);
+  case ParticleKind::Photon: return sizeof(Photon);
+  case ParticleKind::WBoson: return sizeof(WBoson);
+  case ParticleKind::ZBoson: return sizeof(ZBoson);
+  case ParticleKind::HiggsBoson: return sizeof(HiggsBoson);
+  default: return sizeof(Particle);
+  }
+}
+
+// Heap strings owned by a particle, as sizes of the blocks they occupy
+inline std::vector<size_t> particleStringBlocks(const Particle& particle) {
+  std::vector<size_t> blocks;
+  auto add = [&blocks](const std::string& value) {
+    if (size_t heap = stringHeapBytes(value)) {
+      blocks.push_back(heap);
+    }
+  };
+  switch (particle.getKind()) {
+  case ParticleKind::Electron:
+  case ParticleKind::Muon:
+  case ParticleKind::Tau:
+  case ParticleKind::Neutrino:
+    add(particle.getTypeName()); // Lepton::name
+    break;
+  case ParticleKind::Quark: {
+    const auto& quark = static_cast<const Quark&>(particle);
+    add(quark.getName());
+    add(quark.getcolourCharge());
+    break;
+  }
+  case ParticleKind::Gluon: {
+    auto colours = static_cast<const Gluon&>(particle).getcolourCharges();
+    add(colours.first);
+    add(colours.second);
+    break;
+  }
+  default:
+    break;
+  }
+  return blocks;
+}
+
+// libstdc++'s make_shared block: counts and a vtable pointer ahead of the object
+constexpr size_t sharedControlBlockBytes = 2 * sizeof(int) + sizeof(void*);
+
+// Account every particle of a catalogue, and every decay product reachable from them, once each.
+// Sizes follow the libstdc++/glibc layouts used by this project and assume particles are created
+// with make_shared, as everywhere in this code; the hook-measured live bytes of an ingest give the
+// ground truth to compare against (see BatchCli --memory-report).
+inline CatalogueMemoryReport measureCatalogueMemory(const ParticleCatalogue& catalogue) {
+  CatalogueMemoryReport report;
+  report.containers = catalogue.getContainerBytes();
+  std::unordered_set<const Particle*> seen;
+  std::vector<const Particle*> pending;
+  for (const auto& particle : catalogue.getParticles()) {
+    pending.push_back(particle.get());
+  }
+  while (!pending.empty()) {
+    const Particle* particle = pending.back();
+    pending.pop_back();
+    if (!seen.insert(particle).second) {
+      continue;
+    }
+    size_t kind = static_cast<size_t>(particle->getKind());
+    auto& bytes = report.bytes[kind];
+    ++report.counts[kind];
+
+    size_t object = particleObjectBytes(particle->getKind());
+    size_t block = sharedControlBlockBytes + object;
+    bytes[static_cast<size_t>(MemoryComponent::Object)] += object - sizeof(void*);
+    bytes[static_cast<size_t>(MemoryComponent::VtablePointer)] += sizeof(void*);
+    bytes[static_cast<size_t>(MemoryComponent::ControlBlock)] += sharedControlBlockBytes;
+    size_t slack = mallocBlockBytes(block) - block;
+
+    for (size_t heap : particleStringBlocks(*particle)) {
+      bytes[static_cast<size_t>(MemoryComponent::Strings)] += heap;
+      slack += mallocBlockBytes(heap) - heap;
+    }
+    const auto& products = particle->getDecayProducts();
+    if (products.capacity() > 0) {
+      size_t heap = products.capacity() * sizeof(products[0]);
+      bytes[static_cast<size_t>(MemoryComponent::DecayVectors)] += heap;
+      slack += mallocBlockBytes(heap) - heap;
+    }
+    for (const auto& product : products) {
+      pending.push_back(product.get());
+    }
+    bytes[static_cast<size_t>(MemoryComponent::AllocatorSlack)] += slack;
+  }
+  return report;
+}
+
+// Bytes held by a set of columns: used rows, unused capacity and the string dictionary
+struct ColumnsMemoryReport {
+  size_t used = 0;
+  size_t slack = 0;
+  size_t strings = 0;
+
+  size_t total() const { return used + slack + strings; }
+
+  void print(std::ostream& out) const {
+    out << "columns_bytes_used " << used << '\n'
+        << "columns_bytes_slack " << slack << '\n'
+        << "columns_bytes_strings " << strings << '\n'
+        << "columns_bytes_total " << total() << '\n';
+  }
+};
+
+inline ColumnsMemoryReport measureColumnsMemory(const ParticleColumns& columns) {
+  ColumnsMemoryReport report;
+  columns.forEachColumn([&report](const auto& column, bool) {
+    report.used += column.size() * sizeof(column[0]);
+    report.slack += (column.capacity() - column.size()) * sizeof(column[0]);
+  });
+  for (const auto& value : columns.strings) {
+    report.strings += sizeof(value) + stringHeapBytes(value);
+  }
+  return report;
+}
+
+#ifdef PARTICLES_TRACK_ALLOCATIONS
+// Replacement global allocation functions: each block carries its size in a header so that
+// unsized deletes can be counted. Aligned (align_val_t) allocations are not tracked.
+constexpr size_t trackedHeaderBytes = alignof(std::max_align_t);
+
+inline void* trackedAllocate(size_t size) {
+  void* block = std::malloc(size + trackedHeaderBytes);
+  if (!block) {
+    return nullptr;
+  }
+  *static_cast<size_t*>(block) = size;
+  MemoryTracker::global().allocated(size);
+  return static_cast<char*>(block) + trackedHeaderBytes;
+}
+
+// Kept out of line: once inlined into a delete, the compiler sees the header read as an access
+// before the start of the object that new returned
+[[gnu::noinline]] inline void trackedRelease(void* pointer) {
+  if (!pointer) {
+    return;
+  }
+  char* block = static_cast<char*>(pointer) - trackedHeaderBytes;
+  MemoryTracker::global().released(*reinterpret_cast<size_t*>(block));
+  std::free(block);
+}
+
+void* operator new(std::size_t size) {
+  if (void* pointer = trackedAllocate(size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return ::operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return trackedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return trackedAllocate(size); }
+void operator delete(void* pointer) noexcept { trackedRelease(pointer); }
+void operator delete[](void* pointer) noexcept { trackedRelease(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { trackedRelease(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { trackedRelease(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { trackedRelease(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { trackedRelease(pointer); }
+#endif
+
+#endif // MEMORYACCOUNTING_H
@@ -0,0 +1,79 @@
+// MomentumColumns.h - Defines MomentumColumns, four-momentum columns stored at a selectable precision.
+// Author: Raul Scanlon, Date: 03/06/2024
+
+#ifndef MOMENTUMCOLUMNS_H
+#define MOMENTUMCOLUMNS_H
+
+#include <vector>
+#include "CompensatedSum.h"
+#include "FourMomentum.h"
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+
+// E/px/py/pz as separate arrays of T. With T = float a scan over the momenta reads half the
+// bytes of ParticleColumns; sums still accumulate in double under a SummationPolicy, so the
+// result keeps the precision of the stored values (about 7 significant digits per term).
+template <typename T>
+struct MomentumColumns {
+  std::vector<T> energy, px, py, pz;
+
+  size_t size() const { return energy.size(); }
+
+  void resize(size_t rows) {
+    energy.resize(rows);
+    px.resize(rows);
+    py.resize(rows);
+    pz.resize(rows);
+  }
+
+  // Get the bytes held by the four arrays
+  size_t bytes() const { return 4 * size() * sizeof(T); }
+
+  BasicFourMomentum<T> at(size_t row) const { return BasicFourMomentum<T>(energy[row], px[row], py[row], pz[row]); }
+
+  // Copy (and round, for float) the momenta of catalogue columns
+  static MomentumColumns fromColumns(const ParticleColumns& columns, unsigned threads = 0) {
+    MomentumColumns result;
+    result.resize(columns.size());
+    parallelFor(columns.size(), threads, [&](size_t begin, size_t end, size_t) {
+      for (size_t row = begin; row < end; ++row) {
+        result.energy[row] = static_cast<T>(columns.energy[row]);
+        result.px[row] = static_cast<T>(columns.px[row]);
+        result.py[row] = static_cast<T>(columns.py[row]);
+        result.pz[row] = static_cast<T>(columns.pz[row]);
+      }
+    });
+    return result;
+  }
+};
+
+// Sum the four-momenta of rows [begin, end)
+template <typename T>
+FourMomentum sumMomentum(const MomentumColumns<T>& columns, size_t begin, size_t end,
+                         SummationPolicy policy = SummationPolicy::Compensated) {
+  MomentumAccumulator total(policy);
+  for (size_t row = begin; row < end; ++row) {
+    total.add(columns.energy[row], columns.px[row], columns.py[row], columns.pz[row]);
+  }
+  return total.getTotal();
+}
+
+// Sum all four-momenta with per-thread accumulators merged at the end
+template <typename T>
+FourMomentum sumMomentum(const MomentumColumns<T>& columns, SummationPolicy policy = SummationPolicy::Compensated,
+                         unsigned threads = 0) {
+  size_t workers = threads == 0 ? defaultThreadCount() : threads;
+  std::vector<MomentumAccumulator> partials(workers, MomentumAccumulator(policy));
+  parallelFor(columns.size(), threads, [&](size_t begin, size_t end, size_t chunk) {
+    for (size_t row = begin; row < end; ++row) {
+      partials[chunk].add(columns.energy[row], columns.px[row], columns.py[row], columns.pz[row]);
+    }
+  });
+  MomentumAccumulator total(policy);
+  for (const auto& partial : partials) {
+    total.merge(partial);
+  }
+  return total.getTotal();
+}
+
+#endif // MOMENTUMCOLUMNS_H
@@ -0,0 +1,237 @@
+// NumaColumns.h - Defines NumaPartitionedColumns, catalogue columns split into one partition per NUMA node,
+// with aggregates, queries and sorts that run each partition on its own node's workers.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef NUMACOLUMNS_H
+#define NUMACOLUMNS_H
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+#include "ColumnAggregates.h"
+#include "ColumnKey.h"
+#include "NumaThreadPool.h"
+#include "PartialSelection.h"
+#include "ParticleColumns.h"
+
+// Where partition memory lives
+enum class NumaPlacement {
+  FirstTouch, // Each partition is allocated and filled by its own node's workers, so its pages are local
+  Interleave  // Pages of every partition are spread round-robin over all nodes (even bandwidth, no locality)
+};
+
+// Rows split into contiguous partitions, partition i owned by node i of a NumaThreadPool.
+// Scans run on the owning node, so with FirstTouch placement no thread reads remote memory.
+// Global row r is row r - getOffset(i) of the partition i that contains it.
+class NumaPartitionedColumns {
+public:
+  // Distribute the rows of source over the nodes of the pool
+  static NumaPartitionedColumns build(const ParticleColumns& source, NumaThreadPool& pool,
+                                      NumaPlacement placement = NumaPlacement::FirstTouch) {
+    NumaPartitionedColumns result;
+    size_t nodes = pool.nodeCount();
+    result.partitions.resize(nodes);
+    result.offsets.resize(nodes + 1, 0);
+    for (size_t node = 0; node < nodes; ++node) {
+      result.offsets[node + 1] = source.size() * (node + 1) / nodes;
+    }
+
+    // Allocate on the owner (the first write decides the page's node), then copy in parallel
+    std::vector<size_t> counts(nodes);
+    pool.forEachNode([&](size_t node) {
+      ParticleColumns& partition = result.partitions[node];
+      partition.setStrings(source.strings);
+      partition.resize(result.offsets[node + 1] - result.offsets[node]);
+      counts[node] = partition.size();
+    });
+    pool.parallelForNodes(counts, [&](size_t node, size_t begin, size_t end, size_t) {
+      size_t first = result.offsets[node];
+      ParticleColumns::visitColumnPairs(result.partitions[node], source, [&](auto& target, const auto& column, bool) {
+        std::copy(column.begin() + first + begin, column.begin() + first + end, target.begin() + begin);
+      });
+    });
+
+    if (placement == NumaPlacement::Interleave) {
+      for (auto& partition : result.partitions) {
+        partition.forEachColumn([&pool](auto& column, bool) {
+          pool.getTopology().interleaveMemory(column.data(), column.size() * sizeof(column[0]));
+        });
+      }
+    }
+    result.placement = placement;
+    return result;
+  }
+
+  size_t size() const { return offsets.back(); }
+  size_t partitionCount() const { return partitions.size(); }
+  NumaPlacement getPlacement() const { return placement; }
+  const ParticleColumns& getPartition(size_t node) const { return partitions[node]; }
+  size_t getOffset(size_t node) const { return offsets[node]; }
+
+  // Compute totals; each node sums its own partition, partials merge in node order
+  ColumnTotals computeTotals(NumaThreadPool& pool, SummationPolicy policy = SummationPolicy::Compensated) const {
+    checkPool(pool);
+    auto partials = perWorker<ColumnTotals>(pool);
+    pool.parallelForNodes(partitionSizes(), [&](size_t node, size_t begin, size_t end, size_t chunk) {
+      partials[node][chunk] = ::computeTotals(partitions[node], begin, end, policy);
+    });
+    ColumnTotals totals;
+    for (const auto& node : partials) {
+      for (const auto& partial : node) {
+        totals.merge(partial);
+      }
+    }
+    return totals;
+  }
+
+  // Count rows for which predicate(partition, row) is true
+  template <typename Predicate>
+  size_t countRows(NumaThreadPool& pool, Predicate predicate) const {
+    checkPool(pool);
+    auto partials = perWorker<size_t>(pool);
+    pool.parallelForNodes(partitionSizes(), [&](size_t node, size_t begin, size_t end, size_t chunk) {
+      size_t matches = 0;
+      for (size_t row = begin; row < end; ++row) {
+        matches += predicate(partitions[node], row) ? 1 : 0;
+      }
+      partials[node][chunk] = matches;
+    });
+    size_t total = 0;
+    for (const auto& node : partials) {
+      total = std::accumulate(node.begin(), node.end(), total);
+    }
+    return total;
+  }
+
+  // Get the global rows of the k largest (or smallest) key values, best first; ties go to the lower row
+  std::vector<size_t> topKRows(NumaThreadPool& pool, ColumnKey key, size_t k, bool largest = true) const {
+    checkPool(pool);
+    auto partials = perWorker<std::vector<SelectedValue>>(pool);
+    pool.parallelForNodes(partitionSizes(), [&](size_t node, size_t begin, size_t end, size_t chunk) {
+      const ParticleColumns& partition = partitions[node];
+      auto selected = selectTopK(end - begin, k, [&](size_t i) { return columnKeyValue(partition, key, begin + i); },
+                                 largest, 1);
+      for (auto& value : selected) {
+        value.index += offsets[node] + begin;
+      }
+      partials[node][chunk] = std::move(selected);
+    });
+    std::vector<SelectedValue> merged;
+    for (const auto& node : partials) {
+      for (const auto& partial : node) {
+        merged.insert(merged.end(), partial.begin(), partial.end());
+      }
+    }
+    size_t keep = std::min(k, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(), [largest](const SelectedValue& a, const SelectedValue& b) {
+      if (a.value != b.value) {
+        return largest ? a.value > b.value : a.value < b.value;
+      }
+      return a.index < b.index;
+    });
+    std::vector<size_t> rows(keep);
+    for (size_t i = 0; i < keep; ++i) {
+      rows[i] = merged[i].index;
+    }
+    return rows;
+  }
+
+  // Stable-sort every partition by a key on its own node; the sorted copy is built by the owner,
+  // so it stays local. Use mergeSorted for one globally ordered result.
+  void sortPartitions(NumaThreadPool& pool, ColumnKey key, bool descending = false) {
+    checkPool(pool);
+    pool.forEachNode([&](size_t node) {
+      ParticleColumns& partition = partitions[node];
+      std::vector<double> values(partition.size());
+      columnKeyValues(partition, key, 0, values.size(), values.data());
+      std::vector<size_t> order(values.size());
+      std::iota(order.begin(), order.end(), size_t(0));
+      std::stable_sort(order.begin(), order.end(), [&values, descending](size_t a, size_t b) {
+        return descending ? values[a] > values[b] : values[a] < values[b];
+      });
+      partition = partition.gather(order);
+    });
+  }
+
+  // Merge partitions already sorted by sortPartitions into one ordered set of columns
+  ParticleColumns mergeSorted(ColumnKey key, bool descending = false) const {
+    struct Head {
+      double value;
+      size_t node;
+      size_t row;
+    };
+    auto after = [descending](const Head& a, const Head& b) {
+      if (a.value != b.value) {
+        return descending ? a.value < b.value : a.value > b.value;
+      }
+      return a.node > b.node;
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(after)> heads(after);
+    for (size_t node = 0; node < partitions.size(); ++node) {
+      if (partitions[node].size() > 0) {
+        heads.push({columnKeyValue(partitions[node], key, 0), node, 0});
+      }
+    }
+    ParticleColumns result;
+    if (!partitions.empty()) {
+      result.setStrings(partitions[0].strings);
+    }
+    result.reserve(size());
+    while (!heads.empty()) {
+      Head head = heads.top();
+      heads.pop();
+      result.appendRow(partitions[head.node], head.row);
+      if (++head.row < partitions[head.node].size()) {
+        head.value = columnKeyValue(partitions[head.node], key, head.row);
+        heads.push(head);
+      }
+    }
+    return result;
+  }
+
+  // Concatenate the partitions back into ordinary columns
+  ParticleColumns toColumns() const {
+    ParticleColumns result;
+    if (!partitions.empty()) {
+      result.setStrings(partitions[0].strings);
+    }
+    result.reserve(size());
+    for (const auto& partition : partitions) {
+      result.appendColumns(partition);
+    }
+    return result;
+  }
+
+private:
+  std::vector<ParticleColumns> partitions;
+  std::vector<size_t> offsets{0}; // offsets[i] is the first global row of partition i
+  NumaPlacement placement = NumaPlacement::FirstTouch;
+
+  void checkPool(const NumaThreadPool& pool) const {
+    if (pool.nodeCount() != partitions.size()) {
+      throw std::invalid_argument("Thread pool nodes do not match the column partitions");
+    }
+  }
+
+  std::vector<size_t> partitionSizes() const {
+    std::vector<size_t> sizes;
+    for (const auto& partition : partitions) {
+      sizes.push_back(partition.size());
+    }
+    return sizes;
+  }
+
+  // One result slot per worker of every node
+  template <typename T>
+  static std::vector<std::vector<T>> perWorker(const NumaThreadPool& pool) {
+    std::vector<std::vector<T>> slots(pool.nodeCount());
+    for (size_t node = 0; node < slots.size(); ++node) {
+      slots[node].resize(pool.threadsOnNode(node));
+    }
+    return slots;
+  }
+};
+
+#endif // NUMACOLUMNS_H
@@ -0,0 +1,98 @@
+// NumaThreadPool.h - Defines NumaThreadPool, one pool of pinned worker threads per NUMA node.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef NUMATHREADPOOL_H
+#define NUMATHREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "NumaTopology.h"
+#include "ThreadPool.h"
+
+// Worker threads grouped by NUMA node, each pinned to one CPU of its node. Work is submitted per
+// node, so data partitions placed on a node are only ever touched by that node's workers.
+// Bodies must not submit to the same pool and wait (the workers would wait on themselves).
+class NumaThreadPool {
+public:
+  // threadsPerNode = 0 starts one worker per CPU of each node
+  explicit NumaThreadPool(unsigned threadsPerNode = 0, const NumaTopology& topology = NumaTopology::system())
+    : topology(topology) {
+    for (const NumaNode& node : topology.getNodes()) {
+      unsigned threads = threadsPerNode == 0 ? static_cast<unsigned>(node.cpus.size()) : threadsPerNode;
+      std::vector<int> cpus = node.cpus;
+      pools.push_back(std::make_unique<ThreadPool>(threads, 1024, [cpus](unsigned worker) {
+        NumaTopology::pinCurrentThread({cpus[worker % cpus.size()]});
+      }));
+    }
+  }
+
+  const NumaTopology& getTopology() const { return topology; }
+  size_t nodeCount() const { return pools.size(); }
+  unsigned threadsOnNode(size_t node) const { return pools[node]->size(); }
+
+  // Run body(node, begin, end, chunk) over [0, counts[node]) for every node at once, each range
+  // split into at most threadsOnNode(node) chunks run on that node's workers. Waits for all of
+  // them and rethrows the first exception.
+  template <typename Body>
+  void parallelForNodes(const std::vector<size_t>& counts, Body body) {
+    struct Pending {
+      std::mutex mutex;
+      std::condition_variable finished;
+      size_t remaining = 0;
+      std::exception_ptr error;
+    } pending;
+
+    std::vector<std::vector<std::pair<size_t, size_t>>> ranges(pools.size());
+    for (size_t node = 0; node < pools.size() && node < counts.size(); ++node) {
+      size_t chunks = std::min<size_t>(threadsOnNode(node), counts[node]);
+      size_t step = chunks == 0 ? 0 : (counts[node] + chunks - 1) / chunks;
+      for (size_t begin = 0; begin < counts[node]; begin += step) {
+        ranges[node].emplace_back(begin, std::min(counts[node], begin + step));
+      }
+      pending.remaining += ranges[node].size();
+    }
+
+    for (size_t node = 0; node < ranges.size(); ++node) {
+      for (size_t chunk = 0; chunk < ranges[node].size(); ++chunk) {
+        size_t begin = ranges[node][chunk].first, end = ranges[node][chunk].second;
+        pools[node]->submit([&pending, &body, node, begin, end, chunk]() {
+          std::exception_ptr error;
+          try {
+            body(node, begin, end, chunk);
+          } catch (...) {
+            error = std::current_exception();
+          }
+          std::lock_guard<std::mutex> lock(pending.mutex);
+          if (error && !pending.error) {
+            pending.error = error;
+          }
+          if (--pending.remaining == 0) {
+            pending.finished.notify_all();
+          }
+        });
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(pending.mutex);
+    pending.finished.wait(lock, [&pending] { return pending.remaining == 0; });
+    if (pending.error) {
+      std::rethrow_exception(pending.error);
+    }
+  }
+
+  // Run body(node) once on a worker of every node and wait
+  template <typename Body>
+  void forEachNode(Body body) {
+    parallelForNodes(std::vector<size_t>(pools.size(), 1), [&body](size_t node, size_t, size_t, size_t) { body(node); });
+  }
+
+private:
+  const NumaTopology& topology;
+  std::vector<std::unique_ptr<ThreadPool>> pools;
+};
+
+#endif // NUMATHREADPOOL_H
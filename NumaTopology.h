@@ -0,0 +1,162 @@
+// NumaTopology.h - Defines NumaTopology, the NUMA nodes of the machine and their CPUs, with helpers to
+// pin threads to a node and to place memory on chosen nodes.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef NUMATOPOLOGY_H
+#define NUMATOPOLOGY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+// One NUMA node: its id and the CPUs this process may run on there
+struct NumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// NUMA layout read from /sys/devices/system/node. Machines (or containers) without that
+// information are treated as a single node holding every allowed CPU, so callers need no
+// special case. Only the kernel interface is used; there is no dependency on libnuma.
+class NumaTopology {
+public:
+  // Get the topology of this machine (read once)
+  static const NumaTopology& system() {
+    static const NumaTopology topology = detect();
+    return topology;
+  }
+
+  const std::vector<NumaNode>& getNodes() const { return nodes; }
+  size_t nodeCount() const { return nodes.size(); }
+
+  // Get the node holding a CPU (0 if unknown)
+  size_t nodeOfCpu(int cpu) const {
+    for (size_t index = 0; index < nodes.size(); ++index) {
+      if (std::find(nodes[index].cpus.begin(), nodes[index].cpus.end(), cpu) != nodes[index].cpus.end()) {
+        return index;
+      }
+    }
+    return 0;
+  }
+
+  // Restrict the calling thread to the given CPUs; returns false if the kernel refused
+  static bool pinCurrentThread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+  }
+
+  // Move the pages of [data, data + bytes) to one node (by index into getNodes()).
+  // Pages not yet touched are allocated there when first written. Returns false if the kernel
+  // refused, e.g. without NUMA support; the memory stays usable either way.
+  bool bindMemory(const void* data, size_t bytes, size_t node) const {
+    return applyPolicy(data, bytes, MPOL_BIND, {node});
+  }
+
+  // Spread the pages of [data, data + bytes) round-robin over every node
+  bool interleaveMemory(const void* data, size_t bytes) const {
+    std::vector<size_t> all(nodes.size());
+    for (size_t index = 0; index < all.size(); ++index) {
+      all[index] = index;
+    }
+    return applyPolicy(data, bytes, MPOL_INTERLEAVE, all);
+  }
+
+private:
+  std::vector<NumaNode> nodes;
+
+  static NumaTopology detect() {
+    NumaTopology topology;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool haveAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto isAllowed = [&](int cpu) { return !haveAffinity || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)); };
+
+    for (int id : parseList(readFile("/sys/devices/system/node/online"))) {
+      NumaNode node{id, {}};
+      for (int cpu : parseList(readFile("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"))) {
+        if (isAllowed(cpu)) {
+          node.cpus.push_back(cpu);
+        }
+      }
+      if (!node.cpus.empty()) {
+        topology.nodes.push_back(node);
+      }
+    }
+    if (topology.nodes.empty()) {
+      NumaNode node{0, {}};
+      long count = sysconf(_SC_NPROCESSORS_CONF);
+      for (int cpu = 0; cpu < count; ++cpu) {
+        if (isAllowed(cpu)) {
+          node.cpus.push_back(cpu);
+        }
+      }
+      topology.nodes.push_back(node);
+    }
+    return topology;
+  }
+
+  static std::string readFile(const std::string& path) {
+    std::ifstream in(path);
+    std::string text;
+    std::getline(in, text);
+    return text;
+  }
+
+  // Parse a kernel list such as "0-3,8-11"
+  static std::vector<int> parseList(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+      if (item.empty()) {
+        continue;
+      }
+      size_t dash = item.find('-');
+      try {
+        int first = std::stoi(item.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        for (int value = first; value <= last; ++value) {
+          values.push_back(value);
+        }
+      } catch (const std::exception&) {
+        return {};
+      }
+    }
+    return values;
+  }
+
+  bool applyPolicy(const void* data, size_t bytes, int mode, const std::vector<size_t>& nodeIndices) const {
+    if (bytes == 0 || nodes.size() < 2) {
+      return nodes.size() == 1;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(data) & ~static_cast<std::uintptr_t>(page - 1);
+    std::uintptr_t end = reinterpret_cast<std::uintptr_t>(data) + bytes;
+    const size_t bitsPerWord = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(64 / sizeof(unsigned long) + 1, 0);
+    for (size_t index : nodeIndices) {
+      size_t id = static_cast<size_t>(nodes[index].id);
+      if (id / bitsPerWord < mask.size()) {
+        mask[id / bitsPerWord] |= 1UL << (id % bitsPerWord);
+      }
+    }
+    return syscall(SYS_mbind, begin, end - begin, mode, mask.data(), mask.size() * bitsPerWord, MPOL_MF_MOVE) == 0;
+  }
+};
+
+#endif // NUMATOPOLOGY_H
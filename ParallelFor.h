@@ -0,0 +1,61 @@
+// ParallelFor.h - Defines a minimal helper for splitting index ranges across threads.
+// Author: Raul Scanlon, Date: 28/05/2024
+
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Get the number of worker threads to use when none is requested
+inline unsigned defaultThreadCount() {
+  unsigned hardware = std::thread::hardware_concurrency();
+  return hardware == 0 ? 1 : hardware;
+}
+
+// Run body(begin, end, chunkIndex) over [0, count) split into at most `threads` contiguous chunks.
+// The first exception thrown by any chunk is rethrown on the calling thread.
+template <typename Body>
+void parallelFor(std::size_t count, unsigned threads, Body body) {
+  if (threads == 0) {
+    threads = defaultThreadCount();
+  }
+  std::size_t chunks = std::min<std::size_t>(threads, count);
+  if (chunks <= 1) {
+    if (count > 0) {
+      body(std::size_t(0), count, std::size_t(0));
+    }
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  std::vector<std::exception_ptr> errors(chunks);
+  std::size_t step = (count + chunks - 1) / chunks;
+  for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+    std::size_t begin = chunk * step;
+    std::size_t end = std::min(count, begin + step);
+    if (begin >= end) {
+      break;
+    }
+    workers.emplace_back([&body, &errors, begin, end, chunk]() {
+      try {
+        body(begin, end, chunk);
+      } catch (...) {
+        errors[chunk] = std::current_exception();
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+#endif // PARALLELFOR_H
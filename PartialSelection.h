@@ -0,0 +1,152 @@
+// PartialSelection.h - Defines parallel top-K, nth-element and quantile-sketch selection over indexed values.
+// Author: Raul Scanlon, Date: 02/06/2024
+
+#ifndef PARTIALSELECTION_H
+#define PARTIALSELECTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ParallelFor.h"
+#include "QuantileSketch.h"
+
+// The selections below read values through valueAt(index) for index in [0, count) and never
+// reorder the underlying storage. NaN values are treated as absent, which also lets callers
+// exclude rows by returning NaN for them.
+
+// A selected index with the value it was ranked by
+struct SelectedValue {
+  size_t index;
+  double value;
+};
+
+// Get the k indices with the largest values (smallest if largest is false), best first.
+// Each thread keeps a bounded heap of its best k; the heaps are merged at the end.
+template <typename ValueAt>
+std::vector<SelectedValue> selectTopK(size_t count, size_t k, ValueAt valueAt, bool largest = true, unsigned threads = 0) {
+  // better(a, b): a ranks before b; ties go to the lower index so results are deterministic
+  auto better = [largest](const SelectedValue& a, const SelectedValue& b) {
+    if (a.value != b.value) {
+      return largest ? a.value > b.value : a.value < b.value;
+    }
+    return a.index < b.index;
+  };
+  if (k == 0) {
+    return {};
+  }
+  size_t workers = threads == 0 ? defaultThreadCount() : threads;
+  std::vector<std::vector<SelectedValue>> partials(workers);
+  parallelFor(count, threads, [&](size_t begin, size_t end, size_t chunk) {
+    // Heap ordered so that the worst kept value is on top
+    std::priority_queue<SelectedValue, std::vector<SelectedValue>, decltype(better)> heap(better);
+    for (size_t index = begin; index < end; ++index) {
+      SelectedValue candidate{index, static_cast<double>(valueAt(index))};
+      if (std::isnan(candidate.value)) {
+        continue;
+      }
+      if (heap.size() < k) {
+        heap.push(candidate);
+      } else if (better(candidate, heap.top())) {
+        heap.pop();
+        heap.push(candidate);
+      }
+    }
+    auto& partial = partials[chunk];
+    partial.reserve(heap.size());
+    while (!heap.empty()) {
+      partial.push_back(heap.top());
+      heap.pop();
+    }
+  });
+  std::vector<SelectedValue> merged;
+  for (const auto& partial : partials) {
+    merged.insert(merged.end(), partial.begin(), partial.end());
+  }
+  size_t keep = std::min(k, merged.size());
+  std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(), better);
+  merged.resize(keep);
+  return merged;
+}
+
+// Build a quantile sketch of all values, one sketch per thread merged at the end
+template <typename ValueAt>
+QuantileSketch buildQuantileSketch(size_t count, ValueAt valueAt, unsigned threads = 0, size_t k = 200) {
+  size_t workers = threads == 0 ? defaultThreadCount() : threads;
+  std::vector<QuantileSketch> partials(workers, QuantileSketch(k));
+  parallelFor(count, threads, [&](size_t begin, size_t end, size_t chunk) {
+    for (size_t index = begin; index < end; ++index) {
+      partials[chunk].add(static_cast<double>(valueAt(index)));
+    }
+  });
+  QuantileSketch sketch(k);
+  for (const auto& partial : partials) {
+    sketch.merge(partial);
+  }
+  return sketch;
+}
+
+// Get the exact value that would be at position n (0-based) if the non-NaN values were sorted
+// ascending, as std::nth_element would place it. Large inputs are bracketed with a sketch first,
+// so only the values near the answer are copied rather than the whole column.
+template <typename ValueAt>
+double selectNth(size_t count, size_t n, ValueAt valueAt, unsigned threads = 0) {
+  auto exact = [&](double low, double high, size_t skipped) {
+    std::vector<double> band;
+    for (size_t index = 0; index < count; ++index) {
+      double value = static_cast<double>(valueAt(index));
+      if (value >= low && value <= high) {
+        band.push_back(value);
+      }
+    }
+    if (n < skipped || n - skipped >= band.size()) {
+      throw std::out_of_range("selectNth: position " + std::to_string(n) + " is past the last value");
+    }
+    std::nth_element(band.begin(), band.begin() + (n - skipped), band.end());
+    return band[n - skipped];
+  };
+  const double infinity = std::numeric_limits<double>::infinity();
+  if (count < (size_t(1) << 16)) {
+    return exact(-infinity, infinity, 0);
+  }
+
+  QuantileSketch sketch = buildQuantileSketch(count, valueAt, threads, 400);
+  if (n >= sketch.getCount()) {
+    throw std::out_of_range("selectNth: position " + std::to_string(n) + " is past the last value");
+  }
+  double total = static_cast<double>(sketch.getCount());
+  double margin = 0.02 + 64.0 / total;
+  double low = sketch.quantile(n / total - margin);
+  double high = sketch.quantile((n + 1) / total + margin);
+
+  // Count values below the bracket and collect the ones inside it
+  size_t workers = threads == 0 ? defaultThreadCount() : threads;
+  std::vector<size_t> belowCounts(workers, 0);
+  std::vector<std::vector<double>> bands(workers);
+  parallelFor(count, threads, [&](size_t begin, size_t end, size_t chunk) {
+    for (size_t index = begin; index < end; ++index) {
+      double value = static_cast<double>(valueAt(index));
+      if (value < low) {
+        ++belowCounts[chunk];
+      } else if (value <= high) {
+        bands[chunk].push_back(value);
+      }
+    }
+  });
+  size_t below = 0;
+  std::vector<double> band;
+  for (size_t chunk = 0; chunk < workers; ++chunk) {
+    below += belowCounts[chunk];
+    band.insert(band.end(), bands[chunk].begin(), bands[chunk].end());
+  }
+  if (n < below || n - below >= band.size()) {
+    return exact(-infinity, infinity, 0); // The sketch missed the bracket; fall back to a full copy
+  }
+  std::nth_element(band.begin(), band.begin() + (n - below), band.end());
+  return band[n - below];
+}
+
+#endif // PARTIALSELECTION_H
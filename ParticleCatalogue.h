@@ -7,81 +7,343 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <array>
 #include <algorithm>
 #include <iostream>
 #include <limits>
 #include <string>
 #include <cctype> // for std::tolower
+#include <cstdint>
+#include <stdexcept>
+#include "CompensatedSum.h"
 #include "Particle.h"
+#include "PartialSelection.h"
+
+// Catalogue-assigned particle identity: dense (0, 1, 2, ... in insertion order), never reused,
+// and unchanged by removal, sorting or compaction
+using ParticleId = std::uint32_t;
+constexpr ParticleId invalidParticleId = 0xFFFFFFFFu;
+
+// A contiguous run of IDs, e.g. the children of a decay
+struct ParticleIdRange {
+  const ParticleId* first = nullptr;
+  const ParticleId* last = nullptr;
+
+  const ParticleId* begin() const { return first; }
+  const ParticleId* end() const { return last; }
+  size_t size() const { return static_cast<size_t>(last - first); }
+  bool empty() const { return first == last; }
+};
+
+// Bytes held by a catalogue's own containers, not counting the particles they point to
+struct CatalogueContainerBytes {
+  size_t pointers = 0;   // shared_ptr slots in use (including removed slots awaiting compaction)
+  size_t slack = 0;      // Unused capacity of the pointer array
+  size_t tombstones = 0; // Removed-slot bitmap
+  size_t identity = 0;   // Slot IDs, the ID-to-slot index and the decay link arrays
+
+  size_t total() const { return pointers + slack + tombstones + identity; }
+};
 
 // Class representing a catalogue of particles
 class ParticleCatalogue {
 public:
-  // Add a particle to the catalogue
-  void addParticle(const std::shared_ptr<Particle>& particle) {
+  // Add a particle to the catalogue and return its ID
+  ParticleId addParticle(const std::shared_ptr<Particle>& particle) {
+    if (!particle) {
+      throw std::invalid_argument("Cannot add a null particle to the catalogue");
+    }
+    if (nextId == invalidParticleId) {
+      throw std::length_error("Particle IDs exhausted");
+    }
+    ParticleId id = nextId++;
     particles.push_back(particle);
+    slotIds.push_back(id);
+    slotOfId.push_back(static_cast<ParticleId>(particles.size() - 1));
+    parentOf.push_back(invalidParticleId);
+    childBegin.push_back(0);
+    childEnd.push_back(0);
+    accumulate(*particle, 1);
+    return id;
+  }
+
+  // Add a particle and, recursively, the decay products it holds, linking them by ID; returns the root's ID
+  ParticleId addDecayTree(const std::shared_ptr<Particle>& root) {
+    ParticleId rootId = addParticle(root);
+    std::vector<std::pair<ParticleId, const Particle*>> pending{{rootId, root.get()}};
+    while (!pending.empty()) {
+      auto [parentId, parent] = pending.back();
+      pending.pop_back();
+      std::vector<ParticleId> children;
+      for (const auto& product : parent->getDecayProducts()) {
+        children.push_back(addParticle(product));
+        pending.emplace_back(children.back(), product.get());
+      }
+      if (!children.empty()) {
+        linkDecay(parentId, children);
+      }
+    }
+    return rootId;
+  }
+
+  // Record that parent decayed into children (all in the catalogue, none removed). Links are plain
+  // ID arrays: they keep nothing alive and stay valid when particles are removed later. The links
+  // always form a forest, so a child may not repeat, be the parent itself or be one of its ancestors.
+  void linkDecay(ParticleId parent, const std::vector<ParticleId>& children) {
+    checkLiveId(parent);
+    if (childEnd[parent] != childBegin[parent]) {
+      throw std::invalid_argument("Particle " + std::to_string(parent) + " already has decay products");
+    }
+    std::vector<ParticleId> sorted(children);
+    std::sort(sorted.begin(), sorted.end());
+    auto repeated = std::adjacent_find(sorted.begin(), sorted.end());
+    if (repeated != sorted.end()) {
+      throw std::invalid_argument("Particle " + std::to_string(*repeated) + " listed twice as a decay product");
+    }
+    for (ParticleId child : sorted) {
+      checkLiveId(child);
+      if (child == parent) {
+        throw std::invalid_argument("Particle " + std::to_string(child) + " cannot decay into itself");
+      }
+      if (parentOf[child] != invalidParticleId) {
+        throw std::invalid_argument("Particle " + std::to_string(child) + " already has a parent");
+      }
+    }
+    for (ParticleId ancestor = parentOf[parent]; ancestor != invalidParticleId; ancestor = parentOf[ancestor]) {
+      if (std::binary_search(sorted.begin(), sorted.end(), ancestor)) {
+        throw std::invalid_argument("Particle " + std::to_string(ancestor) + " is an ancestor of " +
+                                    std::to_string(parent) + " and cannot be its decay product");
+      }
+    }
+    childBegin[parent] = static_cast<std::uint32_t>(childIds.size());
+    for (ParticleId child : children) {
+      parentOf[child] = parent;
+      childIds.push_back(child);
+    }
+    childEnd[parent] = static_cast<std::uint32_t>(childIds.size());
+  }
+
+  // Get the particle with an ID in O(1), or nullptr if it was removed
+  std::shared_ptr<Particle> getParticle(ParticleId id) const {
+    size_t slot = findSlot(id);
+    return slot == npos ? nullptr : particles[slot];
+  }
+
+  // Get the current storage index of an ID (npos if removed or unknown), as in getParticles();
+  // valid until the catalogue is next modified, unlike the ID itself
+  size_t findSlot(ParticleId id) const {
+    return id < slotOfId.size() && slotOfId[id] != invalidParticleId ? slotOfId[id] : npos;
+  }
+
+  // Get the ID of the particle at a storage index (as in getParticles())
+  ParticleId getId(size_t slot) const {
+    requireCompacted();
+    return slotIds.at(slot);
+  }
+
+  // Get the IDs in storage order, parallel to getParticles()
+  const std::vector<ParticleId>& getParticleIds() const {
+    requireCompacted();
+    return slotIds;
+  }
+
+  bool contains(ParticleId id) const { return findSlot(id) != npos; }
+
+  // Get the parent an ID decayed from (invalidParticleId for primary particles)
+  ParticleId getParentId(ParticleId id) const {
+    checkId(id);
+    return parentOf[id];
+  }
+
+  // Get the decay products of an ID
+  ParticleIdRange getChildIds(ParticleId id) const {
+    checkId(id);
+    return {childIds.data() + childBegin[id], childIds.data() + childEnd[id]};
+  }
+
+  // Follow parent links to the primary particle an ID descends from (itself if primary)
+  ParticleId getRootId(ParticleId id) const {
+    checkId(id);
+    while (parentOf[id] != invalidParticleId) {
+      id = parentOf[id];
+    }
+    return id;
+  }
+
+  // Get the number of IDs ever assigned (removed particles keep theirs, and their identity state)
+  size_t getIdCount() const { return nextId; }
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  // Remove a particle from the catalogue, returning false if it is not present
+  bool removeParticle(const std::shared_ptr<Particle>& particle) {
+    if (!particle) {
+      return false;
+    }
+    auto found = std::find(particles.begin(), particles.end(), particle);
+    if (found == particles.end()) {
+      return false;
+    }
+    tombstone(static_cast<size_t>(found - particles.begin()));
+    compactIfSparse();
+    return true;
+  }
+
+  // Remove every particle for which predicate(particle) is true; returns the number removed.
+  // Removal is logical (a tombstone bit per slot, the particle is released at once) and the
+  // cached totals are patched per removed particle; storage is rewritten by compact().
+  template <typename Predicate>
+  size_t eraseIf(Predicate predicate) {
+    size_t removed = 0;
+    for (size_t index = 0; index < particles.size(); ++index) {
+      if (!isRemoved(index) && predicate(*particles[index])) {
+        tombstone(index);
+        ++removed;
+      }
+    }
+    compactIfSparse();
+    return removed;
+  }
+
+  // Keep only the particles for which keep(particle) is true; returns the number removed
+  template <typename Predicate>
+  size_t filterInPlace(Predicate keep) {
+    return eraseIf([&keep](const Particle& particle) { return !keep(particle); });
+  }
+
+  // Rewrite storage densely without the removed slots, keeping the order of the rest, and give
+  // the freed capacity back. The rows move in place; shrink_to_fit then copies each array into
+  // one of the kept size, one array at a time, so the peak is the old arrays plus a kept-size
+  // pointer array (16 bytes per kept particle).
+  void compact() {
+    if (removedCount == 0) {
+      return;
+    }
+    size_t kept = 0;
+    for (size_t index = 0; index < particles.size(); ++index) {
+      if (!isRemoved(index)) {
+        particles[kept] = std::move(particles[index]);
+        slotIds[kept] = slotIds[index];
+        slotOfId[slotIds[kept]] = static_cast<ParticleId>(kept);
+        ++kept;
+      }
+    }
+    particles.resize(kept);
+    particles.shrink_to_fit();
+    slotIds.resize(kept);
+    slotIds.shrink_to_fit();
+    removedBits.clear();
+    removedBits.shrink_to_fit();
+    removedCount = 0;
+  }
+
+  // Compact automatically once this fraction of the slots is removed: 0 (the default) compacts
+  // at the end of every removal, 1 or more only on an explicit compact(). While removals are
+  // pending, reads that expose the storage (getParticles, getParticleIds, getId) throw; the
+  // other reads skip removed slots, and none of them modify the catalogue.
+  void setCompactionThreshold(double fraction) {
+    compactionThreshold = fraction;
+    compactIfSparse();
+  }
+
+  // Get the number of removed slots waiting for compaction
+  size_t getRemovedCount() const { return removedCount; }
+
+  // Choose how the cached totals are accumulated (compensated by default) and recompute them
+  void setSummationPolicy(SummationPolicy policy) {
+    summationPolicy = policy;
+    refreshAggregates();
+  }
+
+  SummationPolicy getSummationPolicy() const { return summationPolicy; }
+
+  // Recompute all cached totals, e.g. after particles were modified through their pointers
+  void refreshAggregates() {
+    resetAggregates();
+    forEachLive([this](const Particle& particle) { accumulate(particle, 1); });
   }
 
   // Print all particles in the catalogue
   void printAllParticles() const {
-    for (const auto& particle : particles) {
-      particle->print();
-    }
+    forEachLive([](const Particle& particle) { particle.print(); });
   }
 
   // Print particles by type
   void printParticlesByType(const std::string& type) const {
     std::string lowerType = toLowerCase(type); // Convert type to lowercase
-    std::for_each(particles.begin(), particles.end(), [&lowerType](const auto& particle) {
-      if (toLowerCase(particle->getTypeName()) == lowerType) { // Compare lowercase strings
-        particle->print();
+    forEachLive([&lowerType](const Particle& particle) {
+      if (toLowerCase(particle.getTypeName()) == lowerType) { // Compare lowercase strings
+        particle.print();
       }
     });
   }
   
+  // Get read-only access to the stored particles (throws while removals await compaction)
+  const std::vector<std::shared_ptr<Particle>>& getParticles() const {
+    requireCompacted();
+    return particles;
+  }
+
   // Get the total number of particles
   size_t getTotalCount() const {
-    return particles.size();
+    return particles.size() - removedCount;
+  }
+
+  // Get the bytes used by the catalogue's containers (see MemoryAccounting.h for the particles)
+  CatalogueContainerBytes getContainerBytes() const {
+    CatalogueContainerBytes bytes;
+    bytes.pointers = particles.size() * sizeof(particles[0]);
+    bytes.slack = (particles.capacity() - particles.size()) * sizeof(particles[0]);
+    bytes.tombstones = removedBits.capacity() * sizeof(removedBits[0]);
+    bytes.identity = (slotIds.capacity() + slotOfId.capacity() + parentOf.capacity() + childIds.capacity()) * sizeof(ParticleId) +
+                     (childBegin.capacity() + childEnd.capacity()) * sizeof(std::uint32_t);
+    return bytes;
   }
 
   // Template function to get the count of a specific particle type
   template <typename T>
   int getParticleCount() const {
     int count = 0;
-    for (const auto& particle : particles) {
-      if (std::dynamic_pointer_cast<T>(particle)) {
+    forEachLive([&count](const Particle& particle) {
+      if (dynamic_cast<const T*>(&particle)) {
         count++;
       }
-    }
+    });
     return count;
   }
 
-  // Get the counts of particles by type
+  // Get the counts of particles by lowercase type name. Built by a scan on each call; inserts and
+  // removals only maintain the per-kind counts (getKindCount)
   std::map<std::string, int> getParticleCounts() const {
     std::map<std::string, int> counts;
-    for (const auto& particle : particles) {
-      std::string type = toLowerCase(particle->getTypeName()); // Convert type to lowercase
-      counts[type]++;
-    }
+    forEachLive([&counts](const Particle& particle) {
+      counts[toLowerCase(particle.getTypeName())]++;
+    });
     return counts;
   }
 
+  // Get the number of particles of a given kind
+  int getKindCount(ParticleKind kind) const {
+    return kindCounts[static_cast<size_t>(kind)];
+  }
+
   // Get the total four-momentum of all particles
   FourMomentum getTotalFourMomentum() const {
-    FourMomentum totalMomentum;
-    for (const auto& particle : particles) {
-      totalMomentum = totalMomentum + particle->getFourMomentum();
-    }
-    return totalMomentum;
+    return totalMomentum.getTotal();
   }
 
+  // Conservation-law totals over all particles
+  double getTotalCharge() const { return totalCharge.value(); }
+  long getTotalLeptonNumber() const { return totalLeptonNumber; }
+  double getTotalBaryonNumber() const { return totalBaryonNumber.value(); }
+
   // Get particles of a specific type
   std::vector<std::shared_ptr<Particle>> getParticlesOfType(const std::string& type) const {
     std::vector<std::shared_ptr<Particle>> particlesOfType;
     std::string lowerType = toLowerCase(type); // Convert type to lowercase
-    for (const auto& particle : particles) {
-      if (toLowerCase(particle->getTypeName()) == lowerType) { // Compare lowercase strings
-        particlesOfType.push_back(particle);
+    for (size_t index = 0; index < particles.size(); ++index) {
+      if (!isRemoved(index) && toLowerCase(particles[index]->getTypeName()) == lowerType) { // Compare lowercase strings
+        particlesOfType.push_back(particles[index]);
       }
     }
     return particlesOfType;
@@ -89,9 +351,40 @@ public:
 
   // Function to sort particles by charge using a lambda function
   void sortParticlesByCharge() {
-    std::sort(particles.begin(), particles.end(), [](const std::shared_ptr<Particle>& a, const std::shared_ptr<Particle>& b) {
-      return a->getCharge() < b->getCharge();
+    compact();
+    std::vector<size_t> order(particles.size());
+    for (size_t index = 0; index < order.size(); ++index) {
+      order[index] = index;
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return particles[a]->getCharge() < particles[b]->getCharge();
     });
+    permute(order);
+  }
+
+  // Get the k particles with the largest key(particle) (smallest if largest is false), best first,
+  // without reordering the catalogue
+  template <typename Key>
+  std::vector<std::shared_ptr<Particle>> getTopK(size_t k, Key key, bool largest = true, unsigned threads = 0) const {
+    auto selected = selectTopK(particles.size(), k, liveKey(key), largest, threads);
+    std::vector<std::shared_ptr<Particle>> result;
+    result.reserve(selected.size());
+    for (const auto& entry : selected) {
+      result.push_back(particles[entry.index]);
+    }
+    return result;
+  }
+
+  // Get the value of key(particle) at position n of the ascending order, e.g. n = size / 2 for the median
+  template <typename Key>
+  double getNthValue(size_t n, Key key, unsigned threads = 0) const {
+    return selectNth(particles.size(), n, liveKey(key), threads);
+  }
+
+  // Build an approximate quantile sketch of key(particle) over all particles
+  template <typename Key>
+  QuantileSketch getQuantileSketch(Key key, unsigned threads = 0) const {
+    return buildQuantileSketch(particles.size(), liveKey(key), threads);
   }
 
   // User input and printing particles
@@ -134,7 +427,121 @@ public:
   }
 
 private:
+  // Slots of removed particles stay (as null pointers with their bit set in removedBits) until
+  // compaction, which only removal calls and compact() run, so const reads never write
   std::vector<std::shared_ptr<Particle>> particles;
+  std::vector<std::uint64_t> removedBits;
+  size_t removedCount = 0;
+  double compactionThreshold = 0.0;
+
+  // Identity: slotIds[slot] is the ID stored in a slot and slotOfId[id] the slot holding an ID
+  // (invalidParticleId once removed). Decay links are indexed by ID: parentOf[id], and the
+  // children of id are childIds[childBegin[id] .. childEnd[id]). IDs are never reused, so every
+  // ID ever assigned keeps 16 bytes here (plus 4 per child link) after its particle is removed;
+  // compaction frees the slots, not this state.
+  std::vector<ParticleId> slotIds;
+  std::vector<ParticleId> slotOfId;
+  std::vector<ParticleId> parentOf;
+  std::vector<std::uint32_t> childBegin, childEnd;
+  std::vector<ParticleId> childIds;
+  ParticleId nextId = 0;
+
+  // Running aggregates, patched by addParticle/removeParticle
+  SummationPolicy summationPolicy = SummationPolicy::Compensated;
+  MomentumAccumulator totalMomentum;
+  std::array<int, particleKindCount + 1> kindCounts{};
+  NeumaierSum totalCharge, totalBaryonNumber;
+  long totalLeptonNumber = 0;
+
+  bool isRemoved(size_t index) const {
+    return index / 64 < removedBits.size() && (removedBits[index / 64] >> (index % 64) & 1);
+  }
+
+  // Logically delete one slot: patch the totals, set its bit and release the particle
+  void tombstone(size_t index) {
+    accumulate(*particles[index], -1);
+    if (removedBits.size() <= index / 64) {
+      removedBits.resize(particles.size() / 64 + 1, 0);
+    }
+    removedBits[index / 64] |= std::uint64_t(1) << (index % 64);
+    particles[index].reset();
+    slotOfId[slotIds[index]] = invalidParticleId;
+    ++removedCount;
+  }
+
+  void requireCompacted() const {
+    if (removedCount > 0) {
+      throw std::logic_error("Catalogue has removals awaiting compaction; call compact() first");
+    }
+  }
+
+  // Wrap a key so removed slots read as NaN, which the selection algorithms skip
+  template <typename Key>
+  auto liveKey(Key& key) const {
+    return [this, &key](size_t index) {
+      return isRemoved(index) ? std::numeric_limits<double>::quiet_NaN() : static_cast<double>(key(*particles[index]));
+    };
+  }
+
+  void checkId(ParticleId id) const {
+    if (id >= nextId) {
+      throw std::out_of_range("Unknown particle ID " + std::to_string(id));
+    }
+  }
+
+  void checkLiveId(ParticleId id) const {
+    checkId(id);
+    if (slotOfId[id] == invalidParticleId) {
+      throw std::out_of_range("Particle ID " + std::to_string(id) + " was removed");
+    }
+  }
+
+  // Reorder the (compacted) slots so that new slot i holds old slot order[i]. Builds new pointer
+  // and ID arrays, so it briefly needs 20 more bytes per particle.
+  void permute(const std::vector<size_t>& order) {
+    std::vector<std::shared_ptr<Particle>> sortedParticles(order.size());
+    std::vector<ParticleId> sortedIds(order.size());
+    for (size_t index = 0; index < order.size(); ++index) {
+      sortedParticles[index] = std::move(particles[order[index]]);
+      sortedIds[index] = slotIds[order[index]];
+      slotOfId[sortedIds[index]] = static_cast<ParticleId>(index);
+    }
+    particles = std::move(sortedParticles);
+    slotIds = std::move(sortedIds);
+  }
+
+  void compactIfSparse() {
+    if (removedCount > 0 && removedCount >= compactionThreshold * particles.size()) {
+      compact();
+    }
+  }
+
+  // Call visit(particle) for every particle that is not removed, in storage order
+  template <typename Visitor>
+  void forEachLive(Visitor visit) const {
+    for (size_t index = 0; index < particles.size(); ++index) {
+      if (!isRemoved(index)) {
+        visit(*particles[index]);
+      }
+    }
+  }
+
+  // Add (sign = 1) or subtract (sign = -1) one particle's contribution to the aggregates
+  void accumulate(const Particle& particle, int sign) {
+    totalMomentum.add(particle.getFourMomentumRef(), sign);
+    kindCounts[static_cast<size_t>(particle.getKind())] += sign;
+    totalCharge.add(sign * particle.getCharge());
+    totalLeptonNumber += sign * particle.getLeptonNumber();
+    totalBaryonNumber.add(sign * particle.getBaryonNumber());
+  }
+
+  void resetAggregates() {
+    totalMomentum = MomentumAccumulator(summationPolicy);
+    kindCounts.fill(0);
+    totalCharge = NeumaierSum();
+    totalLeptonNumber = 0;
+    totalBaryonNumber = NeumaierSum();
+  }
 
   // Helper function to convert a string to lowercase
   static std::string toLowerCase(const std::string& str) {
@@ -0,0 +1,335 @@
+// ParticleColumns.h - Defines ParticleColumns, a column-oriented (structure of arrays) copy of a catalogue.
+// Author: Raul Scanlon, Date: 28/05/2024
+
+#ifndef PARTICLECOLUMNS_H
+#define PARTICLECOLUMNS_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ParticleCatalogue.h"
+#include "ParticleKind.h"
+#include "electron.h"
+#include "muon.h"
+#include "tau.h"
+#include "neutrino.h"
+#include "quark.h"
+#include "gluon.h"
+#include "photon.h"
+#include "WBoson.h"
+#include "ZBoson.h"
+#include "HiggsBoson.h"
+
+// Bits stored in the flags column
+enum ParticleFlag : std::uint8_t {
+  FlagIsolation = 1,   // Muon isolation
+  FlagInteraction = 2  // Neutrino interaction
+};
+
+// Column-oriented particle storage: one vector per field, all of equal length.
+// Strings (lepton/quark names and colours) are dictionary encoded into `strings`.
+// Decay products are not part of the columnar form.
+struct ParticleColumns {
+  static constexpr std::uint16_t noString = 0xFFFF;
+
+  std::vector<ParticleKind> kind;
+  std::vector<double> charge;
+  std::vector<double> spin;
+  std::vector<double> energy;
+  std::vector<double> px;
+  std::vector<double> py;
+  std::vector<double> pz;
+  std::vector<double> restMass;
+  std::vector<double> baryonNumber;
+  std::vector<std::int32_t> leptonNumber;
+  std::vector<std::uint8_t> flags;
+  std::array<std::vector<double>, 4> calorimeter;
+  std::vector<std::uint16_t> nameId;
+  std::vector<std::uint16_t> colourId;
+  std::vector<std::uint16_t> colour2Id;
+
+  std::vector<std::string> strings;
+
+  // Get the number of rows
+  size_t size() const { return kind.size(); }
+
+  // Reserve space for a number of rows in every column
+  void reserve(size_t rows) {
+    forEachColumn([rows](auto& column, bool) { column.reserve(rows); });
+  }
+
+  // Resize every column to a number of rows
+  void resize(size_t rows) {
+    forEachColumn([rows](auto& column, bool) { column.resize(rows); });
+  }
+
+  // Visit every column as visit(column, isMomentum); momentum columns may be stored lossily
+  template <typename Visitor>
+  void forEachColumn(Visitor&& visit) {
+    visitColumnPairs(*this, *this, [&visit](auto& column, auto&, bool isMomentum) { visit(column, isMomentum); });
+  }
+
+  template <typename Visitor>
+  void forEachColumn(Visitor&& visit) const {
+    visitColumnPairs(*this, *this, [&visit](const auto& column, const auto&, bool isMomentum) { visit(column, isMomentum); });
+  }
+
+  // Visit matching columns of two column sets as visit(columnOfA, columnOfB, isMomentum)
+  template <typename A, typename B, typename Visitor>
+  static void visitColumnPairs(A& a, B& b, Visitor&& visit) {
+    visit(a.kind, b.kind, false);
+    visit(a.charge, b.charge, false);
+    visit(a.spin, b.spin, false);
+    visit(a.energy, b.energy, true);
+    visit(a.px, b.px, true);
+    visit(a.py, b.py, true);
+    visit(a.pz, b.pz, true);
+    visit(a.restMass, b.restMass, false);
+    visit(a.baryonNumber, b.baryonNumber, false);
+    visit(a.leptonNumber, b.leptonNumber, false);
+    visit(a.flags, b.flags, false);
+    for (size_t layer = 0; layer < a.calorimeter.size(); ++layer) {
+      visit(a.calorimeter[layer], b.calorimeter[layer], false);
+    }
+    visit(a.nameId, b.nameId, false);
+    visit(a.colourId, b.colourId, false);
+    visit(a.colour2Id, b.colour2Id, false);
+  }
+
+  // Get the number of bytes one row occupies across all columns
+  size_t bytesPerRow() const {
+    size_t bytes = 0;
+    forEachColumn([&bytes](const auto& column, bool) { bytes += sizeof(column[0]); });
+    return bytes;
+  }
+
+  // Add a string to the dictionary (if new) and return its index
+  std::uint16_t internString(const std::string& value) {
+    auto found = stringIndex.find(value);
+    if (found != stringIndex.end()) {
+      return found->second;
+    }
+    if (strings.size() >= noString) {
+      throw std::length_error("Too many distinct strings in particle columns");
+    }
+    std::uint16_t id = static_cast<std::uint16_t>(strings.size());
+    strings.push_back(value);
+    stringIndex.emplace(value, id);
+    return id;
+  }
+
+  // Get a dictionary string, or an empty string for noString
+  const std::string& stringAt(std::uint16_t id) const {
+    static const std::string empty;
+    return id == noString ? empty : strings.at(id);
+  }
+
+  // Replace the string dictionary (used when loading stored columns)
+  void setStrings(const std::vector<std::string>& values) {
+    strings.clear();
+    stringIndex.clear();
+    for (const auto& value : values) {
+      internString(value);
+    }
+  }
+
+  // Append one particle as a new row
+  void append(const Particle& particle) {
+    FourMomentum momentum = particle.getFourMomentum();
+    kind.push_back(particle.getKind());
+    charge.push_back(particle.getCharge());
+    spin.push_back(particle.getSpin());
+    energy.push_back(momentum.getEnergy());
+    px.push_back(momentum.getPx());
+    py.push_back(momentum.getPy());
+    pz.push_back(momentum.getPz());
+    restMass.push_back(particle.getRestMass());
+    baryonNumber.push_back(particle.getBaryonNumber());
+    leptonNumber.push_back(particle.getLeptonNumber());
+
+    std::uint8_t rowFlags = 0;
+    std::array<double, 4> layers = {0, 0, 0, 0};
+    std::uint16_t name = noString, colour = noString, colour2 = noString;
+    switch (particle.getKind()) {
+    case ParticleKind::Electron: {
+      const auto& electron = static_cast<const Electron&>(particle);
+      for (size_t layer = 0; layer < layers.size(); ++layer) {
+        layers[layer] = electron.getCalorimeterEnergy(layer);
+      }
+      break;
+    }
+    case ParticleKind::Muon:
+      rowFlags |= static_cast<const Muon&>(particle).getIsolation() ? FlagIsolation : 0;
+      break;
+    case ParticleKind::Neutrino:
+      rowFlags |= static_cast<const Neutrino&>(particle).getInteraction() ? FlagInteraction : 0;
+      name = internString(particle.getTypeName());
+      break;
+    case ParticleKind::Quark: {
+      const auto& quark = static_cast<const Quark&>(particle);
+      name = internString(quark.getName());
+      colour = internString(quark.getcolourCharge());
+      break;
+    }
+    case ParticleKind::Gluon: {
+      auto colours = static_cast<const Gluon&>(particle).getcolourCharges();
+      colour = internString(colours.first);
+      colour2 = internString(colours.second);
+      break;
+    }
+    default:
+      break;
+    }
+    flags.push_back(rowFlags);
+    for (size_t layer = 0; layer < layers.size(); ++layer) {
+      calorimeter[layer].push_back(layers[layer]);
+    }
+    nameId.push_back(name);
+    colourId.push_back(colour);
+    colour2Id.push_back(colour2);
+  }
+
+  // Rebuild the particle object stored in a row (without an invariant-mass warning)
+  std::shared_ptr<Particle> makeParticle(size_t row) const {
+    QuietInvariantMassCheck quiet;
+    FourMomentum momentum(energy[row], px[row], py[row], pz[row]);
+    switch (kind[row]) {
+    case ParticleKind::Electron: {
+      auto electron = std::make_shared<Electron>(charge[row], spin[row], leptonNumber[row], momentum, restMass[row]);
+      for (size_t layer = 0; layer < calorimeter.size(); ++layer) {
+        electron->setCalorimeterEnergy(layer, calorimeter[layer][row]);
+      }
+      return electron;
+    }
+    case ParticleKind::Muon:
+      return std::make_shared<Muon>(charge[row], spin[row], leptonNumber[row], momentum, restMass[row],
+                                    (flags[row] & FlagIsolation) != 0);
+    case ParticleKind::Tau:
+      return std::make_shared<Tau>(charge[row], spin[row], leptonNumber[row], momentum, restMass[row]);
+    case ParticleKind::Neutrino:
+      return std::make_shared<Neutrino>(charge[row], spin[row], leptonNumber[row], momentum, restMass[row],
+                                        stringAt(nameId[row]), (flags[row] & FlagInteraction) != 0);
+    case ParticleKind::Quark:
+      return std::make_shared<Quark>(charge[row], spin[row], baryonNumber[row], stringAt(colourId[row]),
+                                     momentum, restMass[row], stringAt(nameId[row]));
+    case ParticleKind::Gluon:
+      return std::make_shared<Gluon>(spin[row], momentum, stringAt(colourId[row]), stringAt(colour2Id[row]));
+    case ParticleKind::Photon:
+      return std::make_shared<Photon>(momentum);
+    case ParticleKind::WBoson:
+      return std::make_shared<WBoson>(charge[row], spin[row], momentum, restMass[row]);
+    case ParticleKind::ZBoson:
+      return std::make_shared<ZBoson>(charge[row], spin[row], momentum, restMass[row]);
+    case ParticleKind::HiggsBoson:
+      return std::make_shared<HiggsBoson>(charge[row], spin[row], momentum, restMass[row]);
+    default:
+      throw std::invalid_argument("Cannot rebuild a particle of unknown kind");
+    }
+  }
+
+  // Copy the given rows, in order, into new columns sharing this string dictionary
+  ParticleColumns gather(const std::vector<size_t>& rows) const {
+    ParticleColumns result;
+    result.setStrings(strings);
+    visitColumnPairs(*this, result, [&rows](const auto& source, auto& target, bool) {
+      target.resize(rows.size());
+      for (size_t i = 0; i < rows.size(); ++i) {
+        target[i] = source[rows[i]];
+      }
+    });
+    return result;
+  }
+
+  // Keep only the given rows (ascending), compacting every column in place and giving the freed
+  // capacity back. Columns are shrunk one at a time, so unlike gather the peak is one extra
+  // kept-size column rather than a second copy of all of them
+  void retainRows(const std::vector<size_t>& rows) {
+    forEachColumn([&rows](auto& column, bool) {
+      for (size_t i = 0; i < rows.size(); ++i) {
+        column[i] = column[rows[i]];
+      }
+      column.resize(rows.size());
+      column.shrink_to_fit();
+    });
+  }
+
+  // Remove the rows for which predicate(row) is true, in place; returns the number removed
+  template <typename Predicate>
+  size_t eraseRowsIf(Predicate predicate) {
+    std::vector<size_t> rows;
+    for (size_t row = 0; row < size(); ++row) {
+      if (!predicate(row)) {
+        rows.push_back(row);
+      }
+    }
+    size_t removed = size() - rows.size();
+    if (removed > 0) {
+      retainRows(rows);
+    }
+    return removed;
+  }
+
+  // Append every row of other (string ids are remapped into this dictionary)
+  void appendColumns(const ParticleColumns& other) {
+    size_t first = size();
+    visitColumnPairs(*this, other, [](auto& target, const auto& source, bool) {
+      target.insert(target.end(), source.begin(), source.end());
+    });
+    if (other.strings == strings) {
+      return;
+    }
+    std::vector<std::uint16_t> remap(other.strings.size());
+    for (size_t id = 0; id < other.strings.size(); ++id) {
+      remap[id] = internString(other.strings[id]);
+    }
+    for (auto* column : {&nameId, &colourId, &colour2Id}) {
+      for (size_t row = first; row < column->size(); ++row) {
+        if ((*column)[row] != noString) {
+          (*column)[row] = remap[(*column)[row]];
+        }
+      }
+    }
+  }
+
+  // Append row `row` of other (string ids are remapped into this dictionary)
+  void appendRow(const ParticleColumns& other, size_t row) {
+    visitColumnPairs(*this, other, [row](auto& target, const auto& source, bool) {
+      target.push_back(source[row]);
+    });
+    if (&other.strings == &strings) {
+      return;
+    }
+    for (auto* column : {&nameId, &colourId, &colour2Id}) {
+      std::uint16_t& id = column->back();
+      if (id != noString) {
+        id = internString(other.strings[id]);
+      }
+    }
+  }
+
+  // Build columns from every particle in a catalogue
+  static ParticleColumns fromCatalogue(const ParticleCatalogue& catalogue) {
+    ParticleColumns columns;
+    columns.reserve(catalogue.getTotalCount());
+    for (const auto& particle : catalogue.getParticles()) {
+      columns.append(*particle);
+    }
+    return columns;
+  }
+
+  // Add every row to a catalogue as a particle object
+  void appendTo(ParticleCatalogue& catalogue) const {
+    for (size_t row = 0; row < size(); ++row) {
+      catalogue.addParticle(makeParticle(row));
+    }
+  }
+
+private:
+  std::unordered_map<std::string, std::uint16_t> stringIndex;
+};
+
+#endif // PARTICLECOLUMNS_H
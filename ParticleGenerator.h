@@ -0,0 +1,111 @@
+// ParticleGenerator.h - Defines ParticleGenerator, which fills catalogue columns with random particles.
+// Author: Raul Scanlon, Date: 31/05/2024
+
+#ifndef PARTICLEGENERATOR_H
+#define PARTICLEGENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "ParallelFor.h"
+#include "ParticleColumns.h"
+#include "PhiloxRandom.h"
+
+// Generates synthetic particles with on-shell four-momenta.
+// Row r is drawn from its own RandomStream(seed, r), so it depends only on the seed and its index:
+// never on the thread count, and any range of rows can be regenerated without the rows before it.
+class ParticleGenerator {
+public:
+  double meanPt = 20000.0; // Mean transverse momentum in MeV (exponential spectrum)
+  double etaRange = 2.5;   // Pseudorapidity drawn uniformly from [-etaRange, etaRange]
+  unsigned threads = 0;    // 0 uses every hardware thread
+
+  // Generate `count` particles from a seed
+  ParticleColumns generate(size_t count, std::uint64_t seed) const { return generateRange(0, count, seed); }
+
+  // Generate rows [first, first + count) of the run with this seed, identical to the same rows of generate()
+  ParticleColumns generateRange(std::uint64_t first, size_t count, std::uint64_t seed) const {
+    const auto& table = speciesTable();
+    ParticleColumns columns;
+    std::vector<std::uint16_t> nameIds, colourIds, colour2Ids;
+    for (const auto& species : table) {
+      nameIds.push_back(species.name ? columns.internString(species.name) : ParticleColumns::noString);
+      colourIds.push_back(species.colour ? columns.internString(species.colour) : ParticleColumns::noString);
+      colour2Ids.push_back(species.colour2 ? columns.internString(species.colour2) : ParticleColumns::noString);
+    }
+    columns.resize(count);
+
+    parallelFor(count, threads, [&](size_t begin, size_t end, size_t) {
+      double uniforms[4];
+      for (size_t row = begin; row < end; ++row) {
+        RandomStream random(seed, first + row);
+        random.fillUniform(uniforms, 4);
+        size_t index = std::min(static_cast<size_t>(uniforms[0] * table.size()), table.size() - 1);
+        const Species& species = table[index];
+        double pt = -meanPt * std::log1p(-uniforms[1]);
+        double eta = etaRange * (2.0 * uniforms[2] - 1.0);
+        double phi = 3.141592653589793 * (2.0 * uniforms[3] - 1.0);
+        double px = pt * std::cos(phi), py = pt * std::sin(phi), pz = pt * std::sinh(eta);
+        columns.kind[row] = species.kind;
+        columns.charge[row] = species.charge;
+        columns.spin[row] = species.spin;
+        columns.energy[row] = std::sqrt(px * px + py * py + pz * pz + species.mass * species.mass);
+        columns.px[row] = px;
+        columns.py[row] = py;
+        columns.pz[row] = pz;
+        columns.restMass[row] = species.mass;
+        columns.baryonNumber[row] = species.baryonNumber;
+        columns.leptonNumber[row] = species.leptonNumber;
+        columns.nameId[row] = nameIds[index];
+        columns.colourId[row] = colourIds[index];
+        columns.colour2Id[row] = colour2Ids[index];
+      }
+    });
+    return columns;
+  }
+
+private:
+  struct Species {
+    ParticleKind kind;
+    double charge;
+    double spin;
+    int leptonNumber;
+    double baryonNumber;
+    double mass;
+    const char* name;
+    const char* colour;
+    const char* colour2;
+  };
+
+  // Species drawn with equal probability (masses in MeV, matching main.cpp)
+  static const std::vector<Species>& speciesTable() {
+    static const std::vector<Species> table = {
+      {ParticleKind::Electron, -1, 0.5, 1, 0, 0.511, nullptr, nullptr, nullptr},
+      {ParticleKind::Electron, 1, 0.5, -1, 0, 0.511, nullptr, nullptr, nullptr},
+      {ParticleKind::Muon, -1, 0.5, 1, 0, 105.7, nullptr, nullptr, nullptr},
+      {ParticleKind::Muon, 1, 0.5, -1, 0, 105.7, nullptr, nullptr, nullptr},
+      {ParticleKind::Tau, -1, 0.5, 1, 0, 1777.0, nullptr, nullptr, nullptr},
+      {ParticleKind::Tau, 1, 0.5, -1, 0, 1777.0, nullptr, nullptr, nullptr},
+      {ParticleKind::Neutrino, 0, 0.5, 1, 0, 0.0, "Electron Neutrino", nullptr, nullptr},
+      {ParticleKind::Neutrino, 0, 0.5, -1, 0, 0.0, "Electron Anti-Neutrino", nullptr, nullptr},
+      {ParticleKind::Neutrino, 0, 0.5, 1, 0, 0.0, "Muon Neutrino", nullptr, nullptr},
+      {ParticleKind::Neutrino, 0, 0.5, -1, 0, 0.0, "Muon Anti-Neutrino", nullptr, nullptr},
+      {ParticleKind::Quark, 2.0 / 3.0, 0.5, 0, 1.0 / 3.0, 2.3, "Up Quark", "red", nullptr},
+      {ParticleKind::Quark, -2.0 / 3.0, 0.5, 0, -1.0 / 3.0, 2.3, "Anti-Up Quark", "anti-red", nullptr},
+      {ParticleKind::Quark, -1.0 / 3.0, 0.5, 0, 1.0 / 3.0, 4.8, "Down Quark", "blue", nullptr},
+      {ParticleKind::Quark, 1.0 / 3.0, 0.5, 0, -1.0 / 3.0, 4.8, "Anti-Down Quark", "anti-blue", nullptr},
+      {ParticleKind::Quark, -1.0 / 3.0, 0.5, 0, 1.0 / 3.0, 4180.0, "Bottom Quark", "green", nullptr},
+      {ParticleKind::Quark, 1.0 / 3.0, 0.5, 0, -1.0 / 3.0, 4180.0, "Anti-Bottom Quark", "anti-green", nullptr},
+      {ParticleKind::Gluon, 0, 1, 0, 0, 0.0, nullptr, "red", "anti-blue"},
+      {ParticleKind::Photon, 0, 1, 0, 0, 0.0, nullptr, nullptr, nullptr},
+      {ParticleKind::WBoson, 1, 1, 0, 0, 80400.0, nullptr, nullptr, nullptr},
+      {ParticleKind::WBoson, -1, 1, 0, 0, 80400.0, nullptr, nullptr, nullptr},
+      {ParticleKind::ZBoson, 0, 1, 0, 0, 91200.0, nullptr, nullptr, nullptr},
+      {ParticleKind::HiggsBoson, 0, 0, 0, 0, 126000.0, nullptr, nullptr, nullptr},
+    };
+    return table;
+  }
+};
+
+#endif // PARTICLEGENERATOR_H
@@ -0,0 +1,62 @@
+// ParticleKind.h - Defines the ParticleKind enumeration identifying the concrete particle species.
+// Author: Raul Scanlon, Date: 28/05/2024
+
+#ifndef PARTICLEKIND_H
+#define PARTICLEKIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+// Closed set of particle species stored in a catalogue
+enum class ParticleKind : std::uint8_t {
+  Electron,
+  Muon,
+  Tau,
+  Neutrino,
+  Quark,
+  Gluon,
+  Photon,
+  WBoson,
+  ZBoson,
+  HiggsBoson,
+  Unknown
+};
+
+// Number of concrete kinds (Unknown excluded)
+constexpr std::size_t particleKindCount = static_cast<std::size_t>(ParticleKind::Unknown);
+
+// Get the display name of a particle kind
+inline std::string kindName(ParticleKind kind) {
+  switch (kind) {
+  case ParticleKind::Electron: return "Electron";
+  case ParticleKind::Muon: return "Muon";
+  case ParticleKind::Tau: return "Tau";
+  case ParticleKind::Neutrino: return "Neutrino";
+  case ParticleKind::Quark: return "Quark";
+  case ParticleKind::Gluon: return "Gluon";
+  case ParticleKind::Photon: return "Photon";
+  case ParticleKind::WBoson: return "WBoson";
+  case ParticleKind::ZBoson: return "ZBoson";
+  case ParticleKind::HiggsBoson: return "HiggsBoson";
+  default: return "Unknown";
+  }
+}
+
+// Look up a kind by name, ignoring case; returns Unknown if there is no match
+inline ParticleKind kindFromName(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  for (size_t index = 0; index < particleKindCount; ++index) {
+    ParticleKind kind = static_cast<ParticleKind>(index);
+    std::string candidate = kindName(kind);
+    std::transform(candidate.begin(), candidate.end(), candidate.begin(), ::tolower);
+    if (candidate == name) {
+      return kind;
+    }
+  }
+  return ParticleKind::Unknown;
+}
+
+#endif // PARTICLEKIND_H
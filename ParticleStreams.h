@@ -0,0 +1,193 @@
+// ParticleStreams.h - Defines lazy particle and batch streams (generation, file reading, catalogue scans,
+// decays) and StreamSummary, an aggregate that consumes a stream in constant memory.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef PARTICLESTREAMS_H
+#define PARTICLESTREAMS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "CatalogueReader.h"
+#include "ColumnAggregates.h"
+#include "ColumnKey.h"
+#include "CompensatedSum.h"
+#include "DecayEngine.h"
+#include "Generator.h"
+#include "ParticleCatalogue.h"
+#include "ParticleColumns.h"
+#include "ParticleGenerator.h"
+#include "QuantileSketch.h"
+
+// Every stream below is a coroutine: arguments are copied into its frame, work happens only when
+// the consumer asks for the next value, and only the current batch (or particle) is alive.
+// Chaining them, e.g. decayBatches(generateBatches(...)), keeps memory at one batch per stage.
+
+// Yield rows [0, count) of the generator's run with this seed, batchRows at a time
+inline Generator<ParticleColumns> generateBatches(ParticleGenerator generator, std::uint64_t count, std::uint64_t seed,
+                                                  size_t batchRows = 65536) {
+  batchRows = std::max<size_t>(batchRows, 1);
+  for (std::uint64_t first = 0; first < count; first += batchRows) {
+    ParticleColumns batch = generator.generateRange(first, static_cast<size_t>(std::min<std::uint64_t>(batchRows, count - first)), seed);
+    co_yield batch;
+  }
+}
+
+// Yield the batches of each file in turn
+inline Generator<ParticleColumns> readBatches(std::vector<std::string> paths, std::optional<CatalogueFormat> format = std::nullopt,
+                                              size_t batchRows = 65536) {
+  for (const auto& path : paths) {
+    CatalogueReader reader(path, format, batchRows);
+    ParticleColumns batch;
+    while (reader.next(batch)) {
+      co_yield batch;
+    }
+  }
+}
+
+// Yield the rows of a batch stream one particle object at a time
+inline Generator<std::shared_ptr<Particle>> particlesOf(Generator<ParticleColumns> batches) {
+  for (ParticleColumns& batch : batches) {
+    for (size_t row = 0; row < batch.size(); ++row) {
+      std::shared_ptr<Particle> particle = batch.makeParticle(row);
+      co_yield particle;
+    }
+  }
+}
+
+// Yield the particles of a catalogue in storage order. The catalogue must outlive the stream and
+// must not be modified while it is being read.
+inline Generator<std::shared_ptr<Particle>> scanCatalogue(const ParticleCatalogue& catalogue) {
+  for (std::shared_ptr<Particle> particle : catalogue.getParticles()) {
+    co_yield particle;
+  }
+}
+
+// Kinds that DecayEngine decays
+inline bool isUnstable(ParticleKind kind) {
+  return kind == ParticleKind::Tau || kind == ParticleKind::WBoson || kind == ParticleKind::ZBoson ||
+         kind == ParticleKind::HiggsBoson;
+}
+
+// Yield the final state of one event: the particle itself if it is stable, otherwise its decay
+// products, depth first, with unstable products decayed in turn. Channels come from the engine's
+// stream for eventId, so the first decay matches engine.decay(particle, eventId). Nothing is
+// attached to the parent; each decay is checked with DecayEngine::checkConservation.
+inline Generator<std::shared_ptr<Particle>> decayProducts(DecayEngine engine, std::shared_ptr<Particle> particle,
+                                                          std::uint64_t eventId) {
+  RandomStream random = engine.eventStream(eventId);
+  std::vector<std::shared_ptr<Particle>> pending{std::move(particle)};
+  while (!pending.empty()) {
+    std::shared_ptr<Particle> next = std::move(pending.back());
+    pending.pop_back();
+    std::vector<std::shared_ptr<Particle>> products;
+    {
+      QuietInvariantMassCheck quiet;
+      products = engine.products(*next, random);
+    }
+    if (products.empty()) {
+      co_yield next;
+      continue;
+    }
+    DecayEngine::checkConservation(*next, products);
+    pending.insert(pending.end(), std::make_move_iterator(products.rbegin()), std::make_move_iterator(products.rend()));
+  }
+}
+
+// Replace every unstable row of each batch by its final state, row i of the stream being event
+// firstEventId + i (the numbering of DecayEngine::decayAll). Stable rows are copied as they are.
+inline Generator<ParticleColumns> decayBatches(Generator<ParticleColumns> batches, DecayEngine engine,
+                                               std::uint64_t firstEventId = 0) {
+  std::uint64_t eventId = firstEventId;
+  for (ParticleColumns& batch : batches) {
+    ParticleColumns decayed;
+    decayed.setStrings(batch.strings);
+    decayed.reserve(batch.size());
+    for (size_t row = 0; row < batch.size(); ++row, ++eventId) {
+      if (!isUnstable(batch.kind[row])) {
+        decayed.appendRow(batch, row);
+        continue;
+      }
+      for (const auto& product : decayProducts(engine, batch.makeParticle(row), eventId)) {
+        decayed.append(*product);
+      }
+    }
+    co_yield decayed;
+  }
+}
+
+// Totals, a quantile sketch and a histogram of one key, fed one batch at a time. Sums are
+// compensated across batches so that 10^10 rows lose no more precision than one batch.
+class StreamSummary {
+public:
+  explicit StreamSummary(ColumnKey key = ColumnKey::Energy, unsigned threads = 0) : key(key), threads(threads) {}
+
+  void add(const ParticleColumns& batch) {
+    ColumnTotals totals = computeTotals(batch, threads);
+    rows += totals.rows;
+    momentum.add(totals.energy, totals.px, totals.py, totals.pz);
+    charge.add(totals.charge);
+    baryonNumber.add(totals.baryonNumber);
+    leptonNumber += totals.leptonNumber;
+    for (size_t kind = 0; kind < kindCounts.size(); ++kind) {
+      kindCounts[kind] += totals.kindCounts[kind];
+    }
+    sketch.merge(keyQuantileSketch(batch, key, threads));
+  }
+
+  // Get the totals in the form computeTotals reports them
+  ColumnTotals getTotals() const {
+    ColumnTotals totals;
+    FourMomentum total = momentum.getTotal();
+    totals.rows = rows;
+    totals.energy = total.getEnergy();
+    totals.px = total.getPx();
+    totals.py = total.getPy();
+    totals.pz = total.getPz();
+    totals.charge = charge.value();
+    totals.leptonNumber = leptonNumber;
+    totals.baryonNumber = baryonNumber.value();
+    totals.kindCounts = kindCounts;
+    return totals;
+  }
+
+  const QuantileSketch& getSketch() const { return sketch; }
+
+  // Write totals, quantiles and an approximate equal-width histogram of the key (from the sketch)
+  void print(std::ostream& out, size_t bins = 20) const {
+    getTotals().print(out);
+    if (sketch.empty()) {
+      return;
+    }
+    for (double q : {0.0, 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 1.0}) {
+      out << "q" << q << ' ' << sketch.quantile(q) << '\n';
+    }
+    double low = sketch.getMin(), high = sketch.getMax();
+    double width = (high - low) / static_cast<double>(bins);
+    double below = 0;
+    for (size_t bin = 0; bin < bins && width > 0; ++bin) {
+      double edge = bin + 1 == bins ? high : low + width * static_cast<double>(bin + 1);
+      double upto = sketch.rank(edge) * static_cast<double>(sketch.getCount());
+      out << "bin " << low + width * static_cast<double>(bin) << ' ' << edge << ' '
+          << static_cast<std::uint64_t>(upto - below + 0.5) << '\n';
+      below = upto;
+    }
+  }
+
+private:
+  ColumnKey key;
+  unsigned threads;
+  size_t rows = 0;
+  MomentumAccumulator momentum{SummationPolicy::Compensated};
+  NeumaierSum charge, baryonNumber;
+  long leptonNumber = 0;
+  std::array<size_t, particleKindCount + 1> kindCounts{};
+  QuantileSketch sketch;
+};
+
+#endif // PARTICLESTREAMS_H
@@ -0,0 +1,159 @@
+// ParticleVariant.h - Defines ParticleValue, a closed-set std::variant of every particle species,
+// and VariantCatalogue, which stores those values inline and contiguously.
+// Author: Raul Scanlon, Date: 29/05/2024
+
+#ifndef PARTICLEVARIANT_H
+#define PARTICLEVARIANT_H
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "ParticleCatalogue.h"
+#include "electron.h"
+#include "muon.h"
+#include "tau.h"
+#include "neutrino.h"
+#include "quark.h"
+#include "gluon.h"
+#include "photon.h"
+#include "WBoson.h"
+#include "ZBoson.h"
+#include "HiggsBoson.h"
+
+// Every concrete species by value. All alternatives are final classes, so inside std::visit
+// the compiler knows the exact type and can inline getCharge(), getKind(), etc.
+using ParticleValue = std::variant<Electron, Muon, Tau, Neutrino, Quark, Gluon, Photon, WBoson, ZBoson, HiggsBoson>;
+
+// Get the polymorphic view of a value (adapter to the virtual interface)
+inline const Particle& asParticle(const ParticleValue& value) {
+  return std::visit([](const auto& particle) -> const Particle& { return particle; }, value);
+}
+
+inline Particle& asParticle(ParticleValue& value) {
+  return std::visit([](auto& particle) -> Particle& { return particle; }, value);
+}
+
+// Copy a polymorphic particle into a value
+inline ParticleValue toParticleValue(const Particle& particle) {
+  switch (particle.getKind()) {
+  case ParticleKind::Electron: return static_cast<const Electron&>(particle);
+  case ParticleKind::Muon: return static_cast<const Muon&>(particle);
+  case ParticleKind::Tau: return static_cast<const Tau&>(particle);
+  case ParticleKind::Neutrino: return static_cast<const Neutrino&>(particle);
+  case ParticleKind::Quark: return static_cast<const Quark&>(particle);
+  case ParticleKind::Gluon: return static_cast<const Gluon&>(particle);
+  case ParticleKind::Photon: return static_cast<const Photon&>(particle);
+  case ParticleKind::WBoson: return static_cast<const WBoson&>(particle);
+  case ParticleKind::ZBoson: return static_cast<const ZBoson&>(particle);
+  case ParticleKind::HiggsBoson: return static_cast<const HiggsBoson&>(particle);
+  default: throw std::invalid_argument("Cannot store a particle of unknown kind by value");
+  }
+}
+
+// Catalogue holding particles inline in one vector instead of behind shared pointers
+class VariantCatalogue {
+public:
+  // Add a particle to the catalogue
+  void addParticle(ParticleValue particle) {
+    particles.push_back(std::move(particle));
+  }
+
+  // Construct a particle of type T in place
+  template <typename T, typename... Args>
+  T& emplaceParticle(Args&&... args) {
+    particles.emplace_back(std::in_place_type<T>, std::forward<Args>(args)...);
+    return std::get<T>(particles.back());
+  }
+
+  size_t getTotalCount() const { return particles.size(); }
+
+  const std::vector<ParticleValue>& getParticles() const { return particles; }
+
+  // Get a particle through the virtual interface
+  const Particle& getParticle(size_t index) const { return asParticle(particles.at(index)); }
+
+  // Copy a particle out as a shared pointer, for APIs built on ParticleCatalogue
+  std::shared_ptr<Particle> makeShared(size_t index) const {
+    return std::visit([](const auto& particle) -> std::shared_ptr<Particle> {
+      return std::make_shared<std::decay_t<decltype(particle)>>(particle);
+    }, particles.at(index));
+  }
+
+  // Call visitor(concreteParticle) for every particle
+  template <typename Visitor>
+  void forEach(Visitor&& visitor) const {
+    for (const auto& particle : particles) {
+      std::visit(visitor, particle);
+    }
+  }
+
+  // Get the total four-momentum of all particles
+  FourMomentum getTotalFourMomentum() const {
+    double E = 0, px = 0, py = 0, pz = 0;
+    forEach([&](const auto& particle) {
+      const FourMomentum& momentum = particle.getFourMomentumRef();
+      E += momentum.getEnergy();
+      px += momentum.getPx();
+      py += momentum.getPy();
+      pz += momentum.getPz();
+    });
+    return FourMomentum(E, px, py, pz);
+  }
+
+  // Get the total charge of all particles
+  double getTotalCharge() const {
+    double total = 0;
+    forEach([&total](const auto& particle) { total += particle.getCharge(); });
+    return total;
+  }
+
+  // Get the number of particles of a given kind
+  int getKindCount(ParticleKind kind) const {
+    int count = 0;
+    forEach([&](const auto& particle) { count += particle.getKind() == kind; });
+    return count;
+  }
+
+  // Sort particles by charge (read through std::visit, so getCharge() is not a virtual call)
+  void sortParticlesByCharge() {
+    auto charge = [](const ParticleValue& value) {
+      return std::visit([](const auto& particle) { return particle.getCharge(); }, value);
+    };
+    std::sort(particles.begin(), particles.end(), [&charge](const ParticleValue& a, const ParticleValue& b) {
+      return charge(a) < charge(b);
+    });
+  }
+
+  // Print all particles in the catalogue
+  void printAllParticles() const {
+    forEach([](const auto& particle) { particle.print(); });
+  }
+
+  // Copy every particle of a pointer-based catalogue
+  static VariantCatalogue fromCatalogue(const ParticleCatalogue& catalogue) {
+    VariantCatalogue result;
+    result.particles.reserve(catalogue.getTotalCount());
+    for (const auto& particle : catalogue.getParticles()) {
+      result.particles.push_back(toParticleValue(*particle));
+    }
+    return result;
+  }
+
+  // Copy every particle into a pointer-based catalogue
+  ParticleCatalogue toCatalogue() const {
+    ParticleCatalogue catalogue;
+    for (size_t index = 0; index < particles.size(); ++index) {
+      catalogue.addParticle(makeShared(index));
+    }
+    return catalogue;
+  }
+
+private:
+  std::vector<ParticleValue> particles;
+};
+
+#endif // PARTICLEVARIANT_H
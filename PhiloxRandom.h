@@ -0,0 +1,216 @@
+// PhiloxRandom.h - Defines Philox4x32, a counter-based random number generator, and RandomStream,
+// an independent reproducible stream of random numbers for one (seed, stream id) pair.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef PHILOXRANDOM_H
+#define PHILOXRANDOM_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+// Philox-4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11).
+// A random block is a pure function of a 128-bit counter and a 64-bit key, so any position in
+// any stream can be computed directly without generating the values before it.
+class Philox4x32 {
+public:
+  using Block = std::array<std::uint32_t, 4>;
+
+  explicit Philox4x32(std::uint64_t key) : key0(static_cast<std::uint32_t>(key)), key1(static_cast<std::uint32_t>(key >> 32)) {}
+
+  // Get the four random words for a counter
+  Block operator()(Block counter) const {
+    std::uint32_t k0 = key0, k1 = key1;
+    for (int round = 0; round < 10; ++round) {
+      std::uint64_t product0 = static_cast<std::uint64_t>(multiplier0) * counter[0];
+      std::uint64_t product1 = static_cast<std::uint64_t>(multiplier1) * counter[2];
+      counter = {static_cast<std::uint32_t>(product1 >> 32) ^ counter[1] ^ k0, static_cast<std::uint32_t>(product1),
+                 static_cast<std::uint32_t>(product0 >> 32) ^ counter[3] ^ k1, static_cast<std::uint32_t>(product0)};
+      k0 += weyl0;
+      k1 += weyl1;
+    }
+    return counter;
+  }
+
+  // Number of blocks computed together by generateLanes
+  static constexpr size_t lanes = 8;
+
+  // Compute the blocks for counters (first + i, high) for i in [0, lanes) into words[4][lanes].
+  // The rounds run over independent lanes held in separate arrays, so the compiler turns the
+  // multiplies into SIMD instructions; the results equal operator() for each counter.
+  void generateLanes(std::uint64_t first, std::uint64_t high, std::uint32_t words[4][lanes]) const {
+    std::uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+    for (size_t i = 0; i < lanes; ++i) {
+      c0[i] = static_cast<std::uint32_t>(first + i);
+      c1[i] = static_cast<std::uint32_t>((first + i) >> 32);
+      c2[i] = static_cast<std::uint32_t>(high);
+      c3[i] = static_cast<std::uint32_t>(high >> 32);
+    }
+    std::uint32_t k0 = key0, k1 = key1;
+    for (int round = 0; round < 10; ++round) {
+      for (size_t i = 0; i < lanes; ++i) {
+        std::uint64_t product0 = static_cast<std::uint64_t>(multiplier0) * c0[i];
+        std::uint64_t product1 = static_cast<std::uint64_t>(multiplier1) * c2[i];
+        std::uint32_t next0 = static_cast<std::uint32_t>(product1 >> 32) ^ c1[i] ^ k0;
+        std::uint32_t next2 = static_cast<std::uint32_t>(product0 >> 32) ^ c3[i] ^ k1;
+        c1[i] = static_cast<std::uint32_t>(product1);
+        c3[i] = static_cast<std::uint32_t>(product0);
+        c0[i] = next0;
+        c2[i] = next2;
+      }
+      k0 += weyl0;
+      k1 += weyl1;
+    }
+    for (size_t i = 0; i < lanes; ++i) {
+      words[0][i] = c0[i];
+      words[1][i] = c1[i];
+      words[2][i] = c2[i];
+      words[3][i] = c3[i];
+    }
+  }
+
+private:
+  static constexpr std::uint32_t multiplier0 = 0xD2511F53;
+  static constexpr std::uint32_t multiplier1 = 0xCD9E8D57;
+  static constexpr std::uint32_t weyl0 = 0x9E3779B9;
+  static constexpr std::uint32_t weyl1 = 0xBB67AE85;
+
+  std::uint32_t key0, key1;
+};
+
+// Stream of random numbers identified by (seed, stream), e.g. (run seed, event id) or
+// (run seed, thread id). Different streams never overlap, and the values of a stream depend on
+// nothing else, so one event of a large parallel run can be regenerated on its own.
+// Also a UniformRandomBitGenerator, so it works with the <random> distributions.
+class RandomStream {
+public:
+  using result_type = std::uint64_t;
+
+  RandomStream(std::uint64_t seed, std::uint64_t stream) : generator(seed), stream(stream) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  // Get the next 64 random bits
+  result_type operator()() {
+    if (available == 0) {
+      refill();
+    }
+    size_t index = 4 - 2 * available--;
+    return static_cast<std::uint64_t>(buffer[index]) << 32 | buffer[index + 1];
+  }
+
+  // Uniform double in [0, 1) with 53 random bits
+  double uniform() {
+    std::uint64_t bits = (*this)();
+    return toUniform(static_cast<std::uint32_t>(bits >> 32), static_cast<std::uint32_t>(bits));
+  }
+
+  // Uniform double in [low, high)
+  double uniform(double low, double high) { return low + (high - low) * uniform(); }
+
+  // Uniform integer in [0, n) without modulo bias (Lemire's multiply-shift with rejection)
+  std::uint64_t choose(std::uint64_t n) {
+    std::uint64_t threshold = (0 - n) % n;
+    while (true) {
+      std::uint64_t value = (*this)();
+      unsigned __int128 product = static_cast<unsigned __int128>(value) * n;
+      if (static_cast<std::uint64_t>(product) >= threshold) {
+        return static_cast<std::uint64_t>(product >> 64);
+      }
+    }
+  }
+
+  // Exponentially distributed value with the given mean
+  double exponential(double mean) { return -mean * std::log1p(-uniform()); }
+
+  // Normally distributed value (Box-Muller; the second value of each pair is kept for the next call)
+  double gaussian(double mean = 0.0, double sigma = 1.0) {
+    if (hasSpare) {
+      hasSpare = false;
+      return mean + sigma * spare;
+    }
+    double radius = std::sqrt(-2.0 * std::log1p(-uniform()));
+    double angle = 6.283185307179586 * uniform();
+    spare = radius * std::sin(angle);
+    hasSpare = true;
+    return mean + sigma * radius * std::cos(angle);
+  }
+
+  // Bulk generation: fill out[0 .. count) with uniform doubles in [0, 1).
+  // Produces the same values as repeated uniform() calls, computed Philox4x32::lanes blocks at a time.
+  void fillUniform(double* out, size_t count) {
+    hasSpare = false;
+    size_t i = 0;
+    while (available > 0 && i < count) {
+      out[i++] = uniform();
+    }
+    std::uint32_t words[4][Philox4x32::lanes];
+    for (; i + 2 * Philox4x32::lanes <= count; i += 2 * Philox4x32::lanes) {
+      generator.generateLanes(position, stream, words);
+      position += Philox4x32::lanes;
+      for (size_t lane = 0; lane < Philox4x32::lanes; ++lane) {
+        out[i + 2 * lane] = toUniform(words[0][lane], words[1][lane]);
+        out[i + 2 * lane + 1] = toUniform(words[2][lane], words[3][lane]);
+      }
+    }
+    for (; i < count; ++i) {
+      out[i] = uniform();
+    }
+  }
+
+  // Fill out[0 .. count) with exponential values of the given mean
+  void fillExponential(double* out, size_t count, double mean) {
+    fillUniform(out, count);
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = -mean * std::log1p(-out[i]);
+    }
+  }
+
+  // Fill out[0 .. count) with normal values
+  void fillGaussian(double* out, size_t count, double mean = 0.0, double sigma = 1.0) {
+    fillUniform(out, count);
+    for (size_t i = 0; i + 1 < count; i += 2) {
+      double radius = std::sqrt(-2.0 * std::log1p(-out[i]));
+      double angle = 6.283185307179586 * out[i + 1];
+      out[i] = mean + sigma * radius * std::cos(angle);
+      out[i + 1] = mean + sigma * radius * std::sin(angle);
+    }
+    if (count % 2 == 1) {
+      out[count - 1] = gaussian(mean, sigma);
+    }
+  }
+
+  // Move to an absolute position (in 128-bit blocks) within the stream
+  void seek(std::uint64_t block) {
+    position = block;
+    available = 0;
+    hasSpare = false;
+  }
+
+private:
+  Philox4x32 generator;
+  std::uint64_t stream;
+  std::uint64_t position = 0; // Next block to generate
+  Philox4x32::Block buffer{};
+  int available = 0;          // 64-bit values left in buffer
+  double spare = 0.0;
+  bool hasSpare = false;
+
+  Philox4x32::Block counterFor(std::uint64_t block) const {
+    return {static_cast<std::uint32_t>(block), static_cast<std::uint32_t>(block >> 32),
+            static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)};
+  }
+
+  static double toUniform(std::uint32_t high, std::uint32_t low) {
+    return static_cast<double>((static_cast<std::uint64_t>(high) << 32 | low) >> 11) * 0x1.0p-53;
+  }
+
+  void refill() {
+    buffer = generator(counterFor(position++));
+    available = 2;
+  }
+};
+
+#endif // PHILOXRANDOM_H
@@ -0,0 +1,210 @@
+// QuantileSketch.h - Defines QuantileSketch, a mergeable streaming sketch for approximate quantiles.
+// Author: Raul Scanlon, Date: 02/06/2024
+
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// KLL sketch: a stack of compactors where an item on level h stands for 2^h inputs.
+// Memory stays around 3 * k values however many values are added, and the rank error
+// is roughly 1.7 / k. Sketches built on separate threads merge into one.
+class QuantileSketch {
+public:
+  explicit QuantileSketch(size_t k = 200) : k(std::max<size_t>(k, 8)), levels(1) { limit = capacityTotal(); }
+
+  // Add one value (NaN is ignored)
+  void add(double value) {
+    if (std::isnan(value)) {
+      return;
+    }
+    minValue = std::min(minValue, value);
+    maxValue = std::max(maxValue, value);
+    ++count;
+    levels[0].push_back(value);
+    if (++retained > limit) {
+      compress();
+    }
+  }
+
+  // Fold another sketch into this one
+  void merge(const QuantileSketch& other) {
+    if (other.count == 0) {
+      return;
+    }
+    if (levels.size() < other.levels.size()) {
+      levels.resize(other.levels.size());
+      limit = capacityTotal();
+    }
+    for (size_t level = 0; level < other.levels.size(); ++level) {
+      levels[level].insert(levels[level].end(), other.levels[level].begin(), other.levels[level].end());
+    }
+    count += other.count;
+    retained += other.retained;
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+    while (retained > limit) {
+      compress();
+    }
+  }
+
+  // Get the approximate value at quantile q in [0, 1]; q = 0 and q = 1 are the exact extremes
+  double quantile(double q) const {
+    if (count == 0) {
+      throw std::runtime_error("Quantile of an empty sketch");
+    }
+    if (q <= 0) {
+      return minValue;
+    }
+    if (q >= 1) {
+      return maxValue;
+    }
+    auto items = weightedItems();
+    double target = q * static_cast<double>(count);
+    std::uint64_t cumulative = 0;
+    for (const auto& item : items) {
+      cumulative += item.second;
+      if (static_cast<double>(cumulative) >= target) {
+        return item.first;
+      }
+    }
+    return maxValue;
+  }
+
+  // Get the approximate fraction of values less than or equal to value
+  double rank(double value) const {
+    if (count == 0) {
+      return 0.0;
+    }
+    std::uint64_t below = 0;
+    for (size_t level = 0; level < levels.size(); ++level) {
+      for (double item : levels[level]) {
+        if (item <= value) {
+          below += std::uint64_t(1) << level;
+        }
+      }
+    }
+    return static_cast<double>(below) / static_cast<double>(count);
+  }
+
+  std::uint64_t getCount() const { return count; }
+  size_t getRetained() const { return retained; }
+  double getMin() const { return minValue; }
+  double getMax() const { return maxValue; }
+  bool empty() const { return count == 0; }
+  size_t getK() const { return k; }
+
+  // Get the compactor levels (level h holds items that stand for 2^h inputs), e.g. to ship a
+  // sketch to another process
+  const std::vector<std::vector<double>>& getLevels() const { return levels; }
+
+  // Rebuild a sketch from the state returned by getK(), getLevels(), getCount(), getMin() and getMax()
+  static QuantileSketch fromLevels(size_t k, std::vector<std::vector<double>> levels, std::uint64_t count,
+                                   double minValue, double maxValue) {
+    QuantileSketch sketch(k);
+    std::uint64_t weight = 0;
+    size_t retained = 0;
+    for (size_t level = 0; level < levels.size(); ++level) {
+      if (level >= 63) {
+        throw std::invalid_argument("Quantile sketch has too many levels");
+      }
+      weight += static_cast<std::uint64_t>(levels[level].size()) << level;
+      retained += levels[level].size();
+    }
+    if (weight != count || (count != 0 && !(minValue <= maxValue))) {
+      throw std::invalid_argument("Inconsistent quantile sketch state");
+    }
+    if (!levels.empty()) {
+      sketch.levels = std::move(levels);
+    }
+    sketch.count = count;
+    sketch.retained = retained;
+    sketch.minValue = count == 0 ? sketch.minValue : minValue;
+    sketch.maxValue = count == 0 ? sketch.maxValue : maxValue;
+    sketch.limit = sketch.capacityTotal();
+    while (sketch.retained > sketch.limit) {
+      sketch.compress();
+    }
+    return sketch;
+  }
+
+private:
+  size_t k;
+  std::vector<std::vector<double>> levels;
+  std::uint64_t count = 0;
+  size_t retained = 0;
+  size_t limit = 0; // capacityTotal() for the current number of levels
+  double minValue = std::numeric_limits<double>::infinity();
+  double maxValue = -std::numeric_limits<double>::infinity();
+  std::uint64_t coin = 0x9E3779B97F4A7C15ULL; // Deterministic, so equal inputs give equal sketches
+
+  // Lower levels get geometrically smaller capacities (factor 2/3 per level down)
+  size_t capacity(size_t level) const {
+    double depth = static_cast<double>(levels.size() - 1 - level);
+    return std::max<size_t>(2, static_cast<size_t>(std::ceil(k * std::pow(2.0 / 3.0, depth))));
+  }
+
+  size_t capacityTotal() const {
+    size_t total = 0;
+    for (size_t level = 0; level < levels.size(); ++level) {
+      total += capacity(level);
+    }
+    return total;
+  }
+
+  // Halve the lowest full level: sort it and promote every other item, starting at a random offset
+  void compress() {
+    for (size_t level = 0; level < levels.size(); ++level) {
+      if (levels[level].size() < capacity(level)) {
+        continue;
+      }
+      if (level + 1 == levels.size()) {
+        levels.emplace_back();
+        limit = capacityTotal();
+      }
+      auto& items = levels[level];
+      std::sort(items.begin(), items.end());
+      double leftover = 0;
+      bool odd = items.size() % 2 == 1;
+      if (odd) {
+        leftover = items.back();
+        items.pop_back();
+      }
+      coin ^= coin << 13;
+      coin ^= coin >> 7;
+      coin ^= coin << 17;
+      size_t offset = coin & 1;
+      auto& next = levels[level + 1];
+      for (size_t i = offset; i < items.size(); i += 2) {
+        next.push_back(items[i]);
+      }
+      retained -= items.size() / 2;
+      items.clear();
+      if (odd) {
+        items.push_back(leftover);
+      }
+      return;
+    }
+  }
+
+  // All retained items with their weights, sorted by value
+  std::vector<std::pair<double, std::uint64_t>> weightedItems() const {
+    std::vector<std::pair<double, std::uint64_t>> items;
+    items.reserve(retained);
+    for (size_t level = 0; level < levels.size(); ++level) {
+      for (double item : levels[level]) {
+        items.emplace_back(item, std::uint64_t(1) << level);
+      }
+    }
+    std::sort(items.begin(), items.end());
+    return items;
+  }
+};
+
+#endif // QUANTILESKETCH_H
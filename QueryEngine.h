@@ -0,0 +1,303 @@
+// QueryEngine.h - Defines QueryEngine, which answers text query requests against loaded catalogue columns
+// with one JSON line per request.
+// Author: Raul Scanlon, Date: 01/06/2024
+
+#ifndef QUERYENGINE_H
+#define QUERYENGINE_H
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ColumnAggregates.h"
+#include "ColumnKey.h"
+#include "ParticleColumns.h"
+
+// Read-only query front end used by the socket server.
+// Requests (one per line, whitespace separated):
+//   ping
+//   count [kind]
+//   totals
+//   filter <kind> [limit]
+//   top <k> <key> [kind]
+//   quantile <key> <q> [kind]
+//   histogram <key> <bins> <low> <high> [kind]
+//   sketch <key> [kind]
+// Every answer except filter's and top's rows is a mergeable partial aggregate (top rows carry
+// their key value), so ShardCoordinator can combine the answers of several engines.
+class QueryEngine {
+public:
+  // threads only splits the totals computed here; requests are answered on the calling
+  // thread, since the server already runs them concurrently on its worker pool
+  explicit QueryEngine(ParticleColumns data, unsigned threads = 0)
+    : columns(std::move(data)), totals(computeTotals(columns, threads)) {}
+
+  // Answer one request; errors are reported as {"error": ...} rather than thrown
+  std::string handle(const std::string& request) const {
+    std::istringstream words(request);
+    std::string op;
+    words >> op;
+    try {
+      if (op == "ping") {
+        return "{\"op\":\"ping\",\"ok\":true}";
+      }
+      if (op == "count") {
+        return count(words);
+      }
+      if (op == "totals") {
+        return totalsJson(totals);
+      }
+      if (op == "filter") {
+        return filter(words);
+      }
+      if (op == "top") {
+        return top(words);
+      }
+      if (op == "quantile") {
+        return quantile(words);
+      }
+      if (op == "histogram") {
+        return histogram(words);
+      }
+      if (op == "sketch") {
+        return sketch(words);
+      }
+      throw std::invalid_argument("unknown request '" + op + "'");
+    } catch (const std::exception& error) {
+      return "{\"error\":\"" + jsonEscape(error.what()) + "\"}";
+    }
+  }
+
+  const ParticleColumns& getColumns() const { return columns; }
+  const ColumnTotals& getTotals() const { return totals; }
+
+  // Escape a string for use inside JSON quotes
+  static std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        escaped += ' ';
+      } else {
+        escaped += c;
+      }
+    }
+    return escaped;
+  }
+
+  // Format a number for JSON (non-finite values become null)
+  static std::string jsonNumber(double value) {
+    if (!std::isfinite(value)) {
+      return "null";
+    }
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return std::string(buffer, result.ptr);
+  }
+
+  // Format a totals answer (shared with ShardCoordinator)
+  static std::string totalsJson(const ColumnTotals& totals) {
+    std::string json = "{\"op\":\"totals\",\"rows\":" + std::to_string(totals.rows) +
+                       ",\"E\":" + jsonNumber(totals.energy) + ",\"px\":" + jsonNumber(totals.px) +
+                       ",\"py\":" + jsonNumber(totals.py) + ",\"pz\":" + jsonNumber(totals.pz) +
+                       ",\"charge\":" + jsonNumber(totals.charge) +
+                       ",\"lepton_number\":" + std::to_string(totals.leptonNumber) +
+                       ",\"baryon_number\":" + jsonNumber(totals.baryonNumber) + ",\"counts\":{";
+    bool first = true;
+    for (size_t kind = 0; kind < particleKindCount; ++kind) {
+      if (totals.kindCounts[kind] == 0) {
+        continue;
+      }
+      json += (first ? "\"" : ",\"") + kindName(static_cast<ParticleKind>(kind)) + "\":" + std::to_string(totals.kindCounts[kind]);
+      first = false;
+    }
+    return json + "}}";
+  }
+
+  // Format a quantile answer (shared with ShardCoordinator)
+  static std::string quantileJson(const std::string& keyName, double q, const QuantileSketch& sketch) {
+    std::string value = sketch.empty() ? "null" : jsonNumber(sketch.quantile(q));
+    return "{\"op\":\"quantile\",\"key\":\"" + jsonEscape(keyName) + "\",\"q\":" + jsonNumber(q) +
+           ",\"value\":" + value + ",\"count\":" + std::to_string(sketch.getCount()) + "}";
+  }
+
+  // Format a histogram answer (shared with ShardCoordinator, which sums them)
+  static std::string histogramJson(const std::string& keyName, double low, double high,
+                                   const std::vector<std::uint64_t>& counts, std::uint64_t underflow, std::uint64_t overflow) {
+    std::string json = "{\"op\":\"histogram\",\"key\":\"" + jsonEscape(keyName) + "\",\"low\":" + jsonNumber(low) +
+                       ",\"high\":" + jsonNumber(high) + ",\"underflow\":" + std::to_string(underflow) +
+                       ",\"overflow\":" + std::to_string(overflow) + ",\"counts\":[";
+    for (size_t bin = 0; bin < counts.size(); ++bin) {
+      json += (bin == 0 ? "" : ",") + std::to_string(counts[bin]);
+    }
+    return json + "]}";
+  }
+
+  // Format the full state of a quantile sketch (shared with ShardCoordinator, which merges them)
+  static std::string sketchJson(const std::string& keyName, const QuantileSketch& sketch) {
+    std::string json = "{\"op\":\"sketch\",\"key\":\"" + jsonEscape(keyName) + "\",\"k\":" + std::to_string(sketch.getK()) +
+                       ",\"count\":" + std::to_string(sketch.getCount()) + ",\"min\":" + jsonNumber(sketch.getMin()) +
+                       ",\"max\":" + jsonNumber(sketch.getMax()) + ",\"levels\":[";
+    const auto& levels = sketch.getLevels();
+    for (size_t level = 0; level < levels.size(); ++level) {
+      json += level == 0 ? "[" : ",[";
+      for (size_t i = 0; i < levels[level].size(); ++i) {
+        json += (i == 0 ? "" : ",") + jsonNumber(levels[level][i]);
+      }
+      json += "]";
+    }
+    return json + "]}";
+  }
+
+private:
+  ParticleColumns columns;
+  ColumnTotals totals;
+
+  static ParticleKind parseKind(const std::string& name) {
+    ParticleKind kind = kindFromName(name);
+    if (kind == ParticleKind::Unknown) {
+      throw std::invalid_argument("unknown particle kind '" + name + "'");
+    }
+    return kind;
+  }
+
+  // Parse a whole word as a count of at least 1
+  static size_t parseCount(const std::string& text, const char* what) {
+    long long value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size() || value <= 0) {
+      throw std::invalid_argument(std::string(what) + " must be a positive integer, got '" + text + "'");
+    }
+    return static_cast<size_t>(value);
+  }
+
+  std::string rowJson(size_t row) const {
+    return "{\"row\":" + std::to_string(row) + ",\"kind\":\"" + kindName(columns.kind[row]) +
+           "\",\"charge\":" + jsonNumber(columns.charge[row]) + ",\"E\":" + jsonNumber(columns.energy[row]) +
+           ",\"px\":" + jsonNumber(columns.px[row]) + ",\"py\":" + jsonNumber(columns.py[row]) +
+           ",\"pz\":" + jsonNumber(columns.pz[row]) + "}";
+  }
+
+  std::string count(std::istringstream& words) const {
+    std::string kind;
+    if (!(words >> kind)) {
+      return "{\"op\":\"count\",\"count\":" + std::to_string(totals.rows) + "}";
+    }
+    size_t value = totals.kindCounts[static_cast<size_t>(parseKind(kind))];
+    return "{\"op\":\"count\",\"kind\":\"" + kindName(parseKind(kind)) + "\",\"count\":" + std::to_string(value) + "}";
+  }
+
+  std::string filter(std::istringstream& words) const {
+    std::string name, limitText;
+    size_t limit = 100;
+    if (!(words >> name)) {
+      throw std::invalid_argument("filter needs a kind");
+    }
+    if (words >> limitText) {
+      limit = parseCount(limitText, "filter limit");
+    }
+    ParticleKind kind = parseKind(name);
+    size_t matched = 0;
+    std::string rows;
+    for (size_t row = 0; row < columns.size(); ++row) {
+      if (columns.kind[row] != kind) {
+        continue;
+      }
+      if (matched < limit) {
+        rows += (matched == 0 ? "" : ",") + rowJson(row);
+      }
+      ++matched;
+    }
+    return "{\"op\":\"filter\",\"kind\":\"" + kindName(kind) + "\",\"matched\":" + std::to_string(matched) +
+           ",\"rows\":[" + rows + "]}";
+  }
+
+  std::string top(std::istringstream& words) const {
+    std::string countText, keyName, kindFilter;
+    if (!(words >> countText >> keyName)) {
+      throw std::invalid_argument("top needs a count and a key");
+    }
+    size_t k = parseCount(countText, "top count");
+    words >> kindFilter;
+    ColumnKey key = columnKeyFromName(keyName);
+    auto selected = selectTopK(columns.size(), k, keyFor(key, kindFilter), true, 1);
+    std::string json = "{\"op\":\"top\",\"key\":\"" + jsonEscape(keyName) + "\",\"rows\":[";
+    for (size_t i = 0; i < selected.size(); ++i) {
+      std::string row = rowJson(selected[i].index);
+      row.insert(row.size() - 1, ",\"value\":" + jsonNumber(selected[i].value));
+      json += (i == 0 ? "" : ",") + row;
+    }
+    return json + "]}";
+  }
+
+  // Fixed-width bins over [low, high); values outside are counted as underflow or overflow
+  std::string histogram(std::istringstream& words) const {
+    std::string keyName, kindFilter;
+    size_t bins = 0;
+    double low = 0, high = 0;
+    if (!(words >> keyName >> bins >> low >> high) || bins == 0 || bins > 100000 || !(low < high)) {
+      throw std::invalid_argument("histogram needs a key, 1 to 100000 bins and a range low < high");
+    }
+    words >> kindFilter;
+    auto value = keyFor(columnKeyFromName(keyName), kindFilter);
+    std::vector<std::uint64_t> counts(bins, 0);
+    std::uint64_t underflow = 0, overflow = 0;
+    double scale = static_cast<double>(bins) / (high - low);
+    for (size_t row = 0; row < columns.size(); ++row) {
+      double x = value(row);
+      if (std::isnan(x)) {
+        continue;
+      }
+      if (x < low) {
+        ++underflow;
+      } else if (x >= high) {
+        ++overflow;
+      } else {
+        ++counts[std::min(bins - 1, static_cast<size_t>((x - low) * scale))];
+      }
+    }
+    return histogramJson(keyName, low, high, counts, underflow, overflow);
+  }
+
+  // The full state of a quantile sketch, for merging with sketches from other engines
+  std::string sketch(std::istringstream& words) const {
+    std::string keyName, kindFilter;
+    if (!(words >> keyName)) {
+      throw std::invalid_argument("sketch needs a key");
+    }
+    words >> kindFilter;
+    return sketchJson(keyName, buildQuantileSketch(columns.size(), keyFor(columnKeyFromName(keyName), kindFilter), 1));
+  }
+
+  std::string quantile(std::istringstream& words) const {
+    std::string keyName, kindFilter;
+    double q = 0;
+    if (!(words >> keyName >> q) || q < 0 || q > 1) {
+      throw std::invalid_argument("quantile needs a key and a fraction between 0 and 1");
+    }
+    words >> kindFilter;
+    ColumnKey key = columnKeyFromName(keyName);
+    return quantileJson(keyName, q, buildQuantileSketch(columns.size(), keyFor(key, kindFilter), 1));
+  }
+
+  // Key lookup that yields NaN (i.e. skips the row) for rows outside an optional kind filter
+  std::function<double(size_t)> keyFor(ColumnKey key, const std::string& kindFilter) const {
+    if (kindFilter.empty()) {
+      return [this, key](size_t row) { return columnKeyValue(columns, key, row); };
+    }
+    ParticleKind kind = parseKind(kindFilter);
+    return [this, key, kind](size_t row) {
+      return columns.kind[row] == kind ? columnKeyValue(columns, key, row) : std::numeric_limits<double>::quiet_NaN();
+    };
+  }
+};
+
+#endif // QUERYENGINE_H
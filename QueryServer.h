@@ -0,0 +1,367 @@
+// QueryServer.h - Defines QueryServer, which serves QueryEngine requests over a UNIX domain or loopback TCP socket.
+// Author: Raul Scanlon, Date: 01/06/2024
+
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "QueryEngine.h"
+#include "ThreadPool.h"
+
+// Holds one catalogue in memory and answers newline-delimited requests from many clients.
+// A single epoll thread does all socket I/O; every complete line received in one read is
+// answered as a batch on the worker pool, and responses (one JSON line per request) are sent
+// back in request order. Linux only.
+class QueryServer {
+public:
+  // Turns one request line into one response line; called concurrently from the worker pool
+  using Handler = std::function<std::string(const std::string&)>;
+
+  QueryServer(ParticleColumns columns, unsigned workers = 0)
+    : engine(std::make_unique<QueryEngine>(std::move(columns), workers)), pool(workers) {
+    const QueryEngine* answering = engine.get();
+    handler = [answering](const std::string& request) { return answering->handle(request); };
+    openEventLoop();
+  }
+
+  // Serve another request handler (e.g. a ShardCoordinator) over the same protocol
+  explicit QueryServer(Handler handler, unsigned workers = 0) : pool(workers), handler(std::move(handler)) {
+    openEventLoop();
+  }
+
+  QueryServer(const QueryServer&) = delete;
+  QueryServer& operator=(const QueryServer&) = delete;
+
+  ~QueryServer() {
+    // Let batches still on the pool finish first: they use the handler, completed and wakeFd
+    pool.shutdown();
+    for (int fd : listenFds) {
+      close(fd);
+    }
+    for (auto& entry : connections) {
+      close(entry.first);
+    }
+    if (!socketPath.empty()) {
+      unlink(socketPath.c_str());
+    }
+    close(wakeFd);
+    close(epollFd);
+  }
+
+  // Listen on a UNIX domain socket path (an existing socket file is replaced)
+  void listenUnix(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+      throw std::invalid_argument("Socket path too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bindAndListen(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address), path);
+    socketPath = path;
+  }
+
+  // Listen on 127.0.0.1:port; returns the bound port (useful when port is 0)
+  int listenTcp(int port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    bindAndListen(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address), "127.0.0.1:" + std::to_string(port));
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    return ntohs(address.sin_port);
+  }
+
+  // Run the event loop until stop() is called
+  void run() {
+    std::vector<epoll_event> events(64);
+    while (!stopping) {
+      int ready = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), -1);
+      if (ready < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+      }
+      for (int i = 0; i < ready; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == wakeFd) {
+          drainWakeups();
+        } else if (isListener(fd)) {
+          acceptClients(fd);
+        } else {
+          auto found = connections.find(fd);
+          if (found == connections.end()) {
+            continue;
+          }
+          auto connection = found->second;
+          if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !connection->peerClosed) {
+            readFrom(connection);
+          }
+          if (events[i].events & EPOLLOUT) {
+            flush(connection);
+          }
+          closeIfFinished(connection);
+        }
+      }
+    }
+  }
+
+  // Ask run() to return; safe to call from any thread or a signal handler
+  void stop() {
+    stopping = true;
+    std::uint64_t one = 1;
+    ssize_t ignored = write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+  }
+
+  // Get the engine of a server built from columns (throws for a handler-based server)
+  const QueryEngine& getEngine() const {
+    if (!engine) {
+      throw std::logic_error("QueryServer has no QueryEngine");
+    }
+    return *engine;
+  }
+
+private:
+  static constexpr size_t maxRequestBytes = 1 << 20; // Longest request line accepted
+
+  struct Connection {
+    int fd = -1;
+    std::string input;                // Bytes received but not yet split into lines
+    std::vector<std::string> pending; // Complete requests waiting for the current batch to finish
+    std::string output;               // Responses not yet written to the socket
+    bool busy = false;                // A batch is running on the pool
+    bool peerClosed = false;
+    std::uint32_t watched = EPOLLIN;  // Events currently registered with epoll
+    std::mutex mutex;                 // Guards output and busy against the workers
+  };
+
+  std::unique_ptr<QueryEngine> engine;
+  ThreadPool pool;
+  Handler handler;
+  int epollFd = -1;
+  int wakeFd = -1;
+  std::vector<int> listenFds;
+  std::string socketPath;
+  std::map<int, std::shared_ptr<Connection>> connections;
+  std::mutex completedMutex;
+  std::vector<int> completed; // Connections whose batch finished, handed back to the loop thread
+  std::atomic<bool> stopping{false};
+
+  void openEventLoop() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) {
+      throw std::runtime_error(std::string("Cannot create event loop: ") + std::strerror(errno));
+    }
+    watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+  }
+
+  void watch(int fd, std::uint32_t events, int operation) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, operation, fd, &event) < 0) {
+      throw std::runtime_error(std::string("epoll_ctl failed: ") + std::strerror(errno));
+    }
+  }
+
+  void bindAndListen(int fd, sockaddr* address, socklen_t length, const std::string& name) {
+    if (fd < 0 || bind(fd, address, length) < 0 || listen(fd, 128) < 0) {
+      std::string reason = std::strerror(errno);
+      if (fd >= 0) {
+        close(fd);
+      }
+      throw std::runtime_error("Cannot listen on " + name + ": " + reason);
+    }
+    listenFds.push_back(fd);
+    watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+  }
+
+  bool isListener(int fd) const {
+    return std::find(listenFds.begin(), listenFds.end(), fd) != listenFds.end();
+  }
+
+  void acceptClients(int listenFd) {
+    while (true) {
+      int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return; // EAGAIN: no more pending clients
+      }
+      auto connection = std::make_shared<Connection>();
+      connection->fd = fd;
+      connections[fd] = connection;
+      watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+  }
+
+  void readFrom(const std::shared_ptr<Connection>& connection) {
+    char buffer[65536];
+    while (true) {
+      ssize_t received = read(connection->fd, buffer, sizeof(buffer));
+      if (received > 0) {
+        connection->input.append(buffer, static_cast<size_t>(received));
+        splitLines(*connection);
+        if (connection->input.size() > maxRequestBytes) {
+          // Not a request: answer what came before it, then close instead of buffering more
+          connection->input.clear();
+          std::lock_guard<std::mutex> lock(connection->mutex);
+          connection->peerClosed = true;
+          updateWatch(*connection);
+          break;
+        }
+      } else if (received == 0 || (errno != EAGAIN && errno != EINTR)) {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->peerClosed = true;
+        updateWatch(*connection); // Stop polling for input that will never come
+        break;
+      } else if (errno == EAGAIN) {
+        break;
+      }
+    }
+    dispatch(connection);
+  }
+
+  // Move the complete lines of the input to the pending requests
+  void splitLines(Connection& connection) {
+    size_t start = 0, newline;
+    while ((newline = connection.input.find('\n', start)) != std::string::npos) {
+      std::string line = connection.input.substr(start, newline - start);
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (!line.empty()) {
+        connection.pending.push_back(std::move(line));
+      }
+      start = newline + 1;
+    }
+    connection.input.erase(0, start);
+  }
+
+  // Hand every pending request to the pool as one batch, unless a batch is already running
+  void dispatch(const std::shared_ptr<Connection>& connection) {
+    {
+      std::lock_guard<std::mutex> lock(connection->mutex);
+      if (connection->busy || connection->pending.empty()) {
+        return;
+      }
+      connection->busy = true;
+    }
+    std::vector<std::string> batch;
+    batch.swap(connection->pending);
+    pool.submit([this, connection, batch = std::move(batch)]() {
+      std::string responses;
+      for (const auto& request : batch) {
+        responses += handler(request);
+        responses += '\n';
+      }
+      {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->output += responses;
+        connection->busy = false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(completedMutex);
+        completed.push_back(connection->fd);
+      }
+      std::uint64_t one = 1;
+      ssize_t ignored = write(wakeFd, &one, sizeof(one));
+      (void)ignored;
+    });
+  }
+
+  void drainWakeups() {
+    std::uint64_t value;
+    while (read(wakeFd, &value, sizeof(value)) > 0) {
+    }
+    std::vector<int> finished;
+    {
+      std::lock_guard<std::mutex> lock(completedMutex);
+      finished.swap(completed);
+    }
+    for (int fd : finished) {
+      auto found = connections.find(fd);
+      if (found == connections.end()) {
+        continue;
+      }
+      auto connection = found->second;
+      flush(connection);
+      dispatch(connection);
+      closeIfFinished(connection);
+    }
+  }
+
+  // Write as much buffered output as the socket accepts; wait for EPOLLOUT for the rest
+  void flush(const std::shared_ptr<Connection>& connection) {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    while (!connection->output.empty()) {
+      ssize_t sent = send(connection->fd, connection->output.data(), connection->output.size(), MSG_NOSIGNAL);
+      if (sent > 0) {
+        connection->output.erase(0, static_cast<size_t>(sent));
+      } else if (sent < 0 && errno == EINTR) {
+        continue;
+      } else {
+        if (errno != EAGAIN) {
+          connection->peerClosed = true;
+          connection->output.clear();
+        }
+        break;
+      }
+    }
+    updateWatch(*connection);
+  }
+
+  // Register interest in input (until the peer closes) and output (while responses are queued)
+  void updateWatch(Connection& connection) {
+    std::uint32_t wanted = (connection.peerClosed ? 0u : std::uint32_t(EPOLLIN)) |
+                           (connection.output.empty() ? 0u : std::uint32_t(EPOLLOUT));
+    if (wanted == connection.watched) {
+      return;
+    }
+    // Deregister entirely when idle: EPOLLHUP is reported even with an empty event mask
+    if (wanted == 0) {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+    } else {
+      watch(connection.fd, wanted, connection.watched == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+    }
+    connection.watched = wanted;
+  }
+
+  // Close a connection once the peer has gone and nothing is left to send
+  void closeIfFinished(const std::shared_ptr<Connection>& connection) {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    if (connection->peerClosed && !connection->busy && connection->output.empty()) {
+      if (connection->watched != 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+      }
+      close(connection->fd);
+      connections.erase(connection->fd);
+    }
+  }
+};
+
+#endif // QUERYSERVER_H
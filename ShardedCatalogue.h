@@ -0,0 +1,670 @@
+// ShardedCatalogue.h - Defines a catalogue sharded across processes: selectShard partitions rows,
+// ShardWorkers runs one QueryServer process per shard and ShardCoordinator scatters QueryEngine
+// requests to the shards and merges their partial answers.
+// Author: Raul Scanlon, Date: 04/06/2024
+
+#ifndef SHARDEDCATALOGUE_H
+#define SHARDEDCATALOGUE_H
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "CatalogueMerge.h"
+#include "QueryServer.h"
+
+// How rows are dealt to shards
+enum class ShardPartition {
+  Hash,  // By kind and four-momentum, so equal particles (within the dedup tolerance) share a shard
+  Event  // By event: eventSize consecutive rows stay together, events are dealt round robin
+};
+
+inline ShardPartition shardPartitionFromName(const std::string& name) {
+  if (name == "hash") {
+    return ShardPartition::Hash;
+  }
+  if (name == "event") {
+    return ShardPartition::Event;
+  }
+  throw std::invalid_argument("Unknown partition '" + name + "' (use hash or event)");
+}
+
+// Get the shard a row belongs to; firstRow is the position of the columns' first row in the
+// whole input, so that events split across batches are dealt as one
+inline size_t shardOfRow(const ParticleColumns& columns, size_t row, size_t shards, ShardPartition partition,
+                         size_t eventSize = 0, double tolerance = 0.0, size_t firstRow = 0) {
+  if (partition == ShardPartition::Event) {
+    return ((firstRow + row) / std::max<size_t>(eventSize, 1)) % shards;
+  }
+  return MomentumKeyHash()(MomentumKey::of(columns, row, tolerance)) % shards;
+}
+
+// Append the rows of a batch that belong to one shard, in their original order. Feeding the
+// input through this one batch at a time keeps only the shard's rows and one batch in memory.
+inline void appendShardRows(ParticleColumns& selected, const ParticleColumns& batch, size_t firstRow, size_t shard,
+                            size_t shards, ShardPartition partition, size_t eventSize = 0, double tolerance = 0.0) {
+  if (shards == 0 || shard >= shards) {
+    throw std::invalid_argument("Shard " + std::to_string(shard) + " out of range");
+  }
+  std::vector<size_t> rows;
+  for (size_t row = 0; row < batch.size(); ++row) {
+    if (shardOfRow(batch, row, shards, partition, eventSize, tolerance, firstRow) == shard) {
+      rows.push_back(row);
+    }
+  }
+  selected.appendColumns(batch.gather(rows));
+}
+
+// Copy the rows of one shard, in their original order
+inline ParticleColumns selectShard(const ParticleColumns& columns, size_t shard, size_t shards, ShardPartition partition,
+                                   size_t eventSize = 0, double tolerance = 0.0) {
+  ParticleColumns selected;
+  appendShardRows(selected, columns, 0, shard, shards, partition, eventSize, tolerance);
+  return selected;
+}
+
+// A parsed JSON answer. Only what QueryEngine produces is needed: objects, arrays, strings,
+// numbers, booleans and null. Numbers keep their text so they can be written back unchanged.
+struct JsonValue {
+  enum class Type { Null, Boolean, Number, String, Array, Object };
+
+  Type type = Type::Null;
+  bool boolean = false;
+  std::string text;                                       // String contents, or the number as written
+  std::vector<JsonValue> items;                           // Array elements
+  std::vector<std::pair<std::string, JsonValue>> members; // Object members, in order
+
+  static JsonValue parse(const std::string& json) {
+    size_t position = 0;
+    JsonValue value = parseValue(json, position);
+    skipSpace(json, position);
+    if (position != json.size()) {
+      throw std::runtime_error("Trailing characters in JSON answer");
+    }
+    return value;
+  }
+
+  bool has(const std::string& name) const {
+    for (const auto& member : members) {
+      if (member.first == name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const JsonValue& operator[](const std::string& name) const {
+    for (const auto& member : members) {
+      if (member.first == name) {
+        return member.second;
+      }
+    }
+    throw std::runtime_error("JSON answer has no field '" + name + "'");
+  }
+
+  // Get a number (null, which QueryEngine writes for non-finite values, reads as NaN)
+  double number() const {
+    if (type == Type::Null) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (type != Type::Number) {
+      throw std::runtime_error("JSON value is not a number");
+    }
+    return std::strtod(text.c_str(), nullptr);
+  }
+
+  // Get a count exactly (doubles lose integers above 2^53)
+  std::uint64_t count() const {
+    if (type != Type::Number) {
+      throw std::runtime_error("JSON value is not a number");
+    }
+    return std::stoull(text);
+  }
+
+  // Write the value back as JSON
+  std::string dump() const {
+    switch (type) {
+      case Type::Null: return "null";
+      case Type::Boolean: return boolean ? "true" : "false";
+      case Type::Number: return text;
+      case Type::String: return "\"" + QueryEngine::jsonEscape(text) + "\"";
+      case Type::Array: {
+        std::string json = "[";
+        for (size_t i = 0; i < items.size(); ++i) {
+          json += (i == 0 ? "" : ",") + items[i].dump();
+        }
+        return json + "]";
+      }
+      case Type::Object: {
+        std::string json = "{";
+        for (size_t i = 0; i < members.size(); ++i) {
+          json += (i == 0 ? "\"" : ",\"") + QueryEngine::jsonEscape(members[i].first) + "\":" + members[i].second.dump();
+        }
+        return json + "}";
+      }
+    }
+    return "null";
+  }
+
+private:
+  static void skipSpace(const std::string& json, size_t& position) {
+    while (position < json.size() && std::isspace(static_cast<unsigned char>(json[position]))) {
+      ++position;
+    }
+  }
+
+  static void expect(const std::string& json, size_t& position, char c) {
+    skipSpace(json, position);
+    if (position >= json.size() || json[position] != c) {
+      throw std::runtime_error(std::string("Malformed JSON answer: expected '") + c + "'");
+    }
+    ++position;
+  }
+
+  static std::string parseString(const std::string& json, size_t& position) {
+    expect(json, position, '"');
+    std::string text;
+    while (position < json.size() && json[position] != '"') {
+      if (json[position] == '\\' && position + 1 < json.size()) {
+        ++position;
+      }
+      text += json[position++];
+    }
+    expect(json, position, '"');
+    return text;
+  }
+
+  static JsonValue parseValue(const std::string& json, size_t& position) {
+    skipSpace(json, position);
+    if (position >= json.size()) {
+      throw std::runtime_error("Truncated JSON answer");
+    }
+    JsonValue value;
+    char c = json[position];
+    if (c == '{') {
+      value.type = Type::Object;
+      ++position;
+      skipSpace(json, position);
+      if (position < json.size() && json[position] == '}') {
+        ++position;
+        return value;
+      }
+      do {
+        std::string name = parseString(json, position);
+        expect(json, position, ':');
+        value.members.emplace_back(std::move(name), parseValue(json, position));
+        skipSpace(json, position);
+      } while (position < json.size() && json[position] == ',' && ++position);
+      expect(json, position, '}');
+    } else if (c == '[') {
+      value.type = Type::Array;
+      ++position;
+      skipSpace(json, position);
+      if (position < json.size() && json[position] == ']') {
+        ++position;
+        return value;
+      }
+      do {
+        value.items.push_back(parseValue(json, position));
+        skipSpace(json, position);
+      } while (position < json.size() && json[position] == ',' && ++position);
+      expect(json, position, ']');
+    } else if (c == '"') {
+      value.type = Type::String;
+      value.text = parseString(json, position);
+    } else if (json.compare(position, 4, "null") == 0) {
+      position += 4;
+    } else if (json.compare(position, 4, "true") == 0 || json.compare(position, 5, "false") == 0) {
+      value.type = Type::Boolean;
+      value.boolean = c == 't';
+      position += value.boolean ? 4 : 5;
+    } else {
+      size_t start = position;
+      while (position < json.size() && std::strchr("+-0123456789.eE", json[position]) != nullptr) {
+        ++position;
+      }
+      if (position == start) {
+        throw std::runtime_error("Malformed JSON answer");
+      }
+      value.type = Type::Number;
+      value.text = json.substr(start, position - start);
+    }
+    return value;
+  }
+};
+
+// A blocking client connection to one shard's UNIX socket
+class ShardConnection {
+public:
+  explicit ShardConnection(const std::string& path) : path(path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+      throw std::invalid_argument("Socket path too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+      std::string reason = std::strerror(errno);
+      if (fd >= 0) {
+        close(fd);
+      }
+      throw std::runtime_error("Cannot connect to shard " + path + ": " + reason);
+    }
+  }
+
+  ShardConnection(ShardConnection&& other) noexcept
+    : path(std::move(other.path)), fd(std::exchange(other.fd, -1)), input(std::move(other.input)) {}
+  ShardConnection(const ShardConnection&) = delete;
+  ShardConnection& operator=(const ShardConnection&) = delete;
+  ShardConnection& operator=(ShardConnection&&) = delete;
+
+  ~ShardConnection() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  // Send one request line
+  void send(const std::string& request) {
+    std::string line = request + '\n';
+    size_t sent = 0;
+    while (sent < line.size()) {
+      ssize_t written = ::send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        throw std::runtime_error("Lost connection to shard " + path);
+      }
+      sent += static_cast<size_t>(written);
+    }
+  }
+
+  // Wait for one response line
+  std::string receive() {
+    size_t newline;
+    while ((newline = input.find('\n')) == std::string::npos) {
+      char buffer[65536];
+      ssize_t received = read(fd, buffer, sizeof(buffer));
+      if (received < 0 && errno == EINTR) {
+        continue;
+      }
+      if (received <= 0) {
+        throw std::runtime_error("Lost connection to shard " + path);
+      }
+      input.append(buffer, static_cast<size_t>(received));
+    }
+    std::string line = input.substr(0, newline);
+    input.erase(0, newline + 1);
+    return line;
+  }
+
+private:
+  std::string path;
+  int fd = -1;
+  std::string input; // Bytes received beyond the last complete line
+};
+
+// Starts one worker process per shard, each holding its shard in a QueryServer listening on
+// "<socketPrefix>.<shard>". The loader runs inside the worker, so the shards are loaded in
+// parallel and this process never holds their rows. Workers stop with SIGTERM when this object
+// is destroyed, and also if this process dies. Linux only.
+class ShardWorkers {
+public:
+  using Loader = std::function<ParticleColumns(size_t shard)>;
+
+  ShardWorkers(size_t shards, const std::string& socketPrefix, Loader loader, unsigned threadsPerShard = 0) {
+    if (shards == 0) {
+      throw std::invalid_argument("Need at least one shard");
+    }
+    std::cout.flush();
+    std::cerr.flush();
+    std::vector<int> readyFds;
+    try {
+      for (size_t shard = 0; shard < shards; ++shard) {
+        std::string path = socketPrefix + "." + std::to_string(shard);
+        int ready[2];
+        if (pipe2(ready, O_CLOEXEC) < 0) {
+          throw std::runtime_error(std::string("Cannot create pipe: ") + std::strerror(errno));
+        }
+        pid_t parent = getpid();
+        pid_t pid = fork();
+        if (pid < 0) {
+          close(ready[0]);
+          close(ready[1]);
+          throw std::runtime_error(std::string("Cannot start shard worker: ") + std::strerror(errno));
+        }
+        if (pid == 0) {
+          close(ready[0]);
+          runWorker(shard, path, loader, threadsPerShard, ready[1], parent);
+        }
+        close(ready[1]);
+        readyFds.push_back(ready[0]);
+        workers.push_back(pid);
+        socketPaths.push_back(path);
+      }
+      // Every worker writes "ok" once it listens, or the reason it failed, then closes the pipe
+      for (size_t shard = 0; shard < shards; ++shard) {
+        std::string status = readAll(readyFds[shard]);
+        if (status != "ok") {
+          throw std::runtime_error("Shard " + std::to_string(shard) + " failed to start: " +
+                                   (status.empty() ? "worker exited" : status));
+        }
+      }
+    } catch (...) {
+      for (int fd : readyFds) {
+        close(fd);
+      }
+      stop();
+      throw;
+    }
+    for (int fd : readyFds) {
+      close(fd);
+    }
+  }
+
+  ShardWorkers(const ShardWorkers&) = delete;
+  ShardWorkers& operator=(const ShardWorkers&) = delete;
+
+  ~ShardWorkers() { stop(); }
+
+  const std::vector<std::string>& getSocketPaths() const { return socketPaths; }
+  size_t getShardCount() const { return socketPaths.size(); }
+
+  // Stop the workers and wait for them to exit
+  void stop() {
+    for (pid_t pid : workers) {
+      kill(pid, SIGTERM);
+    }
+    for (pid_t pid : workers) {
+      int status;
+      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+      }
+    }
+    workers.clear();
+  }
+
+private:
+  std::vector<pid_t> workers;
+  std::vector<std::string> socketPaths;
+
+  static QueryServer*& workerServer() {
+    static QueryServer* server = nullptr;
+    return server;
+  }
+
+  static void stopWorker(int) {
+    if (workerServer()) {
+      workerServer()->stop();
+    }
+  }
+
+  static std::string readAll(int fd) {
+    std::string text;
+    char buffer[256];
+    ssize_t received;
+    while ((received = read(fd, buffer, sizeof(buffer))) != 0) {
+      if (received < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      text.append(buffer, static_cast<size_t>(received));
+    }
+    return text;
+  }
+
+  // Body of a worker process; never returns
+  [[noreturn]] static void runWorker(size_t shard, const std::string& path, const Loader& loader, unsigned threads,
+                                     int readyFd, pid_t parent) {
+    int status = 0;
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    try {
+      if (getppid() != parent) {
+        throw std::runtime_error("coordinator exited");
+      }
+      QueryServer server(loader(shard), threads);
+      server.listenUnix(path);
+      workerServer() = &server;
+      std::signal(SIGINT, stopWorker);
+      std::signal(SIGTERM, stopWorker);
+      ssize_t ignored = write(readyFd, "ok", 2);
+      (void)ignored;
+      close(readyFd);
+      readyFd = -1;
+      server.run();
+      workerServer() = nullptr;
+    } catch (const std::exception& error) {
+      if (readyFd >= 0) {
+        ssize_t ignored = write(readyFd, error.what(), std::strlen(error.what()));
+        (void)ignored;
+      } else {
+        std::cerr << "Shard " << shard << ": " << error.what() << '\n';
+      }
+      status = 1;
+    }
+    std::cerr.flush();
+    _exit(status);
+  }
+};
+
+// Answers the QueryEngine protocol for a catalogue split across shards: each request is sent to
+// every shard before any answer is read, so the shards work on it in parallel, and the partial
+// answers are merged. Totals, counts and histograms are summed, top-K lists are merged by value,
+// quantiles come from the merged quantile sketches, and filter and top rows gain a "shard" field
+// next to their shard-local "row". A coordinator answers "sketch" too, so coordinators can in turn
+// be sharded. Requests are answered one at a time.
+class ShardCoordinator {
+public:
+  explicit ShardCoordinator(const std::vector<std::string>& socketPaths) {
+    for (const auto& path : socketPaths) {
+      shards.emplace_back(path);
+    }
+  }
+
+  // Answer one request; errors are reported as {"error": ...} rather than thrown
+  std::string handle(const std::string& request) {
+    std::istringstream words(request);
+    std::string op;
+    words >> op;
+    try {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (op == "ping") {
+        scatter(request);
+        return "{\"op\":\"ping\",\"ok\":true,\"shards\":" + std::to_string(shards.size()) + "}";
+      }
+      if (op == "count") {
+        return count(scatter(request));
+      }
+      if (op == "totals") {
+        return totals(scatter(request));
+      }
+      if (op == "filter") {
+        return filter(words, scatter(request));
+      }
+      if (op == "top") {
+        return top(words, scatter(request));
+      }
+      if (op == "quantile") {
+        return quantile(words);
+      }
+      if (op == "histogram") {
+        return histogram(scatter(request));
+      }
+      if (op == "sketch") {
+        auto answers = scatter(request);
+        return QueryEngine::sketchJson(answers[0]["key"].text, mergeSketches(answers));
+      }
+      throw std::invalid_argument("unknown request '" + op + "'");
+    } catch (const std::exception& error) {
+      return "{\"error\":\"" + QueryEngine::jsonEscape(error.what()) + "\"}";
+    }
+  }
+
+  size_t getShardCount() const { return shards.size(); }
+
+private:
+  std::vector<ShardConnection> shards;
+  std::mutex mutex;
+
+  // Send a request to every shard, then collect the answers in shard order
+  std::vector<JsonValue> scatter(const std::string& request) {
+    for (auto& shard : shards) {
+      shard.send(request);
+    }
+    std::vector<std::string> lines;
+    for (auto& shard : shards) {
+      lines.push_back(shard.receive());
+    }
+    std::vector<JsonValue> answers;
+    for (size_t shard = 0; shard < lines.size(); ++shard) {
+      answers.push_back(JsonValue::parse(lines[shard]));
+      if (answers.back().has("error")) {
+        // The shards reject bad requests alike, so shard 0's message stands for all of them
+        throw std::invalid_argument(answers.back()["error"].text);
+      }
+    }
+    return answers;
+  }
+
+  static std::string count(const std::vector<JsonValue>& answers) {
+    std::uint64_t total = 0;
+    for (const auto& answer : answers) {
+      total += answer["count"].count();
+    }
+    std::string kind = answers[0].has("kind") ? ",\"kind\":" + answers[0]["kind"].dump() : "";
+    return "{\"op\":\"count\"" + kind + ",\"count\":" + std::to_string(total) + "}";
+  }
+
+  static std::string totals(const std::vector<JsonValue>& answers) {
+    ColumnTotals merged;
+    for (const auto& answer : answers) {
+      ColumnTotals part;
+      part.rows = answer["rows"].count();
+      part.energy = answer["E"].number();
+      part.px = answer["px"].number();
+      part.py = answer["py"].number();
+      part.pz = answer["pz"].number();
+      part.charge = answer["charge"].number();
+      part.leptonNumber = std::stol(answer["lepton_number"].text);
+      part.baryonNumber = answer["baryon_number"].number();
+      for (const auto& member : answer["counts"].members) {
+        part.kindCounts[static_cast<size_t>(kindFromName(member.first))] += member.second.count();
+      }
+      merged.merge(part);
+    }
+    return QueryEngine::totalsJson(merged);
+  }
+
+  // A row answered by one shard, tagged with that shard
+  static std::string shardRow(size_t shard, const JsonValue& row) {
+    return "{\"shard\":" + std::to_string(shard) + "," + row.dump().substr(1);
+  }
+
+  static std::string filter(std::istringstream& words, const std::vector<JsonValue>& answers) {
+    std::string name;
+    size_t limit = 100;
+    words >> name >> limit;
+    std::uint64_t matched = 0;
+    std::string rows;
+    size_t written = 0;
+    for (size_t shard = 0; shard < answers.size(); ++shard) {
+      matched += answers[shard]["matched"].count();
+      for (const auto& row : answers[shard]["rows"].items) {
+        if (written < limit) {
+          rows += (written++ == 0 ? "" : ",") + shardRow(shard, row);
+        }
+      }
+    }
+    return "{\"op\":\"filter\",\"kind\":" + answers[0]["kind"].dump() + ",\"matched\":" + std::to_string(matched) +
+           ",\"rows\":[" + rows + "]}";
+  }
+
+  // Each shard sent its own top k, so the global top k is among them
+  static std::string top(std::istringstream& words, const std::vector<JsonValue>& answers) {
+    size_t k = 0;
+    words >> k;
+    std::vector<std::pair<size_t, const JsonValue*>> rows;
+    for (size_t shard = 0; shard < answers.size(); ++shard) {
+      for (const auto& row : answers[shard]["rows"].items) {
+        rows.emplace_back(shard, &row);
+      }
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+      return (*a.second)["value"].number() > (*b.second)["value"].number();
+    });
+    rows.resize(std::min(rows.size(), k));
+    std::string json = "{\"op\":\"top\",\"key\":" + answers[0]["key"].dump() + ",\"rows\":[";
+    for (size_t i = 0; i < rows.size(); ++i) {
+      json += (i == 0 ? "" : ",") + shardRow(rows[i].first, *rows[i].second);
+    }
+    return json + "]}";
+  }
+
+  static QuantileSketch mergeSketches(const std::vector<JsonValue>& answers) {
+    QuantileSketch merged(static_cast<size_t>(answers[0]["k"].count()));
+    for (const auto& answer : answers) {
+      std::vector<std::vector<double>> levels;
+      for (const auto& level : answer["levels"].items) {
+        levels.emplace_back();
+        for (const auto& item : level.items) {
+          levels.back().push_back(item.number());
+        }
+      }
+      merged.merge(QuantileSketch::fromLevels(static_cast<size_t>(answer["k"].count()), std::move(levels),
+                                              answer["count"].count(), answer["min"].number(), answer["max"].number()));
+    }
+    return merged;
+  }
+
+  std::string quantile(std::istringstream& words) {
+    std::string keyName, kindFilter;
+    double q = 0;
+    if (!(words >> keyName >> q) || q < 0 || q > 1) {
+      throw std::invalid_argument("quantile needs a key and a fraction between 0 and 1");
+    }
+    words >> kindFilter;
+    return QueryEngine::quantileJson(keyName, q, mergeSketches(scatter("sketch " + keyName + " " + kindFilter)));
+  }
+
+  static std::string histogram(const std::vector<JsonValue>& answers) {
+    const auto& first = answers[0];
+    std::vector<std::uint64_t> counts(first["counts"].items.size(), 0);
+    std::uint64_t underflow = 0, overflow = 0;
+    for (const auto& answer : answers) {
+      const auto& bins = answer["counts"].items;
+      if (bins.size() != counts.size()) {
+        throw std::runtime_error("shards answered histograms with different binnings");
+      }
+      for (size_t bin = 0; bin < bins.size(); ++bin) {
+        counts[bin] += bins[bin].count();
+      }
+      underflow += answer["underflow"].count();
+      overflow += answer["overflow"].count();
+    }
+    return QueryEngine::histogramJson(first["key"].text, first["low"].number(), first["high"].number(), counts,
+                                      underflow, overflow);
+  }
+};
+
+#endif // SHARDEDCATALOGUE_H
@@ -0,0 +1,64 @@
+// ThreadPool.h - Defines ThreadPool, a fixed set of worker threads running submitted tasks.
+// Author: Raul Scanlon, Date: 01/06/2024
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "ParallelFor.h"
+
+// Runs tasks on a fixed number of threads; submit blocks while the task queue is full.
+// onStart(workerIndex), if given, runs first on each worker, e.g. to pin it to a CPU set.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned threads = 0, size_t queueCapacity = 1024,
+                      std::function<void(unsigned)> onStart = nullptr)
+    : tasks(queueCapacity) {
+    if (threads == 0) {
+      threads = defaultThreadCount();
+    }
+    for (unsigned index = 0; index < threads; ++index) {
+      workers.emplace_back([this, index, onStart]() {
+        if (onStart) {
+          onStart(index);
+        }
+        while (auto task = tasks.pop()) {
+          (*task)();
+        }
+      });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    shutdown();
+  }
+
+  // Finish queued tasks, then stop the workers; later submits fail
+  void shutdown() {
+    tasks.close();
+    for (auto& worker : workers) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+  }
+
+  // Queue a task; returns false once the pool is shutting down
+  bool submit(std::function<void()> task) {
+    return tasks.push(std::move(task));
+  }
+
+  unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+  BoundedQueue<std::function<void()>> tasks;
+  std::vector<std::thread> workers;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,263 @@
+// VersionedCatalogue.h - Defines VersionedCatalogue, a particle catalogue with cheap read-only snapshots,
+// and CatalogueSnapshot, the immutable view those snapshots return.
+// Author: Raul Scanlon, Date: 02/06/2024
+
+#ifndef VERSIONEDCATALOGUE_H
+#define VERSIONEDCATALOGUE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "ColumnAggregates.h"
+#include "ParticleCatalogue.h"
+
+// A fixed-capacity run of particle pointers. Segments referenced by a snapshot are never
+// modified again; the catalogue copies a shared segment before changing it.
+struct CatalogueSegment {
+  static constexpr size_t capacity = 4096;
+  std::vector<std::shared_ptr<Particle>> particles;
+};
+
+// Read-only view of a VersionedCatalogue at one version. It holds references to the segments
+// that existed when it was taken, so it stays valid and unchanged however the catalogue is
+// modified afterwards, and it is safe to read from any number of threads without locking.
+// The particle objects themselves are shared with the catalogue: replace particles with
+// VersionedCatalogue::replaceParticle rather than modifying them through their pointers.
+class CatalogueSnapshot {
+public:
+  CatalogueSnapshot() = default;
+
+  size_t size() const { return totals.rows; }
+  std::uint64_t getVersion() const { return version; }
+
+  // Get a particle by position (O(log segments))
+  std::shared_ptr<const Particle> getParticle(size_t index) const {
+    if (index >= size()) {
+      throw std::out_of_range("Snapshot index out of range");
+    }
+    size_t segment = std::upper_bound(segmentStarts.begin(), segmentStarts.end(), index) - segmentStarts.begin() - 1;
+    return segments[segment]->particles[index - segmentStarts[segment]];
+  }
+
+  // Call visitor(const Particle&) for every particle in order
+  template <typename Visitor>
+  void forEach(Visitor&& visitor) const {
+    for (const auto& segment : segments) {
+      for (const auto& particle : segment->particles) {
+        visitor(static_cast<const Particle&>(*particle));
+      }
+    }
+  }
+
+  // Aggregates as they were when the snapshot was taken
+  const ColumnTotals& getTotals() const { return totals; }
+  FourMomentum getTotalFourMomentum() const { return totals.getTotalFourMomentum(); }
+  double getTotalCharge() const { return totals.charge; }
+  size_t getKindCount(ParticleKind kind) const { return totals.kindCounts[static_cast<size_t>(kind)]; }
+
+  // Copy the view into an ordinary catalogue (the particle objects are shared, not cloned)
+  ParticleCatalogue toCatalogue() const {
+    ParticleCatalogue catalogue;
+    for (const auto& segment : segments) {
+      for (const auto& particle : segment->particles) {
+        catalogue.addParticle(particle);
+      }
+    }
+    return catalogue;
+  }
+
+private:
+  friend class VersionedCatalogue;
+
+  std::vector<std::shared_ptr<const CatalogueSegment>> segments;
+  std::vector<size_t> segmentStarts; // Index of the first particle of each segment
+  ColumnTotals totals;
+  std::uint64_t version = 0;
+};
+
+// Catalogue whose storage is split into reference-counted segments. snapshot() only copies the
+// list of segment pointers, and a write copies at most the one segment it touches if a snapshot
+// still shares it, so isolation costs memory in proportion to what changed rather than a full
+// copy. Writers and snapshot() serialise on a mutex; readers of a snapshot never take it.
+class VersionedCatalogue {
+public:
+  VersionedCatalogue() = default;
+  VersionedCatalogue(const VersionedCatalogue&) = delete;
+  VersionedCatalogue& operator=(const VersionedCatalogue&) = delete;
+
+  // Add a particle to the end of the catalogue
+  void addParticle(const std::shared_ptr<Particle>& particle) {
+    if (!particle) {
+      throw std::invalid_argument("Cannot add a null particle to the catalogue");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (segments.empty() || segments.back()->particles.size() >= CatalogueSegment::capacity) {
+      segmentStarts.push_back(totals.rows);
+      segments.push_back(std::make_shared<CatalogueSegment>());
+      segments.back()->particles.reserve(CatalogueSegment::capacity);
+    }
+    writable(segments.size() - 1).particles.push_back(particle);
+    accumulate(*particle, 1);
+    ++version;
+  }
+
+  // Replace the particle at a position
+  void replaceParticle(size_t index, const std::shared_ptr<Particle>& particle) {
+    if (!particle) {
+      throw std::invalid_argument("Cannot add a null particle to the catalogue");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [segment, offset] = locate(index);
+    auto& slot = writable(segment).particles[offset];
+    accumulate(*slot, -1);
+    slot = particle;
+    accumulate(*particle, 1);
+    ++version;
+  }
+
+  // Remove the particle at a position
+  void removeAt(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    removeAtLocked(index);
+  }
+
+  // Remove a particle, returning false if it is not present
+  bool removeParticle(const std::shared_ptr<Particle>& particle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t index = 0;
+    for (const auto& segment : segments) {
+      auto position = std::find(segment->particles.begin(), segment->particles.end(), particle);
+      if (position != segment->particles.end()) {
+        removeAtLocked(index + (position - segment->particles.begin()));
+        return true;
+      }
+      index += segment->particles.size();
+    }
+    return false;
+  }
+
+  // Sort particles by charge into freshly built segments; existing snapshots keep the old order
+  void sortParticlesByCharge() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::shared_ptr<Particle>> all;
+    all.reserve(totals.rows);
+    for (const auto& segment : segments) {
+      all.insert(all.end(), segment->particles.begin(), segment->particles.end());
+    }
+    std::stable_sort(all.begin(), all.end(), [](const std::shared_ptr<Particle>& a, const std::shared_ptr<Particle>& b) {
+      return a->getCharge() < b->getCharge();
+    });
+    segments.clear();
+    segmentStarts.clear();
+    for (size_t first = 0; first < all.size(); first += CatalogueSegment::capacity) {
+      auto segment = std::make_shared<CatalogueSegment>();
+      segment->particles.assign(all.begin() + first, all.begin() + std::min(all.size(), first + CatalogueSegment::capacity));
+      segmentStarts.push_back(first);
+      segments.push_back(std::move(segment));
+    }
+    ++version;
+  }
+
+  // Take a read-only view of the current contents
+  CatalogueSnapshot snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    CatalogueSnapshot view;
+    view.segments.assign(segments.begin(), segments.end());
+    view.segmentStarts = segmentStarts;
+    view.totals = totals;
+    view.version = version;
+    return view;
+  }
+
+  size_t getTotalCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals.rows;
+  }
+
+  std::uint64_t getVersion() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return version;
+  }
+
+  // Get the number of segments currently copied because a snapshot shared them
+  size_t getCopiedSegmentCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return copiedSegments;
+  }
+
+  // Build a versioned catalogue holding the same particle objects as an ordinary catalogue
+  static std::unique_ptr<VersionedCatalogue> fromCatalogue(const ParticleCatalogue& catalogue) {
+    auto result = std::make_unique<VersionedCatalogue>();
+    for (const auto& particle : catalogue.getParticles()) {
+      result->addParticle(particle);
+    }
+    return result;
+  }
+
+private:
+  mutable std::mutex mutex;
+  std::vector<std::shared_ptr<CatalogueSegment>> segments;
+  std::vector<size_t> segmentStarts;
+  ColumnTotals totals;
+  std::uint64_t version = 0;
+  size_t copiedSegments = 0;
+
+  // Find the segment and offset holding a position
+  std::pair<size_t, size_t> locate(size_t index) const {
+    if (index >= totals.rows) {
+      throw std::out_of_range("Catalogue index out of range");
+    }
+    size_t segment = std::upper_bound(segmentStarts.begin(), segmentStarts.end(), index) - segmentStarts.begin() - 1;
+    return {segment, index - segmentStarts[segment]};
+  }
+
+  // Remove the particle at a position; the caller holds the mutex
+  void removeAtLocked(size_t index) {
+    auto [segment, offset] = locate(index);
+    auto& particles = writable(segment).particles;
+    accumulate(*particles[offset], -1);
+    particles.erase(particles.begin() + offset);
+    bool emptied = particles.empty();
+    if (emptied) { // Drops the segment, and with it the particles reference
+      segments.erase(segments.begin() + segment);
+      segmentStarts.erase(segmentStarts.begin() + segment);
+    }
+    for (size_t later = segment + (emptied ? 0 : 1); later < segmentStarts.size(); ++later) {
+      --segmentStarts[later];
+    }
+    ++version;
+  }
+
+  // Get a segment for modification, copying it first if a snapshot still references it.
+  // Snapshots are only taken under the mutex, so a use count of one cannot grow meanwhile.
+  CatalogueSegment& writable(size_t segment) {
+    auto& pointer = segments[segment];
+    if (pointer.use_count() > 1) {
+      auto copy = std::make_shared<CatalogueSegment>();
+      copy->particles.reserve(CatalogueSegment::capacity);
+      copy->particles = pointer->particles;
+      pointer = std::move(copy);
+      ++copiedSegments;
+    }
+    return *pointer;
+  }
+
+  // Add (sign = 1) or subtract (sign = -1) one particle's contribution to the totals
+  void accumulate(const Particle& particle, int sign) {
+    const FourMomentum& momentum = particle.getFourMomentumRef();
+    totals.rows += sign;
+    totals.energy += sign * momentum.getEnergy();
+    totals.px += sign * momentum.getPx();
+    totals.py += sign * momentum.getPy();
+    totals.pz += sign * momentum.getPz();
+    totals.charge += sign * particle.getCharge();
+    totals.leptonNumber += sign * particle.getLeptonNumber();
+    totals.baryonNumber += sign * particle.getBaryonNumber();
+    totals.kindCounts[static_cast<size_t>(particle.getKind())] += sign;
+  }
+};
+
+#endif // VERSIONEDCATALOGUE_H
@@ -10,7 +10,7 @@
 #include <iostream>
 
 // Derived class for Electrons
-class Electron : public Lepton {
+class Electron final : public Lepton {
 public:
   Electron(double charge, double spin, int leptonNumber, const FourMomentum& momentum, double restMass, bool isAntiparticle = false)
     : Lepton(charge, spin, leptonNumber, momentum, restMass, "Electron", isAntiparticle), calorimeterEnergies({0, 0, 0, 0}) {}
@@ -54,6 +54,8 @@ public:
               << "Layer 4: " << calorimeterEnergies[3] << std::endl;
   }
 
+  ParticleKind getKind() const override { return ParticleKind::Electron; }
+
   // Set energy deposited in a specific calorimeter layer
   void setCalorimeterEnergy(size_t layer, double energy) {
     if (layer < calorimeterEnergies.size()) {
@@ -7,7 +7,7 @@
 #include "Boson.h"
 
 // Derived class for Gluons
-class Gluon : public Boson {
+class Gluon final : public Boson {
 public:
   Gluon(double spin, const FourMomentum& momentum, const std::string& colour1, const std::string& colour2)
     : Boson(0, spin, momentum, 0), colourCharge1(colour1), colourCharge2(colour2) {}
@@ -51,6 +51,7 @@ public:
   }
 
   std::string getTypeName() const override { return "Gluon"; }
+  ParticleKind getKind() const override { return ParticleKind::Gluon; }
 
   double getCharge() const override { return charge; }
   double getSpin() const override { return spin; }
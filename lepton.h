@@ -59,6 +59,7 @@ public:
   FourMomentum getFourMomentum() const override { return momentum; }
   double getRestMass() const override { return restMass; }
   std::string getTypeName() const override { return name; }
+  int getLeptonNumber() const override { return leptonNumber; }
 
 protected:
   int leptonNumber;
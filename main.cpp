@@ -16,10 +16,16 @@
 #include "HiggsBoson.h"
 #include "gluon.h"
 #include "electron.h"
+#include "MemoryAccounting.h"
+#include "BatchCli.h"
+#include "DecayEngine.h"
+
+int main(int argc, char** argv) {
+  // Any arguments select the non-interactive batch driver
+  if (argc > 1) {
+    return BatchCli().run(argc, argv);
+  }
 
-void handleDecay(const std::shared_ptr<Particle>& particle, ParticleCatalogue& catalogue);
-
-int main() {
   ParticleCatalogue catalogue;
 
   // FourMomentum instances
@@ -73,12 +79,14 @@ int main() {
   auto quarkBottom = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "green", bottomQuarkMomentum, 4180.0, "Bottom Quark", false);
   auto antiquarkBottom = std::make_shared<Quark>(-1.0 / 3.0, 0.5, -1.0 / 3.0, "anti-green", bottomQuarkMomentum, 4180.0, "Anti-Bottom Quark", true);
 
-  // Handle decays
-  handleDecay(tau, catalogue);
-  handleDecay(higgs, catalogue);
-  handleDecay(wboson, catalogue);
-  handleDecay(antiwboson, catalogue);
-  handleDecay(zboson, catalogue);
+  // Handle decays, each as its own reproducible event
+  DecayEngine decayEngine(2024);
+  decayEngine.setLog(&std::cout);
+  decayEngine.decay(tau, 0);
+  decayEngine.decay(higgs, 1);
+  decayEngine.decay(wboson, 2);
+  decayEngine.decay(antiwboson, 3);
+  decayEngine.decay(zboson, 4);
 
   // Add particles to catalogue
   catalogue.addParticle(electron);
@@ -117,126 +125,3 @@ int main() {
 
   return 0;
 }
-
-void handleDecay(const std::shared_ptr<Particle>& particle, ParticleCatalogue& catalogue) {
-  // Handle the decays of particles
-  if (auto tau = std::dynamic_pointer_cast<Tau>(particle)) {
-    // Tau decays
-    std::shared_ptr<Particle> decayProduct1, decayProduct2, decayProduct3;
-    std::cout << "Handling Tau decay" << std::endl;
-
-    if (rand() % 2 == 0) {
-      // Leptonic decay
-      decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, tau->getFourMomentum(), 0.511);
-      decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, 1, tau->getFourMomentum(), 0.0, "Neutrino", false, false);
-      decayProduct3 = std::make_shared<Neutrino>(0.0, 0.5, -1, tau->getFourMomentum(), 0.0, "Anti-Neutrino", false, true);
-    } else {
-      // Hadronic decay
-      decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "anti-red", tau->getFourMomentum(), 2.3, "Anti-Up Quark", true);
-      decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "blue", tau->getFourMomentum(), 4.8, "Down Quark", false);
-      decayProduct3 = std::make_shared<Neutrino>(0.0, 0.5, -1, tau->getFourMomentum(), 0.0, "Anti-Neutrino", false, true);
-    }
-
-    std::cout << "Decay products created: " << std::endl;
-    std::cout << "Decay product 1: " << decayProduct1->getTypeName() << " (Charge: " << decayProduct1->getCharge() << ")" << std::endl;
-    std::cout << "Decay product 2: " << decayProduct2->getTypeName() << " (Charge: " << decayProduct2->getCharge() << ")" << std::endl;
-    std::cout << "Decay product 3: " << decayProduct3->getTypeName() << " (Charge: " << decayProduct3->getCharge() << ")" << std::endl;
-
-    tau->addDecayProduct(decayProduct1);
-    tau->addDecayProduct(decayProduct2);
-    tau->addDecayProduct(decayProduct3);
-
-    tau->checkDecayConsistency();
-
-  } else if (auto higgs = std::dynamic_pointer_cast<HiggsBoson>(particle)) {
-    // Higgs decays
-    std::shared_ptr<Particle> decayProduct1, decayProduct2;
-    std::cout << "Handling Higgs decay" << std::endl;
-    switch (rand() % 4) {
-      case 0:
-        decayProduct1 = std::make_shared<ZBoson>(0.0, 1.0, FourMomentum(45.6, 0.0, 0.0, 0.0), 91200.0);
-        decayProduct2 = std::make_shared<ZBoson>(0.0, 1.0, FourMomentum(45.6, 0.0, 0.0, 0.0), 91200.0);
-        break;
-      case 1:
-        decayProduct1 = std::make_shared<WBoson>(1.0, 1.0, FourMomentum(40.2, 0.0, 0.0, 0.0), 80400.0);
-        decayProduct2 = std::make_shared<WBoson>(1.0, 1.0, FourMomentum(40.2, 0.0, 0.0, 0.0), 80400.0, true);
-        break;
-      case 2:
-        decayProduct1 = std::make_shared<Photon>(FourMomentum(62.55, 0.0, 0.0, 0.0));
-        decayProduct2 = std::make_shared<Photon>(FourMomentum(62.55, 0.0, 0.0, 0.0));
-        break;
-      case 3:
-        decayProduct1 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "red", FourMomentum(4180.0, 0.0, 0.0, 0.0), 4.18, "Bottom Quark", false);
-        decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", FourMomentum(4180.0, 0.0, 0.0, 0.0), 4.18, "Anti-Bottom", true);
-        break;
-    }
-
-    std::cout << "Decay products created: " << std::endl;
-    std::cout << "Decay product 1: " << decayProduct1->getTypeName() << " (Charge: " << decayProduct1->getCharge() << ")" << std::endl;
-    std::cout << "Decay product 2: " << decayProduct2->getTypeName() << " (Charge: " << decayProduct2->getCharge() << ")" << std::endl;
-    
-    higgs->addDecayProduct(decayProduct1);
-    higgs->addDecayProduct(decayProduct2);
-    higgs->checkDecayConsistency();
-
-  } else if (auto wboson = std::dynamic_pointer_cast<WBoson>(particle)) {
-    // W boson decays
-    std::shared_ptr<Particle> decayProduct1, decayProduct2;
-    if (wboson->getCharge() > 0) {
-      std::cout << "Handling W+ Boson decay" << std::endl;
-
-      if (rand() % 2 == 0) {
-        // Leptonic decay
-        decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, wboson->getFourMomentum(), 0.511, true); // Positron (anti-electron)
-        decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, 1, wboson->getFourMomentum(), 0.0, "Neutrino", false, false);
-      } else {
-        // Hadronic decay
-        decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "red", wboson->getFourMomentum(), 2.3, "up", false); // Up quark
-        decayProduct2 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "blue", wboson->getFourMomentum(), 4.8, "anti-down", true); // Anti-down quark
-      }
-    } else {
-      std::cout << "Handling W- Boson decay" << std::endl;
-
-      if (rand() % 2 == 0) {
-        // Leptonic decay
-        decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, wboson->getFourMomentum(), 0.511); // Electron
-        decayProduct2 = std::make_shared<Neutrino>(0.0, 0.5, -1, wboson->getFourMomentum(), 0.0, "Anti-Neutrino", false, true); // Anti-neutrino
-      } else {
-        // Hadronic decay
-        decayProduct1 = std::make_shared<Quark>(-1.0 / 3.0, 0.5, 1.0 / 3.0, "blue", wboson->getFourMomentum(), 4.8, "down", false); // Down quark
-        decayProduct2 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "red", wboson->getFourMomentum(), 2.3, "anti-up", true); // Anti-up quark
-      }
-    }
-
-    std::cout << "Decay products created: " << std::endl;
-    std::cout << "Decay product 1: " << decayProduct1->getTypeName() << " (Charge: " << decayProduct1->getCharge() << ")" << std::endl;
-    std::cout << "Decay product 2: " << decayProduct2->getTypeName() << " (Charge: " << decayProduct2->getCharge() << ")" << std::endl;
-
-    wboson->addDecayProduct(decayProduct1);
-    wboson->addDecayProduct(decayProduct2);
-    wboson->checkDecayConsistency();
-
-  } else if (auto zboson = std::dynamic_pointer_cast<ZBoson>(particle)) {
-    // Z boson decays
-    std::shared_ptr<Particle> decayProduct1, decayProduct2;
-    std::cout << "Handling Z Boson decay" << std::endl;
-
-    if (rand() % 2 == 0) {
-      // Leptonic decay
-      decayProduct1 = std::make_shared<Electron>(-1.0, 0.5, 1, zboson->getFourMomentum(), 0.511);
-      decayProduct2 = std::make_shared<Electron>(-1.0, 0.5, -1, zboson->getFourMomentum(), 0.511, true);
-    } else {
-      // Hadronic decay
-      decayProduct1 = std::make_shared<Quark>(2.0 / 3.0, 0.5, 1.0 / 3.0, "red", zboson->getFourMomentum(), 2.3, "Up Quark", false);
-      decayProduct2 = std::make_shared<Quark>(2.0 / 3.0, 0.5, -1.0 / 3.0, "anti-red", zboson->getFourMomentum(), 2.3, "Anti-Up Quark", true);
-    }
-
-    std::cout << "Decay products created: " << std::endl;
-    std::cout << "Decay product 1: " << decayProduct1->getTypeName() << " (Charge: " << decayProduct1->getCharge() << ")" << std::endl;
-    std::cout << "Decay product 2: " << decayProduct2->getTypeName() << " (Charge: " << decayProduct2->getCharge() << ")" << std::endl;
-    
-    zboson->addDecayProduct(decayProduct1);
-    zboson->addDecayProduct(decayProduct2);
-    zboson->checkDecayConsistency();
-  }
-}
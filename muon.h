@@ -7,7 +7,7 @@
 #include "Lepton.h"
 
 // Derived class for Muons
-class Muon : public Lepton {
+class Muon final : public Lepton {
 public:
   Muon(double charge, double spin, int leptonNumber, const FourMomentum& momentum, double restMass, bool isolation, bool isAntiparticle = false)
     : Lepton(charge, spin, leptonNumber, momentum, restMass, "Muon", isAntiparticle), isolation(isAntiparticle ? !isolation : isolation) {}
@@ -22,7 +22,10 @@ public:
     std::cout << "Muon: Isolation = " << (isolation ? "true" : "false") << std::endl;
   }
 
+  ParticleKind getKind() const override { return ParticleKind::Muon; }
+
   bool getIsolation() const { return isolation; }
+  void setIsolation(bool isolated) { isolation = isolated; }
 
 private:
   bool isolation;
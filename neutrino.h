@@ -7,7 +7,7 @@
 #include "Lepton.h"
 
 // Derived class for Neutrinos
-class Neutrino : public Lepton {
+class Neutrino final : public Lepton {
 public:
   Neutrino(double charge, double spin, int leptonNumber, const FourMomentum& momentum, double restMass, const std::string& name, bool interaction = false, bool isAntiparticle = false)
     : Lepton(charge, spin, leptonNumber, momentum, restMass, name, isAntiparticle), interaction(interaction) {}
@@ -47,6 +47,8 @@ public:
     std::cout << "Neutrino: Interaction = " << (interaction ? "Yes" : "No") << std::endl;
   }
 
+  ParticleKind getKind() const override { return ParticleKind::Neutrino; }
+
   bool getInteraction() const { return interaction; }
 
 private:
@@ -7,10 +7,33 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 #include "FourMomentum.h"
+#include "ParticleKind.h"
 #include <stdexcept>
 #include <cmath>
 
+// While one of these is alive, particles constructed on the same thread skip the invariant-mass
+// warning. Bulk paths (rebuilding objects from columns, decaying whole batches) construct one
+// particle per row and would otherwise print a line for most rows. Keep one alive only around
+// the construction itself, never across a co_yield, so a suspended stream cannot silence its
+// consumer.
+class QuietInvariantMassCheck {
+public:
+  QuietInvariantMassCheck() { ++depth(); }
+  ~QuietInvariantMassCheck() { --depth(); }
+  QuietInvariantMassCheck(const QuietInvariantMassCheck&) = delete;
+  QuietInvariantMassCheck& operator=(const QuietInvariantMassCheck&) = delete;
+
+  static bool active() { return depth() > 0; }
+
+private:
+  static int& depth() {
+    static thread_local int value = 0;
+    return value;
+  }
+};
+
 // Abstract base class for all particles
 class Particle {
 public:
@@ -22,10 +45,35 @@ public:
   virtual double getSpin() const = 0;
   virtual FourMomentum getFourMomentum() const = 0;
   virtual std::string getTypeName() const = 0;
+  virtual ParticleKind getKind() const { return ParticleKind::Unknown; }
   virtual int getLeptonNumber() const { return 0; }
   virtual double getBaryonNumber() const { return 0.0; }
   virtual double getRestMass() const = 0;
 
+  // Non-virtual accessors for code that already knows the concrete type (see ParticleVariant.h)
+  const FourMomentum& getFourMomentumRef() const { return momentum; }
+
+  // Replace the four-momentum, e.g. after a change of reference frame (see LorentzTransform.h)
+  void setFourMomentum(const FourMomentum& value) { momentum = value; }
+
+  // Decay products attached to this particle (empty for species that do not decay here)
+  virtual const std::vector<std::shared_ptr<Particle>>& getDecayProducts() const {
+    static const std::vector<std::shared_ptr<Particle>> none;
+    return none;
+  }
+
+  // Consistency check for decay products; throws if their charges do not sum to this particle's charge.
+  // ConservationChecker.h checks every conservation law for many decays at once without throwing.
+  void checkDecayConsistency() const {
+    double totalCharge = 0;
+    for (const auto& product : getDecayProducts()) {
+      totalCharge += product->getCharge();
+    }
+    if (std::abs(totalCharge - getCharge()) > 1e-2) {
+      throw std::runtime_error("Decay products' charges do not sum up to the original " + getTypeName() + "'s charge");
+    }
+  }
+
   // Method to validate particle properties
   virtual void validate() const {
     // Allow valid charge values: -1, 0, 1, and valid fractional charges for quarks
@@ -39,7 +87,7 @@ public:
   // Method to check if the invariant mass matches the particle's rest mass
   virtual void checkInvariantMass() const {
     double invariantMass = momentum.invariantMass();
-    if (std::abs(invariantMass - restMass) > 1e-6) {
+    if (std::abs(invariantMass - restMass) > 1e-6 && !QuietInvariantMassCheck::active()) {
       std::cerr << "Invariant mass does not match particle rest mass. "
                 << "Invariant Mass: " << invariantMass << ", Rest Mass: " << restMass << std::endl;
     }
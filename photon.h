@@ -7,7 +7,7 @@
 #include "Boson.h"
 
 // Derived class for Photons
-class Photon : public Boson {
+class Photon final : public Boson {
 public:
   Photon(const FourMomentum& momentum)
     : Boson(0, 1, momentum, 0) {}
@@ -23,6 +23,7 @@ public:
   }
 
   std::string getTypeName() const override { return "Photon"; }
+  ParticleKind getKind() const override { return ParticleKind::Photon; }
 
   double getCharge() const override { return charge; }
   double getSpin() const override { return spin; }
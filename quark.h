@@ -8,10 +8,10 @@
 #include <iostream>
 
 // Derived class for Quarks
-class Quark : public Particle {
+class Quark final : public Particle {
 public:
   Quark(double charge, double spin, double baryonNumber, const std::string& colour, const FourMomentum& momentum, double restMass, const std::string& name, bool isAntiparticle = false)
-      : Particle(charge, spin, momentum, restMass, isAntiparticle), baryonNumber(baryonNumber), colourCharge(colourCharge), name(name) {}
+      : Particle(charge, spin, momentum, restMass, isAntiparticle), baryonNumber(baryonNumber), colourCharge(colour), name(name) {}
 
   // Copy constructor
   Quark(const Quark& other)
@@ -36,6 +36,7 @@ public:
   Quark& operator=(Quark&& other) noexcept {
     if (this != &other) {
       Particle::operator=(std::move(other));
+      baryonNumber = other.baryonNumber;
       colourCharge = std::move(other.colourCharge);
       name = std::move(other.name);
     }
@@ -59,6 +60,8 @@ public:
   double getSpin() const override { return spin; }
   FourMomentum getFourMomentum() const override { return momentum; }
   std::string getTypeName() const override { return "Quark"; }
+  ParticleKind getKind() const override { return ParticleKind::Quark; }
+  std::string getName() const { return name; }
   double getBaryonNumber() const override { return baryonNumber; }
   std::string getcolourCharge() const { return colourCharge; }
   double getRestMass() const override { return restMass; }
@@ -10,7 +10,7 @@
 #include <cmath>
 
 // Derived class for Taus
-class Tau : public Lepton {
+class Tau final : public Lepton {
 public:
   Tau(double charge, double spin, int leptonNumber, const FourMomentum& momentum, double restMass, bool isAntiparticle = false)
     : Lepton(charge, spin, leptonNumber, momentum, restMass, "Tau", isAntiparticle) {}
@@ -32,26 +32,17 @@ public:
     std::cout << std::endl;
   }
 
+  ParticleKind getKind() const override { return ParticleKind::Tau; }
+
   // Add a decay product
   void addDecayProduct(const std::shared_ptr<Particle>& particle) {
     decayProducts.push_back(particle);
   }
 
-  const std::vector<std::shared_ptr<Particle>>& getDecayProducts() const {
+  const std::vector<std::shared_ptr<Particle>>& getDecayProducts() const override {
     return decayProducts;
   }
 
-  // Consistency check for decay products
-  void checkDecayConsistency() const {
-    double totalCharge = 0;
-    for (const auto& product : decayProducts) {
-      totalCharge += product->getCharge();
-    }
-    if (std::abs(totalCharge - getCharge()) > 1e-2) {
-      throw std::runtime_error("Decay products' charges do not sum up to the original Z Boson's charge");
-    }
-  }
-
 private:
   std::vector<std::shared_ptr<Particle>> decayProducts;
 };
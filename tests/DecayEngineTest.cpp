@@ -0,0 +1,69 @@
+// DecayEngineTest.cpp - Checks that tau decays conserve charge, lepton number and baryon number for both charges.
+// Author: Raul Scanlon, Date: 05/06/2024
+// Build from the repository root: g++ -std=c++17 -pthread -I. tests/DecayEngineTest.cpp -o decay_engine_test
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include "DecayEngine.h"
+#include "ParticleGenerator.h"
+#include "tau.h"
+
+static int failures = 0;
+
+static void expect(bool condition, const std::string& message) {
+  if (!condition) {
+    std::cerr << "FAILED: " << message << std::endl;
+    ++failures;
+  }
+}
+
+// Decay one tau over enough events to hit both channels and compare the product sums to the parent
+static void checkTau(double charge, int leptonNumber, bool isAntiparticle) {
+  DecayEngine engine(2024);
+  FourMomentum momentum(1777.0, 0.0, 0.0, 0.0);
+  for (std::uint64_t event = 0; event < 64; ++event) {
+    auto tau = std::make_shared<Tau>(charge, 0.5, leptonNumber, momentum, 1777.0, isAntiparticle);
+    std::string name = (tau->getCharge() > 0 ? "tau+" : "tau-") + std::string(" event ") + std::to_string(event);
+    try {
+      expect(engine.decay(tau, event), name + " did not decay");
+    } catch (const std::exception& error) {
+      expect(false, name + " threw: " + error.what());
+      continue;
+    }
+    double productCharge = 0, productBaryonNumber = 0;
+    int productLeptonNumber = 0;
+    for (const auto& product : tau->getDecayProducts()) {
+      productCharge += product->getCharge();
+      productLeptonNumber += product->getLeptonNumber();
+      productBaryonNumber += product->getBaryonNumber();
+    }
+    expect(std::abs(productCharge - tau->getCharge()) < 1e-9, name + " does not conserve charge");
+    expect(productLeptonNumber == tau->getLeptonNumber(), name + " does not conserve lepton number");
+    expect(std::abs(productBaryonNumber) < 1e-9, name + " does not conserve baryon number");
+  }
+}
+
+int main() {
+  // Products carry the parent's four-momentum, so their invariant masses do not match
+  QuietInvariantMassCheck quiet;
+  checkTau(-1.0, 1, false); // tau-
+  checkTau(-1.0, -1, true); // tau+ built as an antiparticle, as in main.cpp
+  checkTau(1.0, -1, false); // tau+ as the generator builds it
+
+  // Every unstable particle of a generated catalogue decays without a consistency error
+  ParticleColumns columns = ParticleGenerator().generate(20000, 7);
+  std::vector<std::shared_ptr<Particle>> particles;
+  for (size_t row = 0; row < columns.size(); ++row) {
+    particles.push_back(columns.makeParticle(row));
+  }
+  try {
+    DecayEngine(7).decayAll(particles);
+  } catch (const std::exception& error) {
+    expect(false, std::string("decayAll threw: ") + error.what());
+  }
+
+  if (failures == 0) {
+    std::cout << "DecayEngineTest passed" << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}